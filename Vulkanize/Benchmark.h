@@ -0,0 +1,267 @@
+#pragma once
+
+// Startup stage timing, which every build prints, and the machine readable benchmark
+//report.
+// The benchmark build (VulkanizeBenchmark.vcxproj, which defines VULKANIZE_BENCHMARK)
+//runs a fixed workload: a set number of frames, headless by default, with the camera
+//moving along a path that only depends on the frame number, so two runs draw exactly
+//the same thing. At the end everything needed to compare runs across drivers and
+//code versions goes into a JSON file.
+
+#include "DeviceMemoryAllocator.h"
+#include "FrameStats.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Wall clock time of the named startup stages. Some stages run in parallel, so each
+//one also knows when it started: the startup took as long as the last stage to end,
+//which is less than the sum of all of them.
+class StageTimings {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Stage {
+		std::string name;
+		// Since the StageTimings was created
+		double startMs;
+		double milliseconds;
+	};
+
+	StageTimings() : epoch(Clock::now()) {}
+
+	StageTimings(const StageTimings&) = delete;
+	StageTimings& operator=(const StageTimings&) = delete;
+
+	// Runs stage() and records how long it took. Can be called from several threads
+	//at once.
+	template <typename Function>
+	void measure(const char* name, Function&& stage) {
+		Clock::time_point start = Clock::now();
+		stage();
+		Clock::time_point end = Clock::now();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		stages.push_back({ name, toMs(start - epoch), toMs(end - start) });
+	}
+
+	// In the order they started
+	std::vector<Stage> all() const {
+		std::vector<Stage> sorted;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			sorted = stages;
+		}
+		std::stable_sort(sorted.begin(), sorted.end(), [](const Stage& a, const Stage& b) { return a.startMs < b.startMs; });
+		return sorted;
+	}
+
+	// From the start until the last stage ended
+	double wallMilliseconds() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		double end = 0.0;
+		for (const Stage& stage : stages) {
+			end = std::max(end, stage.startMs + stage.milliseconds);
+		}
+		return end;
+	}
+
+	// All stages added up, as if they had run one after the other
+	double totalMilliseconds() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		double total = 0.0;
+		for (const Stage& stage : stages) {
+			total += stage.milliseconds;
+		}
+		return total;
+	}
+
+	void print(std::ostream& out) const {
+		out << std::fixed << std::setprecision(1);
+		out << "startup: " << wallMilliseconds() << " ms, the stages add up to " << totalMilliseconds() << " ms" << std::endl;
+		for (const Stage& stage : all()) {
+			out << "  " << std::setw(24) << std::left << stage.name << std::right
+				<< " at " << std::setw(7) << stage.startMs << " ms, took " << std::setw(7) << stage.milliseconds << " ms" << std::endl;
+		}
+		out << std::defaultfloat;
+	}
+
+private:
+	Clock::time_point epoch;
+	mutable std::mutex mutex;
+	std::vector<Stage> stages;
+
+	static double toMs(Clock::duration duration) {
+		return std::chrono::duration<double, std::milli>(duration).count();
+	}
+};
+
+// Collects the results of a benchmark run and writes them as one JSON object
+class BenchmarkReport {
+public:
+	void setDevice(const VkPhysicalDeviceProperties& properties) {
+		deviceName = properties.deviceName;
+		vendorID = properties.vendorID;
+		deviceID = properties.deviceID;
+		driverVersion = properties.driverVersion;
+		apiVersion = properties.apiVersion;
+	}
+
+	// What was run, so a report can be matched with others of the same workload
+	void setWorkload(const std::string& mode, uint32_t frames, uint32_t drawCount, uint32_t framesInFlight, uint32_t recordThreads, VkExtent2D extent) {
+		workload.clear();
+		workload.push_back({ "mode", quote(mode) });
+		workload.push_back({ "frames", std::to_string(frames) });
+		workload.push_back({ "drawCount", std::to_string(drawCount) });
+		workload.push_back({ "framesInFlight", std::to_string(framesInFlight) });
+		workload.push_back({ "recordThreads", std::to_string(recordThreads) });
+		workload.push_back({ "width", std::to_string(extent.width) });
+		workload.push_back({ "height", std::to_string(extent.height) });
+	}
+
+	void setStartup(const StageTimings& timings) {
+		startupStages = timings.all();
+		startupWallMs = timings.wallMilliseconds();
+	}
+
+	void setRun(uint64_t frames, double seconds) {
+		runFrames = frames;
+		runSeconds = seconds;
+	}
+
+	void addMetric(const char* name, const LatencyHistogram& histogram) {
+		metrics.push_back({ name, histogram });
+	}
+
+	void addHeap(uint32_t heapIndex, bool deviceLocal, const MemoryHeapStats& stats) {
+		heaps.push_back({ heapIndex, deviceLocal, stats });
+	}
+
+	// Only known when the tracking or pool host allocator is used
+	void setHostMemory(size_t bytesInUse, size_t peakBytes) {
+		hostMemoryTracked = true;
+		hostBytesInUse = bytesInUse;
+		hostPeakBytes = peakBytes;
+	}
+
+	bool write(const std::string& path) const {
+		std::ofstream file(path, std::ios::trunc);
+		if (!file.is_open()) {
+			std::cerr << "failed to open " << path << " for the benchmark report" << std::endl;
+			return false;
+		}
+		write(file);
+		if (!file) {
+			std::cerr << "failed to write the benchmark report to " << path << std::endl;
+			return false;
+		}
+		std::cout << "benchmark report written to " << path << std::endl;
+		return true;
+	}
+
+	void write(std::ostream& out) const {
+		out << std::fixed << std::setprecision(4);
+		out << "{" << std::endl;
+
+		out << "  \"device\": {\"name\": " << quote(deviceName) << ", \"vendorID\": " << vendorID << ", \"deviceID\": " << deviceID
+			<< ", \"driverVersion\": " << driverVersion << ", \"apiVersion\": " << quote(versionString(apiVersion)) << "}," << std::endl;
+
+		out << "  \"workload\": {";
+		for (size_t i = 0; i < workload.size(); i++) {
+			out << (i > 0 ? ", " : "") << quote(workload[i].first) << ": " << workload[i].second;
+		}
+		out << "}," << std::endl;
+
+		out << "  \"startup\": {\"totalMs\": " << startupWallMs << ", \"stages\": [";
+		for (size_t i = 0; i < startupStages.size(); i++) {
+			const StageTimings::Stage& stage = startupStages[i];
+			out << (i > 0 ? "," : "") << std::endl << "    {\"name\": " << quote(stage.name)
+				<< ", \"startMs\": " << stage.startMs << ", \"ms\": " << stage.milliseconds << "}";
+		}
+		out << std::endl << "  ]}," << std::endl;
+
+		out << "  \"run\": {\"frames\": " << runFrames << ", \"seconds\": " << runSeconds
+			<< ", \"fps\": " << (runSeconds > 0.0 ? runFrames / runSeconds : 0.0) << "}," << std::endl;
+
+		out << "  \"frameTimesMs\": {";
+		for (size_t i = 0; i < metrics.size(); i++) {
+			const LatencyHistogram& histogram = metrics[i].second;
+			out << (i > 0 ? "," : "") << std::endl << "    " << quote(metrics[i].first) << ": {"
+				<< "\"samples\": " << histogram.sampleCount()
+				<< ", \"p50\": " << histogram.percentile(0.50) / 1e6
+				<< ", \"p95\": " << histogram.percentile(0.95) / 1e6
+				<< ", \"p99\": " << histogram.percentile(0.99) / 1e6
+				<< ", \"max\": " << histogram.largest() / 1e6 << "}";
+		}
+		out << std::endl << "  }," << std::endl;
+
+		out << "  \"memory\": {\"heaps\": [";
+		for (size_t i = 0; i < heaps.size(); i++) {
+			const Heap& heap = heaps[i];
+			out << (i > 0 ? "," : "") << std::endl << "    {\"index\": " << heap.index
+				<< ", \"deviceLocal\": " << (heap.deviceLocal ? "true" : "false")
+				<< ", \"blocks\": " << heap.stats.deviceMemoryCount
+				<< ", \"allocations\": " << heap.stats.allocationCount
+				<< ", \"bytesAllocated\": " << heap.stats.bytesAllocated
+				<< ", \"bytesUsed\": " << heap.stats.bytesUsed << "}";
+		}
+		out << std::endl << "  ]";
+		if (hostMemoryTracked) {
+			out << ", \"hostBytesInUse\": " << hostBytesInUse << ", \"hostPeakBytes\": " << hostPeakBytes;
+		}
+		out << "}" << std::endl;
+
+		out << "}" << std::endl;
+		out << std::defaultfloat;
+	}
+
+private:
+	struct Heap {
+		uint32_t index;
+		bool deviceLocal;
+		MemoryHeapStats stats;
+	};
+
+	std::string deviceName;
+	uint32_t vendorID = 0;
+	uint32_t deviceID = 0;
+	uint32_t driverVersion = 0;
+	uint32_t apiVersion = 0;
+
+	// Key and already formatted JSON value
+	std::vector<std::pair<std::string, std::string>> workload;
+	std::vector<StageTimings::Stage> startupStages;
+	double startupWallMs = 0.0;
+	uint64_t runFrames = 0;
+	double runSeconds = 0.0;
+	std::vector<std::pair<std::string, LatencyHistogram>> metrics;
+	std::vector<Heap> heaps;
+
+	bool hostMemoryTracked = false;
+	size_t hostBytesInUse = 0;
+	size_t hostPeakBytes = 0;
+
+	static std::string quote(const std::string& value) {
+		std::string quoted = "\"";
+		for (char c : value) {
+			if (c == '"' || c == '\\') {
+				quoted += '\\';
+			}
+			// Control characters don't show up in device names, drop them if they do
+			if ((unsigned char) c >= 0x20) {
+				quoted += c;
+			}
+		}
+		return quoted + "\"";
+	}
+
+	static std::string versionString(uint32_t version) {
+		return std::to_string(VK_VERSION_MAJOR(version)) + "." + std::to_string(VK_VERSION_MINOR(version)) + "." + std::to_string(VK_VERSION_PATCH(version));
+	}
+};
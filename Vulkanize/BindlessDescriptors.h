@@ -0,0 +1,331 @@
+#pragma once
+
+// One big descriptor set with every texture and storage buffer in it (bindless).
+// Instead of a descriptor set per draw, updated and bound before each draw, all
+//resources live in two large arrays: binding 0 holds combined image samplers and
+//binding 1 storage buffers. The set is bound once per command buffer, and a draw
+//only passes the array indices of what it uses (in push constants, say). Adding a
+//resource takes a free slot from the array's free list and writes that one
+//descriptor.
+// This needs VK_EXT_descriptor_indexing. Update after bind lets slots be written
+//while the set is bound in command buffers that are still pending, as long as
+//those don't use the slots. Partially bound lets the unused slots stay empty.
+//A released slot could still be in use by a frame in flight, so it only goes back
+//to the free list framesInFlight frames later.
+// In GLSL (with GL_EXT_nonuniform_qualifier) the set looks like:
+//   layout(set = 1, binding = 0) uniform sampler2D textures[];
+//   layout(set = 1, binding = 1) buffer Buffers { uint data[]; } buffers[];
+//(set 1, after the frame uniforms of FrameAllocator.h)
+// https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#VK_EXT_descriptor_indexing
+
+#include "VHandle.h"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+class BindlessDescriptors {
+public:
+	enum Binding {
+		Textures = 0,
+		StorageBuffers = 1,
+		BINDING_COUNT
+	};
+
+	static const uint32_t INVALID_SLOT = UINT32_MAX;
+
+	BindlessDescriptors(const VDevice& device, const VkAllocationCallbacks* allocator)
+		: device(device), allocator(allocator) {}
+
+	BindlessDescriptors(const BindlessDescriptors&) = delete;
+	BindlessDescriptors& operator=(const BindlessDescriptors&) = delete;
+
+	// Whether the device can do all of this. The features have to be enabled on the
+	//device (see enableFeatures) before init is called.
+	static bool isSupported(const VkPhysicalDeviceDescriptorIndexingFeaturesEXT& features) {
+		return features.runtimeDescriptorArray
+			&& features.descriptorBindingPartiallyBound
+			&& features.descriptorBindingUpdateUnusedWhilePending
+			&& features.descriptorBindingSampledImageUpdateAfterBind
+			&& features.descriptorBindingStorageBufferUpdateAfterBind
+			&& features.shaderSampledImageArrayNonUniformIndexing;
+	}
+
+	// The subset of the supported features that we use, to chain into
+	//VkDeviceCreateInfo
+	static VkPhysicalDeviceDescriptorIndexingFeaturesEXT enableFeatures(const VkPhysicalDeviceDescriptorIndexingFeaturesEXT& supported) {
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT enabled = {};
+		enabled.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+		enabled.runtimeDescriptorArray = VK_TRUE;
+		enabled.descriptorBindingPartiallyBound = VK_TRUE;
+		enabled.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+		enabled.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+		enabled.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+		enabled.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+		// Optional, lets a draw index the buffers with values that differ per invocation
+		enabled.shaderStorageBufferArrayNonUniformIndexing = supported.shaderStorageBufferArrayNonUniformIndexing;
+		return enabled;
+	}
+
+	// Creates the set layout, the pool and the set. The capacities are lowered to what
+	//the device allows for update after bind descriptors.
+	void init(const VkPhysicalDeviceDescriptorIndexingPropertiesEXT& properties, uint32_t framesInFlight,
+		uint32_t textureCapacity = 16384, uint32_t bufferCapacity = 4096) {
+		this->framesInFlight = framesInFlight;
+
+		// A combined image sampler counts as both a sampler and a sampled image
+		uint32_t textureLimit = std::min(
+			std::min(properties.maxDescriptorSetUpdateAfterBindSampledImages, properties.maxDescriptorSetUpdateAfterBindSamplers),
+			std::min(properties.maxPerStageDescriptorUpdateAfterBindSampledImages, properties.maxPerStageDescriptorUpdateAfterBindSamplers));
+		uint32_t bufferLimit = std::min(properties.maxDescriptorSetUpdateAfterBindStorageBuffers, properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers);
+		uint32_t capacities[BINDING_COUNT] = { std::min(textureCapacity, textureLimit), std::min(bufferCapacity, bufferLimit) };
+		// And both arrays together are limited as well
+		uint32_t resourceLimit = properties.maxPerStageUpdateAfterBindResources;
+		if (capacities[Textures] + capacities[StorageBuffers] > resourceLimit) {
+			capacities[StorageBuffers] = std::min(capacities[StorageBuffers], resourceLimit / 4);
+			capacities[Textures] = std::min(capacities[Textures], resourceLimit - capacities[StorageBuffers]);
+		}
+		if (capacities[Textures] == 0 || capacities[StorageBuffers] == 0) {
+			std::cout << "bindless descriptors: no room for update after bind descriptors, disabled" << std::endl;
+			return;
+		}
+
+		const VkDescriptorType types[BINDING_COUNT] = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER };
+
+		VkDescriptorSetLayoutBinding bindings[BINDING_COUNT] = {};
+		VkDescriptorBindingFlagsEXT bindingFlags[BINDING_COUNT] = {};
+		VkDescriptorPoolSize poolSizes[BINDING_COUNT] = {};
+		for (uint32_t i = 0; i < BINDING_COUNT; i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorType = types[i];
+			bindings[i].descriptorCount = capacities[i];
+			bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+			bindingFlags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT;
+			poolSizes[i].type = types[i];
+			poolSizes[i].descriptorCount = capacities[i];
+		}
+
+		VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo = {};
+		bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+		bindingFlagsInfo.bindingCount = BINDING_COUNT;
+		bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.pNext = &bindingFlagsInfo;
+		layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+		layoutInfo.bindingCount = BINDING_COUNT;
+		layoutInfo.pBindings = bindings;
+
+		if (vkCreateDescriptorSetLayout(device, &layoutInfo, allocator, setLayout.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create bindless descriptor set layout!");
+		}
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+		poolInfo.maxSets = 1;
+		poolInfo.poolSizeCount = BINDING_COUNT;
+		poolInfo.pPoolSizes = poolSizes;
+
+		if (vkCreateDescriptorPool(device, &poolInfo, allocator, pool.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create bindless descriptor pool!");
+		}
+
+		// Freed together with the pool
+		VkDescriptorSetLayout layouts[] = { setLayout };
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = pool;
+		allocInfo.descriptorSetCount = 1;
+		allocInfo.pSetLayouts = layouts;
+
+		if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate bindless descriptor set!");
+		}
+
+		// Highest slot at the back, so the lowest ones are handed out first
+		for (uint32_t i = 0; i < BINDING_COUNT; i++) {
+			arrays[i].capacity = capacities[i];
+			arrays[i].freeSlots.resize(capacities[i]);
+			for (uint32_t slot = 0; slot < capacities[i]; slot++) {
+				arrays[i].freeSlots[slot] = capacities[i] - 1 - slot;
+			}
+		}
+
+		std::cout << "bindless descriptors: " << capacities[Textures] << " textures, " << capacities[StorageBuffers] << " storage buffers" << std::endl;
+	}
+
+	bool isEnabled() const {
+		return descriptorSet != VK_NULL_HANDLE;
+	}
+
+	// For the pipeline layouts, VK_NULL_HANDLE when disabled
+	VkDescriptorSetLayout layout() const {
+		return setLayout;
+	}
+
+	// Puts a texture in a free slot and returns the slot, or INVALID_SLOT when the
+	//array is full. The descriptor is written by the next flush().
+	uint32_t addTexture(VkImageView imageView, VkSampler sampler, VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+		uint32_t slot = takeSlot(Textures);
+		if (slot != INVALID_SLOT) {
+			VkDescriptorImageInfo imageInfo = {};
+			imageInfo.sampler = sampler;
+			imageInfo.imageView = imageView;
+			imageInfo.imageLayout = layout;
+			pendingImages.push_back({ slot, imageInfo });
+		}
+		return slot;
+	}
+
+	uint32_t addStorageBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE) {
+		uint32_t slot = takeSlot(StorageBuffers);
+		if (slot != INVALID_SLOT) {
+			VkDescriptorBufferInfo bufferInfo = {};
+			bufferInfo.buffer = buffer;
+			bufferInfo.offset = offset;
+			bufferInfo.range = range;
+			pendingBuffers.push_back({ slot, bufferInfo });
+		}
+		return slot;
+	}
+
+	// Gives a slot back. No command buffer recorded from now on may use it, and it is
+	//reused once the frames in flight that could still use it are done.
+	void release(Binding binding, uint32_t slot, uint64_t frameNumber) {
+		if (slot == INVALID_SLOT) {
+			return;
+		}
+		released.push_back({ binding, slot, frameNumber });
+		arrays[binding].used--;
+	}
+
+	// Call once per frame, before recording it: slots released framesInFlight frames
+	//ago go back to their free lists (the same rule as the retired swap chains), and
+	//all descriptors added since the last call are written in one
+	//vkUpdateDescriptorSets.
+	void beginFrame(uint64_t frameNumber) {
+		while (!released.empty() && frameNumber >= released.front().releasedAt + framesInFlight) {
+			arrays[released.front().binding].freeSlots.push_back(released.front().slot);
+			released.pop_front();
+		}
+		flush();
+	}
+
+	void flush() {
+		if (pendingImages.empty() && pendingBuffers.empty()) {
+			return;
+		}
+
+		std::vector<VkWriteDescriptorSet> writes;
+		writes.reserve(pendingImages.size() + pendingBuffers.size());
+		for (const PendingImage& pending : pendingImages) {
+			writes.push_back(write(Textures, pending.slot, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER));
+			writes.back().pImageInfo = &pending.info;
+		}
+		for (const PendingBuffer& pending : pendingBuffers) {
+			writes.push_back(write(StorageBuffers, pending.slot, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER));
+			writes.back().pBufferInfo = &pending.info;
+		}
+		vkUpdateDescriptorSets(device, (uint32_t) writes.size(), writes.data(), 0, nullptr);
+
+		descriptorWrites += writes.size();
+		updateCalls++;
+		pendingImages.clear();
+		pendingBuffers.clear();
+	}
+
+	// Binds the set as the given set of the layout. Once per command buffer, the
+	//draws only push the slots they use.
+	void bind(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t set, VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS) const {
+		if (!isEnabled()) {
+			return;
+		}
+		vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, set, 1, &descriptorSet, 0, nullptr);
+	}
+
+	void printStats(std::ostream& out) const {
+		if (!isEnabled()) {
+			out << "bindless descriptors: disabled" << std::endl;
+			return;
+		}
+		out << "bindless descriptors: " << arrays[Textures].used << "/" << arrays[Textures].capacity << " textures, "
+			<< arrays[StorageBuffers].used << "/" << arrays[StorageBuffers].capacity << " storage buffers, "
+			<< descriptorWrites << " descriptors written in " << updateCalls << " updates";
+		if (fullArrays > 0) {
+			out << ", " << fullArrays << " adds to a full array";
+		}
+		out << std::endl;
+	}
+
+private:
+	struct SlotArray {
+		uint32_t capacity = 0;
+		uint32_t used = 0;
+		// Handed out from the back
+		std::vector<uint32_t> freeSlots;
+	};
+
+	struct ReleasedSlot {
+		Binding binding;
+		uint32_t slot;
+		uint64_t releasedAt;
+	};
+
+	struct PendingImage {
+		uint32_t slot;
+		VkDescriptorImageInfo info;
+	};
+
+	struct PendingBuffer {
+		uint32_t slot;
+		VkDescriptorBufferInfo info;
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+	uint32_t framesInFlight = 0;
+
+	VDescriptorSetLayout setLayout;
+	VDescriptorPool pool;
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+	SlotArray arrays[BINDING_COUNT];
+	// Oldest first
+	std::deque<ReleasedSlot> released;
+	// Written by the next flush
+	std::vector<PendingImage> pendingImages;
+	std::vector<PendingBuffer> pendingBuffers;
+
+	uint64_t descriptorWrites = 0;
+	uint64_t updateCalls = 0;
+	uint64_t fullArrays = 0;
+
+	uint32_t takeSlot(Binding binding) {
+		SlotArray& array = arrays[binding];
+		if (array.freeSlots.empty()) {
+			if (isEnabled()) {
+				fullArrays++;
+			}
+			return INVALID_SLOT;
+		}
+		uint32_t slot = array.freeSlots.back();
+		array.freeSlots.pop_back();
+		array.used++;
+		return slot;
+	}
+
+	VkWriteDescriptorSet write(Binding binding, uint32_t slot, VkDescriptorType type) const {
+		VkWriteDescriptorSet descriptorWrite = {};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = descriptorSet;
+		descriptorWrite.dstBinding = binding;
+		descriptorWrite.dstArrayElement = slot;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.descriptorType = type;
+		return descriptorWrite;
+	}
+};
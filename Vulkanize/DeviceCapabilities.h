@@ -0,0 +1,127 @@
+#pragma once
+
+// What a physical device (and the surface) can do, queried once per device.
+// Picking a device looks at its queue families, extensions, surface support, memory
+//and limits, and most of that is needed again to create the logical device and the
+//swap chain. Every vkGetPhysicalDevice* query allocates and goes into the driver, so
+//the answers are kept here instead of asking again each time.
+// Only the surface capabilities change while the program runs (the current extent
+//follows the window), refreshSurface() updates them when the swap chain is
+//recreated.
+
+#include "Swapchain.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+struct DeviceCapabilities {
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	// Name, type, versions and the limits
+	VkPhysicalDeviceProperties properties;
+	VkPhysicalDeviceFeatures features;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	std::vector<VkQueueFamilyProperties> queueFamilies;
+	// Whether each queue family can present to the surface. All false without one.
+	std::vector<VkBool32> presentSupport;
+	std::vector<VkExtensionProperties> extensions;
+	// Capabilities, formats and present modes of the surface. Empty without one, or
+	//when the device doesn't have the swap chain extension.
+	SwapChainSupportDetails surfaceSupport = {};
+	// What VK_EXT_descriptor_indexing can do (for bindless descriptors). All zero when
+	//the device doesn't have the extension or the instance has no
+	//VK_KHR_get_physical_device_properties2 to ask with.
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+	VkPhysicalDeviceDescriptorIndexingPropertiesEXT descriptorIndexingProperties = {};
+	// Whether VK_KHR_timeline_semaphore works, zero under the same conditions
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {};
+	// And VK_KHR_dynamic_rendering
+	VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {};
+
+	// surface is VK_NULL_HANDLE when headless, which leaves the surface details empty.
+	//The properties2 functions are nullptr without VK_KHR_get_physical_device_properties2.
+	static DeviceCapabilities query(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface,
+		PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2 = nullptr, PFN_vkGetPhysicalDeviceProperties2KHR getProperties2 = nullptr) {
+		DeviceCapabilities capabilities;
+		capabilities.physicalDevice = physicalDevice;
+		vkGetPhysicalDeviceProperties(physicalDevice, &capabilities.properties);
+		vkGetPhysicalDeviceFeatures(physicalDevice, &capabilities.features);
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &capabilities.memoryProperties);
+
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+		capabilities.queueFamilies.resize(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, capabilities.queueFamilies.data());
+
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+		capabilities.extensions.resize(extensionCount);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, capabilities.extensions.data());
+
+		// The extension structs are filled in through the pNext chains of the 2 queries
+		if (getFeatures2 != nullptr && getProperties2 != nullptr && capabilities.hasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)) {
+			capabilities.descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+			VkPhysicalDeviceFeatures2KHR features2 = {};
+			features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+			features2.pNext = &capabilities.descriptorIndexingFeatures;
+			getFeatures2(physicalDevice, &features2);
+			capabilities.descriptorIndexingFeatures.pNext = nullptr;
+
+			capabilities.descriptorIndexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+			VkPhysicalDeviceProperties2KHR properties2 = {};
+			properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+			properties2.pNext = &capabilities.descriptorIndexingProperties;
+			getProperties2(physicalDevice, &properties2);
+			capabilities.descriptorIndexingProperties.pNext = nullptr;
+		}
+		if (getFeatures2 != nullptr && capabilities.hasExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+			capabilities.timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+			VkPhysicalDeviceFeatures2KHR features2 = {};
+			features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+			features2.pNext = &capabilities.timelineSemaphoreFeatures;
+			getFeatures2(physicalDevice, &features2);
+			capabilities.timelineSemaphoreFeatures.pNext = nullptr;
+		}
+		if (getFeatures2 != nullptr && capabilities.hasExtension(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+			capabilities.dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+			VkPhysicalDeviceFeatures2KHR features2 = {};
+			features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+			features2.pNext = &capabilities.dynamicRenderingFeatures;
+			getFeatures2(physicalDevice, &features2);
+			capabilities.dynamicRenderingFeatures.pNext = nullptr;
+		}
+
+		capabilities.presentSupport.assign(queueFamilyCount, VK_FALSE);
+		if (surface != VK_NULL_HANDLE) {
+			for (uint32_t i = 0; i < queueFamilyCount; i++) {
+				vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &capabilities.presentSupport[i]);
+			}
+			// The surface queries come from the swap chain extension's instance half,
+			//but a device without the device half can't present anyway
+			if (capabilities.hasExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME)) {
+				capabilities.surfaceSupport = querySwapChainSupport(physicalDevice, surface);
+			}
+		}
+		return capabilities;
+	}
+
+	bool hasExtension(const char* name) const {
+		for (const auto& extension : extensions) {
+			if (strcmp(extension.extensionName, name) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Re-reads the surface capabilities, whose current extent changes with the window.
+	//With allSurfaceDetails the formats and present modes are read again too, they can
+	//change when the window moves to another monitor.
+	void refreshSurface(VkSurfaceKHR surface, bool allSurfaceDetails) {
+		if (allSurfaceDetails) {
+			surfaceSupport = querySwapChainSupport(physicalDevice, surface);
+		}
+		else {
+			vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceSupport.capabilities);
+		}
+	}
+};
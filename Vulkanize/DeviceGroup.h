@@ -0,0 +1,126 @@
+#pragma once
+
+// Several linked GPUs behind one logical device (a device group).
+// The driver reports GPUs that can work together (SLI, CrossFire and the like) as a
+//physical device group. A logical device created from the whole group has one
+//instance of every resource per GPU, and every command buffer and submission says
+//which GPUs run it with a device mask (bit i is device index i, in the order of the
+//group's physical devices).
+// Alternate frame rendering: each frame goes to the next GPU, so with N GPUs up to N
+//frames render at once. Needs at least N frames in flight to keep them busy. It's
+//headless only: the frames are seen through the offscreen target's readback, which
+//each GPU copies into host memory they all share. Presenting would need the group's
+//swap chain and present modes.
+// Split frame rendering would need every GPU's strip copied into one image through
+//peer memory, which isn't there (yet), so there's no such mode.
+// The core of this is VK_KHR_device_group_creation (instance) and VK_KHR_device_group
+//(device), promoted to Vulkan 1.1.
+// https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#devsandqueues-devicegroups
+
+#include "Settings.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+class DeviceGroup {
+public:
+	// Looks for the group the picked device is in. Needs VK_KHR_device_group_creation
+	//on the instance. With mode Off, no group or a group of one, everything runs on
+	//device index 0 and isActive() is false.
+	void find(VkInstance instance, VkPhysicalDevice picked, MultiGpuMode mode) {
+		physicalDevices.clear();
+		this->mode = MultiGpuMode::Off;
+		if (mode == MultiGpuMode::Off) {
+			return;
+		}
+
+		auto enumerateGroups = (PFN_vkEnumeratePhysicalDeviceGroupsKHR) vkGetInstanceProcAddr(instance, "vkEnumeratePhysicalDeviceGroupsKHR");
+		if (enumerateGroups == nullptr) {
+			std::cout << "device group: " VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME " not available, using one GPU" << std::endl;
+			return;
+		}
+
+		uint32_t groupCount = 0;
+		enumerateGroups(instance, &groupCount, nullptr);
+		std::vector<VkPhysicalDeviceGroupPropertiesKHR> groups(groupCount);
+		for (auto& group : groups) {
+			group.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES_KHR;
+		}
+		enumerateGroups(instance, &groupCount, groups.data());
+
+		for (const auto& group : groups) {
+			const VkPhysicalDevice* begin = group.physicalDevices;
+			const VkPhysicalDevice* end = group.physicalDevices + group.physicalDeviceCount;
+			if (std::find(begin, end, picked) == end) {
+				continue;
+			}
+			if (group.physicalDeviceCount < 2) {
+				break;
+			}
+			physicalDevices.assign(begin, end);
+			this->mode = mode;
+			std::cout << "device group: " << group.physicalDeviceCount << " GPUs, alternate frame rendering" << std::endl;
+			break;
+		}
+		if (physicalDevices.empty()) {
+			std::cout << "device group: the picked GPU isn't linked with others, using one GPU" << std::endl;
+		}
+		framesPerDevice.assign(deviceCount(), 0);
+	}
+
+	bool isActive() const {
+		return mode != MultiGpuMode::Off;
+	}
+
+	uint32_t deviceCount() const {
+		return isActive() ? (uint32_t) physicalDevices.size() : 1;
+	}
+
+	uint32_t allDevicesMask() const {
+		return (1u << deviceCount()) - 1;
+	}
+
+	// To chain into VkDeviceCreateInfo when isActive(). The physical device of the
+	//create info has to be one of them.
+	VkDeviceGroupDeviceCreateInfoKHR deviceCreateInfo() const {
+		VkDeviceGroupDeviceCreateInfoKHR createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_DEVICE_CREATE_INFO_KHR;
+		createInfo.physicalDeviceCount = (uint32_t) physicalDevices.size();
+		createInfo.pPhysicalDevices = physicalDevices.data();
+		return createInfo;
+	}
+
+	// The GPUs a frame runs on
+	uint32_t frameDeviceMask(uint64_t frameNumber) const {
+		if (mode == MultiGpuMode::AlternateFrame) {
+			return 1u << (uint32_t) (frameNumber % deviceCount());
+		}
+		return allDevicesMask();
+	}
+
+	// A frame was submitted with the mask
+	void countFrame(uint32_t deviceMask) {
+		for (uint32_t i = 0; i < (uint32_t) framesPerDevice.size(); i++) {
+			if (deviceMask & (1u << i)) {
+				framesPerDevice[i]++;
+			}
+		}
+	}
+
+	void printStats(std::ostream& out) const {
+		if (!isActive()) {
+			return;
+		}
+		out << "device group: frames per GPU";
+		for (uint64_t frames : framesPerDevice) {
+			out << " " << frames;
+		}
+		out << std::endl;
+	}
+
+private:
+	MultiGpuMode mode = MultiGpuMode::Off;
+	std::vector<VkPhysicalDevice> physicalDevices;
+	std::vector<uint64_t> framesPerDevice;
+};
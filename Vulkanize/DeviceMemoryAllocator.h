@@ -0,0 +1,635 @@
+#pragma once
+
+// Device memory sub-allocator.
+// Calling vkAllocateMemory for every buffer and image doesn't scale: the number of
+//allocations is limited by maxMemoryAllocationCount (which can be as low as 4096) and
+//every call goes down to the kernel. Instead we allocate big blocks per memory type
+//and hand out pieces of them. Each block keeps a list of free ranges, allocations
+//take the smallest range that fits (best fit) and freed ranges are merged with their
+//neighbours again.
+// https://vulkan-tutorial.com/Vertex_buffers/Staging_buffer (see the conclusion)
+
+#include "VHandle.h"
+//Reporting and error propagation
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+// Free ranges of a block, sorted by offset so neighbours are easy to find
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Vulkan doesn't allow linear resources (buffers, linear images) and optimal (tiled)
+//images to share a "page" of bufferImageGranularity bytes. If the device has such
+//a granularity, both kinds are kept in separate blocks so we never have to pad
+//between neighbours.
+enum class ResourceTiling {
+	Linear,
+	Optimal
+};
+
+// A piece of device memory handed out by the allocator. Bind resources with
+//memory + offset. Host visible memory is kept mapped, mapped points at offset.
+struct DeviceAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr;
+	uint32_t memoryTypeIndex = 0;
+	// Block the allocation was carved from, nullptr for dedicated allocations
+	void* block = nullptr;
+
+	bool isValid() const {
+		return memory != VK_NULL_HANDLE;
+	}
+};
+
+// Usage summary for a memory heap
+struct MemoryHeapStats {
+	// VkDeviceMemory objects (blocks and dedicated allocations)
+	uint32_t deviceMemoryCount = 0;
+	// Allocations handed out
+	uint32_t allocationCount = 0;
+	// Memory allocated from Vulkan and how much of that is handed out
+	VkDeviceSize bytesAllocated = 0;
+	VkDeviceSize bytesUsed = 0;
+	// Largest contiguous free range in any block
+	VkDeviceSize largestFreeRange = 0;
+	// Sum of the largest free range of every block
+	VkDeviceSize largestFreeRangePerBlock = 0;
+
+	VkDeviceSize bytesFree() const {
+		return bytesAllocated - bytesUsed;
+	}
+
+	// 0 when the free memory of each block is one contiguous range, close to 1 when 
+	//it's scattered in many small ranges that can't hold a big allocation
+	double fragmentation() const {
+		if (bytesFree() == 0) {
+			return 0.0;
+		}
+		return 1.0 - (double) largestFreeRangePerBlock / (double) bytesFree();
+	}
+};
+
+// How much of a heap the process may use and how much it does, everything counted
+//(other allocators and the driver's own too). See DeviceMemoryAllocator::heapBudget.
+struct MemoryHeapBudget {
+	VkDeviceSize budget = 0;
+	VkDeviceSize usage = 0;
+	// Whether the numbers come from VK_EXT_memory_budget, or are the heap size and
+	//what this allocator allocated from it
+	bool reported = false;
+
+	VkDeviceSize available() const {
+		return budget > usage ? budget - usage : 0;
+	}
+};
+
+class DeviceMemoryAllocator {
+public:
+	DeviceMemoryAllocator(const VDevice& device, const VkAllocationCallbacks* allocator)
+		: device(device), allocator(allocator) {}
+
+	~DeviceMemoryAllocator() {
+		destroy();
+	}
+
+	// Must be called once the logical device exists. Blocks are preferredBlockSize
+	//bytes, smaller on small heaps (a block never takes more than 1/8 of its heap).
+	void init(VkPhysicalDevice physicalDevice, VkDeviceSize preferredBlockSize = 256 * 1024 * 1024) {
+		this->physicalDevice = physicalDevice;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+		bufferImageGranularity = deviceProperties.limits.bufferImageGranularity;
+		nonCoherentAtomSize = deviceProperties.limits.nonCoherentAtomSize;
+		maxMemoryAllocationCount = deviceProperties.limits.maxMemoryAllocationCount;
+
+		blockSizes.resize(memoryProperties.memoryTypeCount);
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[i].heapIndex].size;
+			blockSizes[i] = std::min(preferredBlockSize, heapSize / 8);
+		}
+
+		// One pool per memory type, or two if linear and optimal resources are separated
+		pools.resize(memoryProperties.memoryTypeCount * 2);
+	}
+
+	// Frees all blocks. Every resource bound to them must be destroyed already.
+	void destroy() {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto& pool : pools) {
+			for (auto& block : pool) {
+				freeDeviceMemory(block->memory, block->mapped != nullptr);
+			}
+			pool.clear();
+		}
+		for (auto& dedicated : dedicatedAllocations) {
+			freeDeviceMemory(dedicated.memory, dedicated.mapped != nullptr);
+		}
+		dedicatedAllocations.clear();
+	}
+
+	// Finds memory for the requirements of a resource. The memory type must have all
+	//of the required flags, types that also have the preferred ones are tried first.
+	DeviceAllocation allocate(
+		const VkMemoryRequirements& requirements,
+		VkMemoryPropertyFlags requiredFlags,
+		VkMemoryPropertyFlags preferredFlags,
+		ResourceTiling tiling
+	) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// If a heap is full, fall back to the next best type
+		for (uint32_t memoryTypeIndex : findMemoryTypes(requirements.memoryTypeBits, requiredFlags, preferredFlags)) {
+			DeviceAllocation allocation;
+			if (allocateFromType(memoryTypeIndex, requirements, tiling, allocation)) {
+				return allocation;
+			}
+		}
+
+		throw std::runtime_error("failed to allocate device memory!");
+	}
+
+	// Allocates and binds memory for a buffer
+	DeviceAllocation allocateAndBind(VkBuffer buffer, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags = 0) {
+		VkMemoryRequirements memRequirements;
+		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+		DeviceAllocation allocation = allocate(memRequirements, requiredFlags, preferredFlags, ResourceTiling::Linear);
+		if (vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+			free(allocation);
+			throw std::runtime_error("failed to bind buffer memory!");
+		}
+		return allocation;
+	}
+
+	// Allocates and binds memory for an image with the given tiling
+	DeviceAllocation allocateAndBind(VkImage image, VkImageTiling tiling, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags = 0) {
+		VkMemoryRequirements memRequirements;
+		vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+		ResourceTiling resourceTiling = tiling == VK_IMAGE_TILING_LINEAR ? ResourceTiling::Linear : ResourceTiling::Optimal;
+		DeviceAllocation allocation = allocate(memRequirements, requiredFlags, preferredFlags, resourceTiling);
+		if (vkBindImageMemory(device, image, allocation.memory, allocation.offset) != VK_SUCCESS) {
+			free(allocation);
+			throw std::runtime_error("failed to bind image memory!");
+		}
+		return allocation;
+	}
+
+	// Gives the memory back. The resource using it must be destroyed (or at least no
+	//longer in use by the GPU).
+	void free(DeviceAllocation& allocation) {
+		if (!allocation.isValid()) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (allocation.block == nullptr) {
+			freeDedicated(allocation);
+		}
+		else {
+			freeFromBlock(allocation);
+		}
+
+		allocation = DeviceAllocation();
+	}
+
+	// Writes from the host to non coherent memory have to be flushed before the GPU
+	//can see them. Does nothing for coherent memory.
+	void flush(const DeviceAllocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE) {
+		VkMappedMemoryRange range;
+		if (getNonCoherentRange(allocation, offset, size, range)) {
+			vkFlushMappedMemoryRanges(device, 1, &range);
+		}
+	}
+
+	// The counterpart of flush, for reading what the GPU wrote to non coherent memory
+	void invalidate(const DeviceAllocation& allocation, VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE) {
+		VkMappedMemoryRange range;
+		if (getNonCoherentRange(allocation, offset, size, range)) {
+			vkInvalidateMappedMemoryRanges(device, 1, &range);
+		}
+	}
+
+	MemoryHeapStats heapStats(uint32_t heapIndex) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		MemoryHeapStats stats;
+		for (size_t poolIndex = 0; poolIndex < pools.size(); poolIndex++) {
+			uint32_t memoryTypeIndex = (uint32_t) poolIndex / 2;
+			if (memoryProperties.memoryTypes[memoryTypeIndex].heapIndex != heapIndex) {
+				continue;
+			}
+			for (const auto& block : pools[poolIndex]) {
+				stats.deviceMemoryCount++;
+				stats.allocationCount += block->allocationCount;
+				stats.bytesAllocated += block->size;
+				stats.bytesUsed += block->used;
+				VkDeviceSize largestInBlock = 0;
+				for (const auto& range : block->freeRanges) {
+					largestInBlock = std::max(largestInBlock, range.second);
+				}
+				stats.largestFreeRange = std::max(stats.largestFreeRange, largestInBlock);
+				stats.largestFreeRangePerBlock += largestInBlock;
+			}
+		}
+		for (const auto& dedicated : dedicatedAllocations) {
+			if (memoryProperties.memoryTypes[dedicated.memoryTypeIndex].heapIndex == heapIndex) {
+				stats.deviceMemoryCount++;
+				stats.allocationCount++;
+				stats.bytesAllocated += dedicated.size;
+				stats.bytesUsed += dedicated.size;
+			}
+		}
+		return stats;
+	}
+
+	void printStats(std::ostream& out) {
+		const double MiB = 1024.0 * 1024.0;
+
+		out << "device memory (" << deviceMemoryCount << " of " << maxMemoryAllocationCount << " vkAllocateMemory allocations):" << std::endl;
+		for (uint32_t heapIndex = 0; heapIndex < memoryProperties.memoryHeapCount; heapIndex++) {
+			MemoryHeapStats stats = heapStats(heapIndex);
+			bool deviceLocal = (memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+
+			out << "\theap " << heapIndex << (deviceLocal ? " (device local)" : " (host)") << ": "
+				<< stats.deviceMemoryCount << " blocks, "
+				<< stats.bytesAllocated / MiB << " MiB allocated, "
+				<< stats.bytesUsed / MiB << " MiB used by " << stats.allocationCount << " allocations, "
+				<< "fragmentation " << (int) (stats.fragmentation() * 100.0) << "%";
+			if (getMemoryProperties2 != nullptr) {
+				MemoryHeapBudget budget = heapBudget(heapIndex);
+				out << ", process uses " << budget.usage / MiB << " of a " << budget.budget / MiB << " MiB budget";
+			}
+			out << std::endl;
+		}
+	}
+
+	const VkPhysicalDeviceMemoryProperties& properties() const {
+		return memoryProperties;
+	}
+
+	// Lets heapBudget ask VK_EXT_memory_budget, which has to be enabled on the device.
+	//The function comes from VK_KHR_get_physical_device_properties2 on the instance.
+	void enableMemoryBudget(PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2) {
+		this->getMemoryProperties2 = getMemoryProperties2;
+	}
+
+	// For a device created from a device group. Memory from a multi-instance heap then
+	//has an instance per GPU and can't be mapped, so allocations that need to be host
+	//visible come from the other heaps, and the rest isn't mapped there.
+	void enableDeviceGroup() {
+		deviceGroup = true;
+	}
+
+	// The budget changes while the program runs (other programs allocate too, and the
+	//OS moves things around), so it's asked for every time. Without the extension
+	//it's the heap size and what we allocated from it.
+	MemoryHeapBudget heapBudget(uint32_t heapIndex) {
+		MemoryHeapBudget heapBudget;
+		if (getMemoryProperties2 != nullptr) {
+			VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {};
+			budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+			VkPhysicalDeviceMemoryProperties2KHR properties2 = {};
+			properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+			properties2.pNext = &budgetProperties;
+			getMemoryProperties2(physicalDevice, &properties2);
+			heapBudget.budget = budgetProperties.heapBudget[heapIndex];
+			heapBudget.usage = budgetProperties.heapUsage[heapIndex];
+			heapBudget.reported = true;
+			return heapBudget;
+		}
+		heapBudget.budget = memoryProperties.memoryHeaps[heapIndex].size;
+		heapBudget.usage = heapStats(heapIndex).bytesAllocated;
+		return heapBudget;
+	}
+
+	// The biggest device local heap, where the textures and buffers the GPU reads go
+	uint32_t deviceLocalHeap() const {
+		uint32_t best = 0;
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			bool deviceLocal = (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+			bool bestDeviceLocal = (memoryProperties.memoryHeaps[best].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+			if ((deviceLocal && !bestDeviceLocal) || (deviceLocal == bestDeviceLocal && memoryProperties.memoryHeaps[i].size > memoryProperties.memoryHeaps[best].size)) {
+				best = i;
+			}
+		}
+		return best;
+	}
+
+private:
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		// Host visible blocks are mapped once for their whole lifetime
+		void* mapped = nullptr;
+		uint32_t memoryTypeIndex = 0;
+		// offset -> size of every free range
+		std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+		VkDeviceSize used = 0;
+		uint32_t allocationCount = 0;
+	};
+
+	const VDevice& device;
+	// Host allocator for the driver's bookkeeping of VkDeviceMemory objects
+	const VkAllocationCallbacks* allocator;
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	// vkGetPhysicalDeviceMemoryProperties2KHR with VK_EXT_memory_budget, or nullptr
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+	// See enableDeviceGroup
+	bool deviceGroup = false;
+	VkPhysicalDeviceMemoryProperties memoryProperties = {};
+	VkDeviceSize bufferImageGranularity = 1;
+	VkDeviceSize nonCoherentAtomSize = 1;
+	uint32_t maxMemoryAllocationCount = 0;
+
+	// Block size for each memory type
+	std::vector<VkDeviceSize> blockSizes;
+	// Blocks of memory type i: pools[2 * i] for linear resources, pools[2 * i + 1]
+	//for optimal ones (only used when the granularity forces us to separate them)
+	std::vector<std::vector<std::unique_ptr<Block>>> pools;
+	// Big resources get their own VkDeviceMemory, it would only waste block space
+	std::vector<DeviceAllocation> dedicatedAllocations;
+	// Number of live VkDeviceMemory objects (checked against maxMemoryAllocationCount)
+	uint32_t deviceMemoryCount = 0;
+
+	// Allocation can happen from loader threads, not only the render thread
+	std::mutex mutex;
+
+	static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	static uint32_t countBits(uint32_t value) {
+		uint32_t count = 0;
+		for (; value != 0; value &= value - 1) {
+			count++;
+		}
+		return count;
+	}
+
+	// Memory types that are allowed and have the required flags, the ones with more of
+	//the preferred flags (and then with less flags we didn't ask for) first
+	std::vector<uint32_t> findMemoryTypes(uint32_t typeFilter, VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags) {
+		std::vector<uint32_t> candidates;
+		bool mapped = (requiredFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & requiredFlags) == requiredFlags
+				&& (!mapped || isMappable(i))) {
+				candidates.push_back(i);
+			}
+		}
+
+		VkMemoryPropertyFlags wanted = requiredFlags | preferredFlags;
+		auto rank = [&](uint32_t type) {
+			VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[type].propertyFlags;
+			return (int) countBits(flags & preferredFlags) * 32 - (int) countBits(flags & ~wanted);
+		};
+		std::stable_sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+			return rank(a) > rank(b);
+		});
+
+		if (candidates.empty()) {
+			throw std::runtime_error("failed to find suitable memory type!");
+		}
+		return candidates;
+	}
+
+	bool isHostVisible(uint32_t memoryTypeIndex) const {
+		return (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+	}
+
+	bool isMappable(uint32_t memoryTypeIndex) const {
+		uint32_t heapIndex = memoryProperties.memoryTypes[memoryTypeIndex].heapIndex;
+		bool multiInstance = deviceGroup && (memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_MULTI_INSTANCE_BIT) != 0;
+		return isHostVisible(memoryTypeIndex) && !multiInstance;
+	}
+
+	// Allocates (and maps, if possible) a VkDeviceMemory. Returns false when the heap
+	//is out of memory, so the caller can try another type.
+	bool allocateDeviceMemory(uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory& memory, void*& mapped) {
+		if (deviceMemoryCount >= maxMemoryAllocationCount) {
+			throw std::runtime_error("reached maxMemoryAllocationCount!");
+		}
+
+		VkMemoryAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = size;
+		allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+		VkResult result = vkAllocateMemory(device, &allocInfo, allocator, &memory);
+		if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY) {
+			return false;
+		}
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate device memory!");
+		}
+		deviceMemoryCount++;
+
+		mapped = nullptr;
+		if (isMappable(memoryTypeIndex)) {
+			if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS) {
+				freeDeviceMemory(memory, false);
+				throw std::runtime_error("failed to map device memory!");
+			}
+		}
+		return true;
+	}
+
+	void freeDeviceMemory(VkDeviceMemory memory, bool mapped) {
+		if (mapped) {
+			vkUnmapMemory(device, memory);
+		}
+		vkFreeMemory(device, memory, allocator);
+		deviceMemoryCount--;
+	}
+
+	bool allocateFromType(uint32_t memoryTypeIndex, const VkMemoryRequirements& requirements, ResourceTiling tiling, DeviceAllocation& allocation) {
+		VkDeviceSize blockSize = blockSizes[memoryTypeIndex];
+
+		// Resources bigger than half a block get their own memory
+		if (requirements.size > blockSize / 2) {
+			return allocateDedicated(memoryTypeIndex, requirements.size, allocation);
+		}
+
+		bool separateTiling = bufferImageGranularity > 1 && tiling == ResourceTiling::Optimal;
+		auto& pool = pools[2 * memoryTypeIndex + (separateTiling ? 1 : 0)];
+
+		for (auto& block : pool) {
+			if (allocateFromBlock(*block, requirements, allocation)) {
+				return true;
+			}
+		}
+
+		// No room in the existing blocks, so add a new one
+		std::unique_ptr<Block> block(new Block());
+		if (!allocateDeviceMemory(memoryTypeIndex, blockSize, block->memory, block->mapped)) {
+			return false;
+		}
+		block->size = blockSize;
+		block->memoryTypeIndex = memoryTypeIndex;
+		block->freeRanges[0] = blockSize;
+		pool.push_back(std::move(block));
+
+		return allocateFromBlock(*pool.back(), requirements, allocation);
+	}
+
+	// Best fit: the smallest free range that still holds the aligned allocation
+	bool allocateFromBlock(Block& block, const VkMemoryRequirements& requirements, DeviceAllocation& allocation) {
+		auto best = block.freeRanges.end();
+		VkDeviceSize bestOffset = 0;
+
+		for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+			VkDeviceSize alignedOffset = alignUp(it->first, requirements.alignment);
+			VkDeviceSize rangeEnd = it->first + it->second;
+			if (alignedOffset + requirements.size > rangeEnd) {
+				continue;
+			}
+			if (best == block.freeRanges.end() || it->second < best->second) {
+				best = it;
+				bestOffset = alignedOffset;
+				// Can't get any better than an exact fit
+				if (it->second == requirements.size) {
+					break;
+				}
+			}
+		}
+
+		if (best == block.freeRanges.end()) {
+			return false;
+		}
+
+		// Split the free range into what's before (alignment padding) and after the allocation
+		VkDeviceSize rangeOffset = best->first;
+		VkDeviceSize rangeEnd = best->first + best->second;
+		block.freeRanges.erase(best);
+		if (bestOffset > rangeOffset) {
+			block.freeRanges[rangeOffset] = bestOffset - rangeOffset;
+		}
+		if (bestOffset + requirements.size < rangeEnd) {
+			block.freeRanges[bestOffset + requirements.size] = rangeEnd - (bestOffset + requirements.size);
+		}
+
+		block.used += requirements.size;
+		block.allocationCount++;
+
+		allocation.memory = block.memory;
+		allocation.offset = bestOffset;
+		allocation.size = requirements.size;
+		allocation.mapped = block.mapped != nullptr ? (char*) block.mapped + bestOffset : nullptr;
+		allocation.memoryTypeIndex = block.memoryTypeIndex;
+		allocation.block = &block;
+		return true;
+	}
+
+	bool allocateDedicated(uint32_t memoryTypeIndex, VkDeviceSize size, DeviceAllocation& allocation) {
+		if (!allocateDeviceMemory(memoryTypeIndex, size, allocation.memory, allocation.mapped)) {
+			return false;
+		}
+		allocation.offset = 0;
+		allocation.size = size;
+		allocation.memoryTypeIndex = memoryTypeIndex;
+		allocation.block = nullptr;
+		dedicatedAllocations.push_back(allocation);
+		return true;
+	}
+
+	void freeDedicated(const DeviceAllocation& allocation) {
+		for (auto it = dedicatedAllocations.begin(); it != dedicatedAllocations.end(); ++it) {
+			if (it->memory == allocation.memory) {
+				freeDeviceMemory(it->memory, it->mapped != nullptr);
+				dedicatedAllocations.erase(it);
+				return;
+			}
+		}
+	}
+
+	void freeFromBlock(const DeviceAllocation& allocation) {
+		Block& block = *(Block*) allocation.block;
+
+		VkDeviceSize offset = allocation.offset;
+		VkDeviceSize size = allocation.size;
+
+		// Merge with the free range right after...
+		auto next = block.freeRanges.lower_bound(offset);
+		if (next != block.freeRanges.end() && next->first == offset + size) {
+			size += next->second;
+			next = block.freeRanges.erase(next);
+		}
+		// ...and the one right before
+		if (next != block.freeRanges.begin()) {
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset) {
+				offset = previous->first;
+				size += previous->second;
+				block.freeRanges.erase(previous);
+			}
+		}
+		block.freeRanges[offset] = size;
+
+		block.used -= allocation.size;
+		block.allocationCount--;
+
+		if (block.allocationCount == 0) {
+			releaseEmptyBlock(block);
+		}
+	}
+
+	// Empty blocks are given back, except for one per pool, so that allocating and
+	//freeing in a loop doesn't hit vkAllocateMemory every time
+	void releaseEmptyBlock(Block& emptyBlock) {
+		for (auto& pool : pools) {
+			bool owner = false;
+			uint32_t emptyBlocks = 0;
+			for (const auto& block : pool) {
+				owner |= block.get() == &emptyBlock;
+				emptyBlocks += block->allocationCount == 0 ? 1 : 0;
+			}
+			if (!owner) {
+				continue;
+			}
+
+			if (emptyBlocks > 1) {
+				for (auto it = pool.begin(); it != pool.end(); ++it) {
+					if (it->get() == &emptyBlock) {
+						freeDeviceMemory(emptyBlock.memory, emptyBlock.mapped != nullptr);
+						pool.erase(it);
+						break;
+					}
+				}
+			}
+			return;
+		}
+	}
+
+	// Range to flush/invalidate, expanded to nonCoherentAtomSize as the spec requires
+	bool getNonCoherentRange(const DeviceAllocation& allocation, VkDeviceSize offset, VkDeviceSize size, VkMappedMemoryRange& range) {
+		if (memoryProperties.memoryTypes[allocation.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+			return false;
+		}
+		if (size == VK_WHOLE_SIZE) {
+			size = allocation.size - offset;
+		}
+
+		VkDeviceSize memorySize = allocation.block != nullptr ? ((Block*) allocation.block)->size : allocation.size;
+		VkDeviceSize start = (allocation.offset + offset) / nonCoherentAtomSize * nonCoherentAtomSize;
+		VkDeviceSize end = std::min(alignUp(allocation.offset + offset + size, nonCoherentAtomSize), memorySize);
+
+		range = {};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = allocation.memory;
+		range.offset = start;
+		range.size = end - start;
+		return true;
+	}
+};
@@ -0,0 +1,287 @@
+#pragma once
+
+// Scratch memory for data that only lives for one frame: per frame uniforms and
+//immediate mode geometry.
+// Every frame in flight has one persistently mapped buffer, and allocating from it
+//is bumping an offset. Nothing is freed individually, the whole buffer is reused
+//once the frame's fence says the GPU is done with it (beginFrame). Uniform data is
+//read through a uniform buffer dynamic descriptor, one descriptor set per frame
+//that covers the whole buffer: a draw binds it with the offset of its data, so no
+//descriptor is written per allocation. Vertex and index data is bound directly
+//with its buffer and offset.
+// Allocating is thread safe (the offset is atomic), so the recording threads can
+//allocate while they record.
+// https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#descriptorsets-uniformbufferdynamic
+
+#include "VHandle.h"
+#include "DeviceMemoryAllocator.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+class FrameAllocator {
+public:
+	// Where allocated data goes. data is nullptr when the frame's buffer was full.
+	struct Allocation {
+		void* data = nullptr;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+
+		bool isValid() const {
+			return data != nullptr;
+		}
+	};
+
+	FrameAllocator(const VDevice& device, const VkAllocationCallbacks* allocator, DeviceMemoryAllocator& memoryAllocator)
+		: device(device), allocator(allocator), memoryAllocator(memoryAllocator) {}
+
+	~FrameAllocator() {
+		destroy();
+	}
+
+	FrameAllocator(const FrameAllocator&) = delete;
+	FrameAllocator& operator=(const FrameAllocator&) = delete;
+
+	// Creates a buffer of bytesPerFrame and a descriptor set for each frame in
+	//flight. uniformRange is how much a shader can read from one uniform allocation,
+	//it has to cover the biggest uniform block bound through it.
+	void init(const VkPhysicalDeviceLimits& limits, uint32_t frameCount, VkDeviceSize bytesPerFrame = 4 * 1024 * 1024, uint32_t uniformRange = 256) {
+		destroy();
+		uniformAlignment = std::max<VkDeviceSize>(limits.minUniformBufferOffsetAlignment, 16);
+		this->uniformRange = std::min(uniformRange, limits.maxUniformBufferRange);
+
+		VkDescriptorSetLayoutBinding binding = {};
+		binding.binding = 0;
+		binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		binding.descriptorCount = 1;
+		binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = 1;
+		layoutInfo.pBindings = &binding;
+
+		if (vkCreateDescriptorSetLayout(device, &layoutInfo, allocator, setLayout.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create frame uniform descriptor set layout!");
+		}
+
+		VkDescriptorPoolSize poolSize = {};
+		poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		poolSize.descriptorCount = frameCount;
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = frameCount;
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+
+		if (vkCreateDescriptorPool(device, &poolInfo, allocator, pool.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create frame uniform descriptor pool!");
+		}
+
+		std::vector<VkDescriptorSetLayout> layouts(frameCount, setLayout.get());
+		std::vector<VkDescriptorSet> sets(frameCount);
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = pool;
+		allocInfo.descriptorSetCount = frameCount;
+		allocInfo.pSetLayouts = layouts.data();
+
+		if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate frame uniform descriptor sets!");
+		}
+
+		// Assigned instead of resized, FrameBuffer can't be moved
+		frames = std::vector<FrameBuffer>(frameCount);
+		for (uint32_t i = 0; i < frameCount; i++) {
+			frames[i].descriptorSet = sets[i];
+			createBuffer(frames[i], bytesPerFrame);
+		}
+		current = &frames[0];
+
+		std::cout << "frame allocator: " << frameCount << " x " << bytesPerFrame / 1024 << " KiB" << std::endl;
+	}
+
+	void destroy() {
+		for (FrameBuffer& frame : frames) {
+			frame.buffer.reset();
+			memoryAllocator.free(frame.memory);
+		}
+		frames.clear();
+		current = nullptr;
+		pool.reset();
+		setLayout.reset();
+	}
+
+	// Starts allocating from a frame's buffer, dropping everything allocated there
+	//before. Call it after waiting for the frame's fence. A buffer that ran out of
+	//room last time is replaced by one twice the size, which is safe now that the GPU
+	//is done with it.
+	void beginFrame(uint32_t frameIndex) {
+		current = &frames[frameIndex];
+		VkDeviceSize used = current->offset.load();
+		peakBytes = std::max(peakBytes, std::min(used, current->capacity));
+		if (current->overflowed) {
+			VkDeviceSize capacity = current->capacity;
+			while (capacity < used) {
+				capacity *= 2;
+			}
+			current->buffer.reset();
+			memoryAllocator.free(current->memory);
+			createBuffer(*current, capacity);
+			grownBuffers++;
+		}
+		current->offset = 0;
+		current->overflowed = false;
+	}
+
+	// For uniform data read through descriptorSet() with the allocation's offset.
+	//size can't be more than the uniform range given to init.
+	Allocation allocateUniform(VkDeviceSize size) {
+		if (size > uniformRange) {
+			throw std::runtime_error("uniform data bigger than the frame allocator's uniform range!");
+		}
+		// The descriptor covers uniformRange bytes from the offset, which have to be in
+		//the buffer even if this allocation is smaller
+		return allocate(size, uniformRange);
+	}
+
+	// For vertex and index data, bound with the allocation's buffer and offset
+	Allocation allocateVertices(VkDeviceSize size) {
+		return allocate(size, 0);
+	}
+
+	// Copies value into a new uniform allocation
+	template <typename T>
+	Allocation pushUniform(const T& value) {
+		Allocation allocation = allocateUniform(sizeof(T));
+		if (allocation.isValid()) {
+			memcpy(allocation.data, &value, sizeof(T));
+		}
+		return allocation;
+	}
+
+	// Makes everything written to the frame's buffer visible to the GPU. Call it once
+	//all of the frame's command buffers are recorded, before submitting them.
+	void endFrame() {
+		VkDeviceSize used = std::min(current->offset.load(), current->capacity);
+		if (used > 0) {
+			memoryAllocator.flush(current->memory, 0, used);
+		}
+	}
+
+	// For the pipeline layouts
+	VkDescriptorSetLayout layout() const {
+		return setLayout;
+	}
+
+	// The current frame's set, bind it with the offset of a uniform allocation as the
+	//dynamic offset
+	VkDescriptorSet descriptorSet() const {
+		return current->descriptorSet;
+	}
+
+	void bindUniforms(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t set, const Allocation& uniforms,
+		VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS) const {
+		uint32_t dynamicOffset = (uint32_t) uniforms.offset;
+		vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, set, 1, &current->descriptorSet, 1, &dynamicOffset);
+	}
+
+	void printStats(std::ostream& out) const {
+		out << "frame allocator: peak " << peakBytes / 1024 << " KiB per frame";
+		if (overflows > 0) {
+			out << ", " << overflows << " allocations didn't fit, " << grownBuffers << " buffers grown";
+		}
+		out << std::endl;
+	}
+
+private:
+	struct FrameBuffer {
+		VBuffer buffer;
+		DeviceAllocation memory;
+		VkDeviceSize capacity = 0;
+		uint8_t* mapped = nullptr;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		// Bumped by every allocation, can end up past the capacity when the buffer is full
+		std::atomic<VkDeviceSize> offset{ 0 };
+		std::atomic<bool> overflowed{ false };
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+	DeviceMemoryAllocator& memoryAllocator;
+
+	VDescriptorSetLayout setLayout;
+	VDescriptorPool pool;
+	std::vector<FrameBuffer> frames;
+	FrameBuffer* current = nullptr;
+
+	VkDeviceSize uniformAlignment = 256;
+	uint32_t uniformRange = 256;
+
+	VkDeviceSize peakBytes = 0;
+	std::atomic<uint64_t> overflows{ 0 };
+	uint64_t grownBuffers = 0;
+
+	static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	// Reserves size bytes and checks that reach bytes from the start fit (the
+	//descriptor range of uniforms). Every size is padded to the uniform alignment,
+	//which keeps all offsets aligned for uniforms as well as vertex data.
+	//Overflowing allocations still bump the offset, so beginFrame knows how much the
+	//frame wanted.
+	Allocation allocate(VkDeviceSize size, VkDeviceSize reach) {
+		VkDeviceSize padded = alignUp(size, uniformAlignment);
+		VkDeviceSize offset = current->offset.fetch_add(padded);
+		if (offset + std::max(padded, reach) > current->capacity) {
+			current->overflowed = true;
+			overflows++;
+			return Allocation();
+		}
+
+		Allocation allocation;
+		allocation.data = current->mapped + offset;
+		allocation.buffer = current->buffer;
+		allocation.offset = offset;
+		return allocation;
+	}
+
+	void createBuffer(FrameBuffer& frame, VkDeviceSize capacity) {
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = capacity;
+		bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateBuffer(device, &bufferInfo, allocator, frame.buffer.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create frame allocator buffer!");
+		}
+		// Written by the CPU once and read by the GPU once, device local host visible
+		//memory (if there is any) saves the GPU a trip over the bus
+		frame.memory = memoryAllocator.allocateAndBind(frame.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		frame.mapped = (uint8_t*) frame.memory.mapped;
+		frame.capacity = capacity;
+
+		VkDescriptorBufferInfo descriptorBuffer = {};
+		descriptorBuffer.buffer = frame.buffer;
+		descriptorBuffer.offset = 0;
+		descriptorBuffer.range = uniformRange;
+
+		VkWriteDescriptorSet descriptorWrite = {};
+		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet = frame.descriptorSet;
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.dstArrayElement = 0;
+		descriptorWrite.descriptorCount = 1;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		descriptorWrite.pBufferInfo = &descriptorBuffer;
+
+		vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+	}
+};
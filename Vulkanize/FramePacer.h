@@ -0,0 +1,209 @@
+#pragma once
+
+// Frame pacing for the windowed main loop.
+// Without a frame rate limit the loop draws as fast as the present mode lets it. With
+//one, it sleeps in glfwWaitEventsTimeout until the next frame is due instead of
+//spinning, so window events still wake it up. The period is rounded to a whole number
+//of refresh cycles when the display's refresh rate is known, otherwise frames would
+//alternate between being shown for one cycle and for two (judder).
+// VK_GOOGLE_display_timing, where the driver has it, tells the refresh rate and when
+//past presents were actually shown. Every present then asks for a time of its own:
+//the last one shown plus a period per present since, half a cycle early so a frame
+//that is right on time doesn't miss its vblank.
+// https://www.khronos.org/registry/vulkan/specs/1.0-extensions/html/vkspec.html#VK_GOOGLE_display_timing
+
+#include "VHandle.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+class FramePacer {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	explicit FramePacer(const VDevice& device) : device(device) {}
+
+	FramePacer(const FramePacer&) = delete;
+	FramePacer& operator=(const FramePacer&) = delete;
+
+	// targetFrameRate 0 turns the pacing off. displayTiming needs
+	//VK_GOOGLE_display_timing on the device.
+	void init(uint32_t targetFrameRate, bool displayTiming) {
+		this->targetFrameRate = targetFrameRate;
+		if (displayTiming) {
+			getRefreshCycleDuration = (PFN_vkGetRefreshCycleDurationGOOGLE) vkGetDeviceProcAddr(device, "vkGetRefreshCycleDurationGOOGLE");
+			getPastPresentationTiming = (PFN_vkGetPastPresentationTimingGOOGLE) vkGetDeviceProcAddr(device, "vkGetPastPresentationTimingGOOGLE");
+			if (getRefreshCycleDuration == nullptr || getPastPresentationTiming == nullptr) {
+				throw std::runtime_error("failed to load display timing functions!");
+			}
+		}
+		framePeriod = periodNanoseconds();
+		nextFrameAt = Clock::now();
+	}
+
+	bool isEnabled() const {
+		return targetFrameRate > 0;
+	}
+
+	bool hasDisplayTiming() const {
+		return getPastPresentationTiming != nullptr;
+	}
+
+	// Call with every new swap chain: the refresh rate may have changed with the
+	//monitor, and the old one's timings are gone
+	void setSwapchain(VkSwapchainKHR swapchain) {
+		this->swapchain = swapchain;
+		refreshDuration = 0;
+		lastShownId = 0;
+		lastShownTime = 0;
+		if (hasDisplayTiming()) {
+			VkRefreshCycleDurationGOOGLE refreshCycle = {};
+			if (getRefreshCycleDuration(device, swapchain, &refreshCycle) == VK_SUCCESS) {
+				refreshDuration = refreshCycle.refreshDuration;
+			}
+		}
+		framePeriod = periodNanoseconds();
+	}
+
+	// Seconds until the next frame is due, 0 when it is or without a limit
+	double secondsUntilNextFrame() const {
+		if (!isEnabled()) {
+			return 0.0;
+		}
+		std::chrono::duration<double> remaining = nextFrameAt - Clock::now();
+		return std::max(0.0, remaining.count());
+	}
+
+	// A frame is being drawn now. The next one is due a period after this one was, so
+	//a frame that started a little late doesn't push the following ones back. After
+	//more than a period without frames (idling) the schedule starts over from now.
+	void frameStarted() {
+		if (!isEnabled()) {
+			return;
+		}
+		Clock::time_point now = Clock::now();
+		std::chrono::nanoseconds period(framePeriod);
+		nextFrameAt = now - nextFrameAt > period ? now + period : nextFrameAt + period;
+	}
+
+	// Chains the time the next present would like to be shown at in front of
+	//presentInfo's pNext, with display timing and once a present has been shown.
+	//presentInfo must be submitted before the next call.
+	void applyPresentTime(VkPresentInfoKHR& presentInfo) {
+		if (!hasDisplayTiming()) {
+			return;
+		}
+		presentId++;
+		presentTime.presentID = presentId;
+		presentTime.desiredPresentTime = 0;
+		if (isEnabled() && lastShownId != 0) {
+			presentTime.desiredPresentTime = lastShownTime + (presentId - lastShownId) * framePeriod - refreshDuration / 2;
+			stats.paced++;
+		}
+
+		presentTimes.sType = VK_STRUCTURE_TYPE_PRESENT_TIMES_INFO_GOOGLE;
+		presentTimes.swapchainCount = 1;
+		presentTimes.pTimes = &presentTime;
+		presentTimes.pNext = presentInfo.pNext;
+		presentInfo.pNext = &presentTimes;
+	}
+
+	// Reads what the display did with past presents, which shows up a few frames
+	//after presenting. Call after every present.
+	void collectTimings() {
+		if (!hasDisplayTiming()) {
+			return;
+		}
+		uint32_t count = 0;
+		if (getPastPresentationTiming(device, swapchain, &count, nullptr) != VK_SUCCESS || count == 0) {
+			return;
+		}
+		timings.resize(count);
+		if (getPastPresentationTiming(device, swapchain, &count, timings.data()) != VK_SUCCESS) {
+			return;
+		}
+		for (uint32_t i = 0; i < count; i++) {
+			const VkPastPresentationTimingGOOGLE& timing = timings[i];
+			// A present that asked for a time is late when it missed the cycle it
+			//asked for
+			if (timing.desiredPresentTime != 0 && timing.actualPresentTime >= timing.desiredPresentTime + refreshDuration) {
+				stats.late++;
+			}
+			lastShownId = timing.presentID;
+			lastShownTime = timing.actualPresentTime;
+		}
+	}
+
+	// The main loop slept for this long, waiting for a frame to be due or for an event.
+	//idle is a wakeup that didn't lead to a frame.
+	void slept(Clock::duration duration, bool idle) {
+		stats.sleepNanoseconds += (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+		if (idle) {
+			stats.idleWakeups++;
+		}
+	}
+
+	void printStats(std::ostream& out) const {
+		out << "frame pacing: ";
+		if (isEnabled()) {
+			out << targetFrameRate << " fps target, " << std::fixed << std::setprecision(2) << framePeriod / 1e6 << " ms period";
+			if (refreshDuration != 0) {
+				out << " (" << refreshDuration / 1e6 << " ms refresh cycle)";
+			}
+			out << std::defaultfloat << ", ";
+		}
+		if (hasDisplayTiming()) {
+			out << stats.paced << " presents with a desired time, " << stats.late << " of them late, ";
+		}
+		out << std::fixed << std::setprecision(1) << stats.sleepNanoseconds / 1e9 << " s asleep, "
+			<< stats.idleWakeups << " wakeups without a frame" << std::defaultfloat << std::endl;
+	}
+
+private:
+	struct Stats {
+		uint64_t paced = 0;
+		uint64_t late = 0;
+		uint64_t sleepNanoseconds = 0;
+		uint64_t idleWakeups = 0;
+	};
+
+	const VDevice& device;
+
+	uint32_t targetFrameRate = 0;
+	// Nanoseconds between frames, 0 without a limit
+	uint64_t framePeriod = 0;
+	Clock::time_point nextFrameAt;
+
+	PFN_vkGetRefreshCycleDurationGOOGLE getRefreshCycleDuration = nullptr;
+	PFN_vkGetPastPresentationTimingGOOGLE getPastPresentationTiming = nullptr;
+	VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+	// Display timing: the refresh cycle (0 when unknown) and the last present shown,
+	//in the presentation engine's nanoseconds
+	uint64_t refreshDuration = 0;
+	uint32_t presentId = 0;
+	uint32_t lastShownId = 0;
+	uint64_t lastShownTime = 0;
+	VkPresentTimeGOOGLE presentTime = {};
+	VkPresentTimesInfoGOOGLE presentTimes = {};
+	std::vector<VkPastPresentationTimingGOOGLE> timings;
+
+	Stats stats;
+
+	// The target frame time in whole refresh cycles (the nearest number, at least one)
+	//when the refresh rate is known
+	uint64_t periodNanoseconds() const {
+		if (targetFrameRate == 0) {
+			return 0;
+		}
+		uint64_t period = 1000000000ull / targetFrameRate;
+		if (refreshDuration == 0) {
+			return period;
+		}
+		uint64_t cycles = std::max<uint64_t>(1, (period + refreshDuration / 2) / refreshDuration);
+		return cycles * refreshDuration;
+	}
+};
@@ -0,0 +1,250 @@
+#pragma once
+
+// CPU side frame timing.
+// The main loop wraps its steps (waiting for the frame's fence, acquiring, recording,
+//submitting, presenting) in scopes, and every duration goes into a histogram per
+//step. Every few seconds the p50/p95/p99 of each histogram are printed and the
+//histograms start over, so the numbers always describe the recent past.
+// The time spent waiting for the fence is the time the CPU had nothing to do because
+//the GPU was still busy: when it's a big part of the frame we're GPU bound, when
+//it's close to zero the CPU is the bottleneck.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// Counts durations in buckets that are 1/16th of a power of two wide, so the
+//relative error of a percentile is at most about 6% from nanoseconds to minutes,
+//with a fixed amount of memory and no allocation per sample.
+class LatencyHistogram {
+public:
+	LatencyHistogram() : buckets(BUCKET_COUNT, 0) {}
+
+	void add(uint64_t nanoseconds) {
+		buckets[bucketIndex(nanoseconds)]++;
+		if (count == 0 || nanoseconds < minimum) {
+			minimum = nanoseconds;
+		}
+		maximum = std::max(maximum, nanoseconds);
+		count++;
+	}
+
+	void clear() {
+		std::fill(buckets.begin(), buckets.end(), 0);
+		count = 0;
+		minimum = 0;
+		maximum = 0;
+	}
+
+	uint64_t sampleCount() const {
+		return count;
+	}
+
+	// The smallest duration that at least the given fraction of the samples is
+	//less or equal to, in nanoseconds (middle of its bucket)
+	uint64_t percentile(double fraction) const {
+		if (count == 0) {
+			return 0;
+		}
+		uint64_t rank = std::max<uint64_t>(1, (uint64_t) (fraction * count + 0.999999));
+		uint64_t seen = 0;
+		for (uint32_t i = 0; i < BUCKET_COUNT; i++) {
+			seen += buckets[i];
+			if (seen >= rank) {
+				// The exact extremes are known, don't report past them
+				return std::min(maximum, std::max(minimum, bucketMiddle(i)));
+			}
+		}
+		return maximum;
+	}
+
+	uint64_t largest() const {
+		return maximum;
+	}
+
+private:
+	// 16 sub-buckets per power of two
+	static const uint32_t SUB_BUCKET_BITS = 4;
+	static const uint32_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+	// Values below SUB_BUCKETS get a bucket each, then 16 per power of two up to 2^63
+	static const uint32_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	std::vector<uint32_t> buckets;
+	uint64_t count = 0;
+	uint64_t minimum = 0;
+	uint64_t maximum = 0;
+
+	static uint32_t highestBit(uint64_t value) {
+		uint32_t bit = 0;
+		while (value >>= 1) {
+			bit++;
+		}
+		return bit;
+	}
+
+	static uint32_t bucketIndex(uint64_t value) {
+		if (value < SUB_BUCKETS) {
+			return (uint32_t) value;
+		}
+		uint32_t bit = highestBit(value);
+		uint32_t shift = bit - SUB_BUCKET_BITS;
+		uint32_t subBucket = (uint32_t) (value >> shift) & (SUB_BUCKETS - 1);
+		return (shift + 1) * SUB_BUCKETS + subBucket;
+	}
+
+	static uint64_t bucketMiddle(uint32_t index) {
+		if (index < SUB_BUCKETS) {
+			return index;
+		}
+		uint32_t shift = index / SUB_BUCKETS - 1;
+		uint64_t lower = (uint64_t) (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+		return lower + ((1ull << shift) >> 1);
+	}
+};
+
+class FrameStats {
+public:
+	// What gets measured. InputToPresent goes from polling the window events to the
+	//present call returning, which is as far as the CPU can see: the time until the
+	//image is actually on screen depends on the present mode and the display.
+	enum Metric {
+		FrameTime,
+		InputToPresent,
+		FenceWait,
+		Acquire,
+		Record,
+		Submit,
+		Present,
+		METRIC_COUNT
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Reports every intervalSeconds, 0 turns the periodic report off (the totals are
+	//still printed at shutdown)
+	explicit FrameStats(uint32_t intervalSeconds) : interval(std::chrono::seconds(intervalSeconds)) {}
+
+	void record(Metric metric, Clock::duration duration) {
+		uint64_t nanoseconds = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+		histograms[metric].add(nanoseconds);
+		totals[metric].add(nanoseconds);
+	}
+
+	// Times the rest of the enclosing block
+	class Scope {
+	public:
+		Scope(FrameStats& stats, Metric metric) : stats(stats), metric(metric), start(Clock::now()) {}
+
+		~Scope() {
+			stats.record(metric, Clock::now() - start);
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		FrameStats& stats;
+		Metric metric;
+		Clock::time_point start;
+	};
+
+	// The window events (the input) were just polled
+	void inputSampled() {
+		inputSampledAt = Clock::now();
+	}
+
+	// The frame was handed to the presentation engine
+	void presented() {
+		record(InputToPresent, Clock::now() - inputSampledAt);
+	}
+
+	// Call once per main loop iteration. The frame time is the time between two
+	//calls, and the report is printed when its interval has passed.
+	void endFrame(std::ostream& out) {
+		Clock::time_point now = Clock::now();
+		if (frameStarted) {
+			record(FrameTime, now - lastFrameEnd);
+		}
+		else {
+			frameStarted = true;
+			reportStart = now;
+		}
+		lastFrameEnd = now;
+
+		if (interval.count() > 0 && now - reportStart >= interval) {
+			out << "frame stats, last " << std::chrono::duration_cast<std::chrono::seconds>(now - reportStart).count() << " s:" << std::endl;
+			print(out, histograms);
+			for (LatencyHistogram& histogram : histograms) {
+				histogram.clear();
+			}
+			reportStart = now;
+		}
+	}
+
+	// Everything since the start
+	void printStats(std::ostream& out) const {
+		out << "frame stats, whole run:" << std::endl;
+		print(out, totals);
+	}
+
+	// The whole run histogram of a metric
+	const LatencyHistogram& total(Metric metric) const {
+		return totals[metric];
+	}
+
+	static const char* metricName(Metric metric) {
+		switch (metric) {
+		case FrameTime: return "frame";
+		case InputToPresent: return "input to present";
+		case FenceWait: return "fence wait";
+		case Acquire: return "acquire";
+		case Record: return "record";
+		case Submit: return "submit";
+		case Present: return "present";
+		default: return "unknown";
+		}
+	}
+
+private:
+	Clock::duration interval;
+	// Since the last report, and since the start
+	LatencyHistogram histograms[METRIC_COUNT];
+	LatencyHistogram totals[METRIC_COUNT];
+
+	bool frameStarted = false;
+	Clock::time_point lastFrameEnd;
+	Clock::time_point reportStart;
+	Clock::time_point inputSampledAt;
+
+	static double toMs(uint64_t nanoseconds) {
+		return nanoseconds / 1e6;
+	}
+
+	static void print(std::ostream& out, const LatencyHistogram (&histograms)[METRIC_COUNT]) {
+		const LatencyHistogram& frame = histograms[FrameTime];
+		if (frame.sampleCount() == 0) {
+			out << "  no frames" << std::endl;
+			return;
+		}
+
+		out << std::fixed << std::setprecision(3);
+		for (int i = 0; i < METRIC_COUNT; i++) {
+			const LatencyHistogram& histogram = histograms[i];
+			out << "  " << std::setw(16) << std::left << metricName((Metric) i) << std::right
+				<< " p50 " << toMs(histogram.percentile(0.50))
+				<< " p95 " << toMs(histogram.percentile(0.95))
+				<< " p99 " << toMs(histogram.percentile(0.99))
+				<< " max " << toMs(histogram.largest()) << " ms"
+				<< " (" << histogram.sampleCount() << " samples)" << std::endl;
+		}
+
+		// A quarter of the frame spent waiting on the GPU is a lot of idle CPU time
+		double waitShare = std::min(1.0, (double) histograms[FenceWait].percentile(0.50) / std::max<uint64_t>(1, frame.percentile(0.50)));
+		out << "  " << std::setprecision(0) << waitShare * 100 << "% of the median frame waiting for the GPU: "
+			<< (waitShare > 0.25 ? "GPU bound" : "CPU bound") << std::endl;
+		out << std::defaultfloat;
+	}
+};
@@ -0,0 +1,337 @@
+#pragma once
+
+// GPU driven draws: a compute shader decides which objects are on screen and writes a
+//draw command for each of them, and a single vkCmdDrawIndexedIndirect* call draws
+//them all. Recording a frame costs the same for ten objects as for a million.
+// With VK_KHR_draw_indirect_count the visible objects' commands are packed at the
+//front of the buffer and counted, and the draw reads the count from the GPU too.
+//Without it every object keeps its own command, with instanceCount 0 when it was
+//culled, so the draw goes through all of them.
+// Each command draws one instance, whose firstInstance is the object's index: the
+//instanced vertex shader gets the object's placement as per instance attributes from
+//the same buffer the culling reads. That needs the multiDrawIndirect and
+//drawIndirectFirstInstance features.
+// The objects are written by the CPU every frame (see SceneStore.h), straight into
+//a persistently mapped buffer of the frame in flight, so there's no upload.
+// https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#drawing-indirect
+
+#include "DeviceMemoryAllocator.h"
+#include "FrameAllocator.h"
+#include "PipelineCache.h"
+#include "SceneStore.h"
+#include "VHandle.h"
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+class GpuCulling {
+public:
+	GpuCulling(const VDevice& device, const VkAllocationCallbacks* allocator, DeviceMemoryAllocator& memoryAllocator)
+		: device(device), allocator(allocator), memoryAllocator(memoryAllocator) {}
+
+	~GpuCulling() {
+		destroy();
+	}
+
+	GpuCulling(const GpuCulling&) = delete;
+	GpuCulling& operator=(const GpuCulling&) = delete;
+
+	static bool isSupported(const VkPhysicalDeviceFeatures& supported) {
+		return supported.multiDrawIndirect && supported.drawIndirectFirstInstance;
+	}
+
+	// Into the features of the logical device
+	static void enableFeatures(VkPhysicalDeviceFeatures& enabled) {
+		enabled.multiDrawIndirect = VK_TRUE;
+		enabled.drawIndirectFirstInstance = VK_TRUE;
+	}
+
+	// Creates the buffers for objectCount objects and the culling pipeline. Every
+	//object is drawn with indexCount indices of the bound index buffer. frameLayout
+	//is set 0 of the culling pipeline, with the camera in it. drawIndexedIndirectCount
+	//is nullptr without VK_KHR_draw_indirect_count.
+	void init(uint32_t objectCount, uint32_t indexCount, VkDescriptorSetLayout frameLayout, VkShaderModule cullShader,
+		PipelineCache& pipelineCache, PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount, uint32_t frameCount) {
+		destroy();
+		this->objectCount = objectCount;
+		this->indexCount = indexCount;
+		this->drawIndexedIndirectCount = drawIndexedIndirectCount;
+
+		// Written by the CPU once per frame and read by the GPU twice, device local
+		//host visible memory (if there is any) saves the GPU the trips over the bus
+		frames.resize(frameCount);
+		for (FrameObjects& frame : frames) {
+			createBuffer(frame.buffer, frame.memory, sizeof(SceneInstance) * objectCount,
+				VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		}
+		current = &frames[0];
+		createBuffer(commandBuffer_, commandMemory, sizeof(VkDrawIndexedIndirectCommand) * objectCount,
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+		createBuffer(countBuffer_, countMemory, sizeof(uint32_t),
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+
+		createDescriptors();
+		createPipeline(frameLayout, cullShader, pipelineCache);
+		enabled = true;
+	}
+
+	void destroy() {
+		enabled = false;
+		pipeline.reset();
+		pipelineLayout.reset();
+		descriptorPool.reset();
+		setLayout.reset();
+		for (FrameObjects& frame : frames) {
+			frame.buffer.reset();
+			memoryAllocator.free(frame.memory);
+		}
+		frames.clear();
+		current = nullptr;
+		commandBuffer_.reset();
+		countBuffer_.reset();
+		memoryAllocator.free(commandMemory);
+		memoryAllocator.free(countMemory);
+	}
+
+	bool isEnabled() const {
+		return enabled;
+	}
+
+	// Hot reload: creates the culling pipeline again from a new module of the cull
+	//shader and returns the old one, which has to live until the frames using it are
+	//done. The old pipeline stays when the new one can't be created.
+	VPipeline reloadPipeline(VkShaderModule cullShader, PipelineCache& pipelineCache) {
+		VPipeline reloaded;
+		createComputePipeline(cullShader, pipelineCache, reloaded);
+		std::swap(pipeline, reloaded);
+		return reloaded;
+	}
+
+	// Whether the visible commands are packed and counted (see countBuffer())
+	bool compacts() const {
+		return drawIndexedIndirectCount != nullptr;
+	}
+
+	// Switches to the objects of a frame in flight. Call it after waiting for the
+	//frame's fence, the GPU is done with them then.
+	void beginFrame(uint32_t frameIndex) {
+		current = &frames[frameIndex];
+	}
+
+	// Where the frame's objects go, objectCount of them
+	SceneInstance* objects() {
+		return (SceneInstance*) current->memory.mapped;
+	}
+
+	// Makes the written objects visible to the GPU, before submitting the frame
+	void flushObjects() {
+		memoryAllocator.flush(current->memory, 0, sizeof(SceneInstance) * objectCount);
+	}
+
+	// The frame's per instance vertex data, binding 1 of the instanced pipeline
+	VkBuffer objectBuffer() const {
+		return current->buffer;
+	}
+
+	// Written by the culling, read by the draw
+	VkBuffer commandBuffer() const {
+		return commandBuffer_;
+	}
+
+	VkBuffer countBuffer() const {
+		return countBuffer_;
+	}
+
+	// Compacting only: the count goes back to 0 before the culling adds to it
+	void recordReset(VkCommandBuffer commandBuffer) {
+		vkCmdFillBuffer(commandBuffer, countBuffer_, 0, sizeof(uint32_t), 0);
+	}
+
+	// uniforms are the frame's FrameUniforms, for the camera
+	void recordCull(VkCommandBuffer commandBuffer, const FrameAllocator& frameAllocator, const FrameAllocator::Allocation& uniforms) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		frameAllocator.bindUniforms(commandBuffer, pipelineLayout, 0, uniforms, VK_PIPELINE_BIND_POINT_COMPUTE);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 1, 1, &current->descriptorSet, 0, nullptr);
+
+		CullPushConstants pushConstants;
+		pushConstants.objectCount = objectCount;
+		pushConstants.indexCount = indexCount;
+		pushConstants.compact = compacts() ? 1 : 0;
+		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+		vkCmdDispatch(commandBuffer, (objectCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+		culledFrames++;
+	}
+
+	// Every object's draw in one call. The instanced pipeline, the vertex buffers and
+	//the index buffer have to be bound.
+	void recordDraws(VkCommandBuffer commandBuffer) {
+		if (compacts()) {
+			drawIndexedIndirectCount(commandBuffer, commandBuffer_, 0, countBuffer_, 0, objectCount, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else {
+			vkCmdDrawIndexedIndirect(commandBuffer, commandBuffer_, 0, objectCount, sizeof(VkDrawIndexedIndirectCommand));
+		}
+	}
+
+	void printStats(std::ostream& out) const {
+		if (!enabled) {
+			return;
+		}
+		out << "gpu culling: " << objectCount << " objects culled on the GPU in " << culledFrames << " frames, "
+			<< (compacts() ? "compacted with draw indirect count" : "one command per object") << std::endl;
+	}
+
+private:
+	// Has to match local_size_x in shaders/cull.comp
+	static const uint32_t WORKGROUP_SIZE = 64;
+
+	// See PushConstants in shaders/cull.comp
+	struct CullPushConstants {
+		uint32_t objectCount;
+		uint32_t indexCount;
+		uint32_t compact;
+	};
+
+	// The objects of one frame in flight, and set 1 of the culling pipeline for them
+	struct FrameObjects {
+		VBuffer buffer;
+		DeviceAllocation memory;
+		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+	DeviceMemoryAllocator& memoryAllocator;
+
+	bool enabled = false;
+	uint32_t objectCount = 0;
+	uint32_t indexCount = 0;
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = nullptr;
+	uint64_t culledFrames = 0;
+
+	std::vector<FrameObjects> frames;
+	FrameObjects* current = nullptr;
+	VBuffer commandBuffer_;
+	DeviceAllocation commandMemory;
+	VBuffer countBuffer_;
+	DeviceAllocation countMemory;
+
+	VDescriptorSetLayout setLayout;
+	VDescriptorPool descriptorPool;
+	VPipelineLayout pipelineLayout;
+	VPipeline pipeline;
+
+	void createBuffer(VBuffer& buffer, DeviceAllocation& memory, VkDeviceSize size, VkBufferUsageFlags usage,
+		VkMemoryPropertyFlags requiredFlags, VkMemoryPropertyFlags preferredFlags) {
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = size;
+		bufferInfo.usage = usage;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateBuffer(device, &bufferInfo, allocator, buffer.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling buffer!");
+		}
+		memory = memoryAllocator.allocateAndBind(buffer, requiredFlags, preferredFlags);
+	}
+
+	// Set 1 of the culling pipeline: objects, commands and count, in that order. One
+	//set per frame in flight, they only differ in the objects.
+	void createDescriptors() {
+		VkDescriptorSetLayoutBinding bindings[3] = {};
+		for (uint32_t i = 0; i < 3; i++) {
+			bindings[i].binding = i;
+			bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			bindings[i].descriptorCount = 1;
+			bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		}
+
+		VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+		layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount = 3;
+		layoutInfo.pBindings = bindings;
+		if (vkCreateDescriptorSetLayout(device, &layoutInfo, allocator, setLayout.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling descriptor set layout!");
+		}
+
+		VkDescriptorPoolSize poolSize = {};
+		poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSize.descriptorCount = 3 * (uint32_t) frames.size();
+
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = (uint32_t) frames.size();
+		poolInfo.poolSizeCount = 1;
+		poolInfo.pPoolSizes = &poolSize;
+		if (vkCreateDescriptorPool(device, &poolInfo, allocator, descriptorPool.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling descriptor pool!");
+		}
+
+		std::vector<VkDescriptorSetLayout> layouts(frames.size(), setLayout);
+		std::vector<VkDescriptorSet> sets(frames.size());
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = descriptorPool;
+		allocInfo.descriptorSetCount = (uint32_t) layouts.size();
+		allocInfo.pSetLayouts = layouts.data();
+		if (vkAllocateDescriptorSets(device, &allocInfo, sets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate culling descriptor sets!");
+		}
+
+		for (uint32_t frame = 0; frame < (uint32_t) frames.size(); frame++) {
+			frames[frame].descriptorSet = sets[frame];
+
+			VkDescriptorBufferInfo bufferInfos[3] = {};
+			bufferInfos[0].buffer = frames[frame].buffer;
+			bufferInfos[1].buffer = commandBuffer_;
+			bufferInfos[2].buffer = countBuffer_;
+			VkWriteDescriptorSet writes[3] = {};
+			for (uint32_t i = 0; i < 3; i++) {
+				bufferInfos[i].offset = 0;
+				bufferInfos[i].range = VK_WHOLE_SIZE;
+				writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				writes[i].dstSet = sets[frame];
+				writes[i].dstBinding = i;
+				writes[i].descriptorCount = 1;
+				writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writes[i].pBufferInfo = &bufferInfos[i];
+			}
+			vkUpdateDescriptorSets(device, 3, writes, 0, nullptr);
+		}
+	}
+
+	void createPipeline(VkDescriptorSetLayout frameLayout, VkShaderModule cullShader, PipelineCache& pipelineCache) {
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(CullPushConstants);
+
+		VkDescriptorSetLayout setLayouts[] = { frameLayout, setLayout };
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = 2;
+		pipelineLayoutInfo.pSetLayouts = setLayouts;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, pipelineLayout.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling pipeline layout!");
+		}
+		createComputePipeline(cullShader, pipelineCache, pipeline);
+	}
+
+	void createComputePipeline(VkShaderModule cullShader, PipelineCache& pipelineCache, VPipeline& computePipeline) {
+		VkComputePipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = cullShader;
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = pipelineLayout;
+		if (pipelineCache.createComputePipelines(1, &pipelineInfo, computePipeline.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create culling pipeline!");
+		}
+	}
+};
@@ -0,0 +1,325 @@
+#pragma once
+
+// GPU timing with timestamp queries.
+// vkCmdWriteTimestamp stores the GPU clock in a query once all previous commands
+//reached the given pipeline stage. Two of them around a piece of work (a scope) tell
+//how long the GPU spent on it. The values are in ticks of timestampPeriod
+//nanoseconds and only the low timestampValidBits bits are meaningful, both come
+//from the device.
+// Every frame in flight has its own query pool. A pool is read back when its frame
+//slot comes around again, after the frame's fence was waited on, so the results are
+//there already and reading them never stalls.
+// https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#queries-timestamps
+
+#include "VHandle.h"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+class GpuProfiler {
+public:
+	GpuProfiler(const VDevice& device, const VkAllocationCallbacks* allocator)
+		: device(device), allocator(allocator) {}
+
+	// Creates a query pool per frame in flight, with room for maxScopes scopes each.
+	//The queue family is the one the measured command buffers are submitted to:
+	//timestamp support is per family and some families (often transfer only ones)
+	//have none, in which case the profiler just stays disabled.
+	void init(VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t frameCount, uint32_t maxScopes = 64) {
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		timestampPeriod = properties.limits.timestampPeriod;
+
+		uint32_t queueFamilyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+		timestampValidBits = queueFamily < queueFamilyCount ? queueFamilies[queueFamily].timestampValidBits : 0;
+
+		slots.clear();
+		if (timestampValidBits == 0) {
+			std::cout << "gpu profiler: no timestamp support on queue family " << queueFamily << ", disabled" << std::endl;
+			return;
+		}
+		timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+
+		this->maxScopes = maxScopes;
+		slots.resize(frameCount);
+		for (FrameSlot& slot : slots) {
+			VkQueryPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			// A begin and an end timestamp per scope
+			poolInfo.queryCount = 2 * maxScopes;
+
+			if (vkCreateQueryPool(device, &poolInfo, allocator, slot.queryPool.replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create query pool!");
+			}
+			slot.scopes.reserve(maxScopes);
+			slot.timestamps.resize(2 * maxScopes);
+		}
+	}
+
+	bool isEnabled() const {
+		return !slots.empty();
+	}
+
+	// Starts measuring a frame in the given frame slot. Call it right after waiting
+	//for the slot's fence, with the frame's command buffer in the recording state and
+	//outside of any render pass: the results of the slot's previous frame are
+	//collected and its queries are reset for this one.
+	void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint64_t frameNumber) {
+		if (!isEnabled()) {
+			return;
+		}
+		currentSlot = &slots[frameIndex];
+		collect(*currentSlot);
+
+		currentSlot->frameNumber = frameNumber;
+		currentSlot->scopes.clear();
+		openScopes = 0;
+		vkCmdResetQueryPool(commandBuffer, currentSlot->queryPool, 0, 2 * maxScopes);
+	}
+
+	// Marks the start of a named scope. Scopes can be nested and the name has to stay
+	//valid until the scope is read back, string literals are the intended use.
+	//Returns the id to end the scope with, which is NO_SCOPE if the profiler is
+	//disabled or the frame ran out of queries.
+	uint32_t beginScope(VkCommandBuffer commandBuffer, const char* name) {
+		if (currentSlot == nullptr || currentSlot->scopes.size() >= maxScopes) {
+			if (currentSlot != nullptr) {
+				droppedScopes++;
+			}
+			return NO_SCOPE;
+		}
+
+		uint32_t scope = (uint32_t) currentSlot->scopes.size();
+		currentSlot->scopes.push_back({ name, openScopes });
+		openScopes++;
+		// Written once all previous commands have started, the closest there is to
+		//"when the scope's work can start"
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, currentSlot->queryPool, 2 * scope);
+		return scope;
+	}
+
+	void endScope(VkCommandBuffer commandBuffer, uint32_t scope) {
+		if (currentSlot == nullptr || scope == NO_SCOPE) {
+			return;
+		}
+		openScopes--;
+		// Written once all previous commands have completed
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, currentSlot->queryPool, 2 * scope + 1);
+	}
+
+	// Begins a scope on construction and ends it when going out of scope
+	class Scope {
+	public:
+		Scope(GpuProfiler& profiler, VkCommandBuffer commandBuffer, const char* name)
+			: profiler(profiler), commandBuffer(commandBuffer), scope(profiler.beginScope(commandBuffer, name)) {}
+
+		~Scope() {
+			profiler.endScope(commandBuffer, scope);
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		GpuProfiler& profiler;
+		VkCommandBuffer commandBuffer;
+		uint32_t scope;
+	};
+
+	// Writes the frames kept in the history, one row per scope. A path ending in
+	//.json gives JSON, anything else CSV. Returns false if the file can't be written.
+	bool dump(const std::string& path) const {
+		std::ofstream file(path, std::ios::trunc);
+		if (!file.is_open()) {
+			std::cerr << "failed to open " << path << " for the gpu profile" << std::endl;
+			return false;
+		}
+
+		bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+		file << std::fixed << std::setprecision(6);
+		if (json) {
+			writeJson(file);
+		}
+		else {
+			writeCsv(file);
+		}
+
+		if (!file) {
+			std::cerr << "failed to write the gpu profile to " << path << std::endl;
+			return false;
+		}
+		std::cout << "gpu profile: " << history.size() << " frames written to " << path << std::endl;
+		return true;
+	}
+
+	// Average, minimum and maximum per scope name over all frames measured so far
+	void printStats(std::ostream& out) const {
+		if (!isEnabled()) {
+			out << "gpu profiler: disabled" << std::endl;
+			return;
+		}
+
+		out << "gpu profiler: " << measuredFrames << " frames measured";
+		if (unavailableFrames > 0) {
+			out << ", " << unavailableFrames << " not ready at readback";
+		}
+		if (droppedScopes > 0) {
+			out << ", " << droppedScopes << " scopes over the limit of " << maxScopes;
+		}
+		out << std::endl;
+
+		out << std::fixed << std::setprecision(3);
+		for (const auto& entry : totals) {
+			const ScopeTotals& scope = entry.second;
+			out << "  " << entry.first << ": " << scope.totalMs / scope.count << " ms avg, "
+				<< scope.minMs << " min, " << scope.maxMs << " max" << std::endl;
+		}
+		out << std::defaultfloat;
+	}
+
+	// Name and milliseconds of the scopes of the last frame measured, nothing before
+	//the first one
+	std::vector<std::pair<const char*, double>> latestScopes() const {
+		std::vector<std::pair<const char*, double>> scopes;
+		if (!history.empty()) {
+			for (const ScopeSample& scope : history.back().scopes) {
+				scopes.push_back({ scope.name, scope.milliseconds });
+			}
+		}
+		return scopes;
+	}
+
+	static const uint32_t NO_SCOPE = UINT32_MAX;
+
+	// Frames kept for dump()
+	static const size_t HISTORY_FRAMES = 1024;
+
+private:
+	struct ScopeInfo {
+		const char* name;
+		// How many scopes were open when this one began
+		uint32_t depth;
+	};
+
+	struct FrameSlot {
+		VQueryPool queryPool;
+		uint64_t frameNumber = 0;
+		// Scopes begun in the frame that was last recorded in this slot
+		std::vector<ScopeInfo> scopes;
+		// Readback space, two per scope
+		std::vector<uint64_t> timestamps;
+	};
+
+	struct ScopeSample {
+		const char* name;
+		uint32_t depth;
+		double milliseconds;
+	};
+
+	struct FrameSample {
+		uint64_t frameNumber;
+		std::vector<ScopeSample> scopes;
+	};
+
+	struct ScopeTotals {
+		uint64_t count = 0;
+		double totalMs = 0.0;
+		double minMs = 0.0;
+		double maxMs = 0.0;
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+
+	float timestampPeriod = 1.0f;
+	uint32_t timestampValidBits = 0;
+	uint64_t timestampMask = 0;
+	uint32_t maxScopes = 0;
+
+	std::vector<FrameSlot> slots;
+	FrameSlot* currentSlot = nullptr;
+	uint32_t openScopes = 0;
+
+	std::deque<FrameSample> history;
+	std::map<std::string, ScopeTotals> totals;
+	uint64_t measuredFrames = 0;
+	uint64_t unavailableFrames = 0;
+	uint64_t droppedScopes = 0;
+
+	// Reads the timestamps of the slot's last frame into the history. The frame's
+	//fence has been waited on, so VK_QUERY_RESULT_WAIT_BIT isn't needed; if the
+	//results aren't there anyway the frame is skipped rather than waited for.
+	void collect(FrameSlot& slot) {
+		if (slot.scopes.empty()) {
+			return;
+		}
+
+		uint32_t queryCount = 2 * (uint32_t) slot.scopes.size();
+		VkResult result = vkGetQueryPoolResults(device, slot.queryPool, 0, queryCount,
+			queryCount * sizeof(uint64_t), slot.timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if (result != VK_SUCCESS) {
+			unavailableFrames++;
+			return;
+		}
+
+		FrameSample sample;
+		sample.frameNumber = slot.frameNumber;
+		sample.scopes.reserve(slot.scopes.size());
+		for (size_t i = 0; i < slot.scopes.size(); i++) {
+			// Masking the difference handles a counter that wrapped around in between
+			uint64_t ticks = (slot.timestamps[2 * i + 1] - slot.timestamps[2 * i]) & timestampMask;
+			double milliseconds = ticks * (double) timestampPeriod / 1e6;
+			sample.scopes.push_back({ slot.scopes[i].name, slot.scopes[i].depth, milliseconds });
+
+			ScopeTotals& scope = totals[slot.scopes[i].name];
+			scope.minMs = scope.count == 0 ? milliseconds : std::min(scope.minMs, milliseconds);
+			scope.maxMs = scope.count == 0 ? milliseconds : std::max(scope.maxMs, milliseconds);
+			scope.totalMs += milliseconds;
+			scope.count++;
+		}
+
+		history.push_back(std::move(sample));
+		if (history.size() > HISTORY_FRAMES) {
+			history.pop_front();
+		}
+		measuredFrames++;
+	}
+
+	void writeCsv(std::ostream& out) const {
+		out << "frame,scope,depth,ms" << std::endl;
+		for (const FrameSample& frame : history) {
+			for (const ScopeSample& scope : frame.scopes) {
+				out << frame.frameNumber << "," << scope.name << "," << scope.depth << "," << scope.milliseconds << std::endl;
+			}
+		}
+	}
+
+	// Scope names are our own literals, so they don't need escaping
+	void writeJson(std::ostream& out) const {
+		out << "{\"timestampPeriod\": " << timestampPeriod << ", \"timestampValidBits\": " << timestampValidBits
+			<< ", \"frames\": [" << std::endl;
+		for (size_t i = 0; i < history.size(); i++) {
+			const FrameSample& frame = history[i];
+			out << "  {\"frame\": " << frame.frameNumber << ", \"scopes\": [";
+			for (size_t j = 0; j < frame.scopes.size(); j++) {
+				const ScopeSample& scope = frame.scopes[j];
+				out << (j > 0 ? ", " : "") << "{\"name\": \"" << scope.name << "\", \"depth\": " << scope.depth
+					<< ", \"ms\": " << scope.milliseconds << "}";
+			}
+			out << "]}" << (i + 1 < history.size() ? "," : "") << std::endl;
+		}
+		out << "]}" << std::endl;
+	}
+};
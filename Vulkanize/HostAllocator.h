@@ -0,0 +1,317 @@
+#pragma once
+
+// Host memory allocator for the driver (VkAllocationCallbacks).
+// Every vkCreateXXX/vkDestroyXXX takes a pointer to these callbacks, nullptr meaning
+//"use the driver's own allocator". Plugging in our own lets us see exactly how much
+//host memory the driver uses (per allocation scope), and lets the many small,
+//short lived allocations drivers do go to a pool instead of the system heap.
+// https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#memory-allocation
+
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+// _aligned_malloc
+#include <malloc.h>
+#endif
+
+enum class HostAllocatorMode {
+	// Don't install callbacks, the driver uses its own allocator
+	Driver,
+	// Every allocation goes to the system heap, but is counted
+	Tracking,
+	// Counted, and small allocations are served from size class pools
+	Pool
+};
+
+inline HostAllocatorMode parseHostAllocatorMode(const std::string& value) {
+	if (value == "driver") return HostAllocatorMode::Driver;
+	if (value == "tracking") return HostAllocatorMode::Tracking;
+	if (value == "pool") return HostAllocatorMode::Pool;
+	throw std::runtime_error("unknown host allocator '" + value + "' (use driver, tracking or pool)");
+}
+
+class HostAllocator {
+public:
+	HostAllocator(HostAllocatorMode mode) : mode(mode) {
+		allocationCallbacks.pUserData = this;
+		allocationCallbacks.pfnAllocation = &HostAllocator::allocationFunction;
+		allocationCallbacks.pfnReallocation = &HostAllocator::reallocationFunction;
+		allocationCallbacks.pfnFree = &HostAllocator::freeFunction;
+		allocationCallbacks.pfnInternalAllocation = &HostAllocator::internalAllocationNotification;
+		allocationCallbacks.pfnInternalFree = &HostAllocator::internalFreeNotification;
+	}
+
+	// Must outlive every Vulkan object created with its callbacks
+	~HostAllocator() {
+		for (auto& sizeClass : sizeClasses) {
+			for (void* chunk : sizeClass.chunks) {
+				systemFree(chunk);
+			}
+		}
+	}
+
+	HostAllocator(const HostAllocator&) = delete;
+	HostAllocator& operator=(const HostAllocator&) = delete;
+
+	// What to pass as pAllocator, nullptr in Driver mode
+	const VkAllocationCallbacks* callbacks() const {
+		return mode == HostAllocatorMode::Driver ? nullptr : &allocationCallbacks;
+	}
+
+	HostAllocatorMode allocatorMode() const {
+		return mode;
+	}
+
+	size_t bytesInUse() const {
+		return (size_t) currentBytes.load();
+	}
+
+	size_t peakBytes() const {
+		return (size_t) maxBytes.load();
+	}
+
+	void printStats(std::ostream& out) const {
+		if (mode == HostAllocatorMode::Driver) {
+			return;
+		}
+
+		static const char* scopeNames[SCOPE_COUNT] = { "command", "object", "cache", "device", "instance" };
+
+		out << "driver host memory: " << currentBytes.load() << " bytes in use (peak " << maxBytes.load() << "), "
+			<< allocationCount.load() << " allocations, " << reallocationCount.load() << " reallocations, "
+			<< freeCount.load() << " frees, " << internalBytes.load() << " bytes internal" << std::endl;
+		for (int scope = 0; scope < SCOPE_COUNT; scope++) {
+			out << "\t" << scopeNames[scope] << " scope: " << scopeBytes[scope].load() << " bytes" << std::endl;
+		}
+	}
+
+private:
+	static const int SCOPE_COUNT = 5;
+	// Pools serve blocks of 32 bytes up to 4 KiB, in power of two size classes. Each
+	//class carves its blocks out of 64 KiB chunks aligned to the biggest class, so
+	//every block is aligned to its own size.
+	static const size_t MIN_CLASS_SIZE = 32;
+	static const size_t MAX_CLASS_SIZE = 4096;
+	static const int CLASS_COUNT = 8;
+	static const size_t CHUNK_SIZE = 64 * 1024;
+
+	// Placed right before the pointer we hand out, the free callback only gets the pointer
+	struct Header {
+		size_t size;
+		// Distance from the start of the underlying block to the returned pointer
+		uint32_t offset;
+		// Size class of the block, -1 if it came from the system heap
+		int32_t sizeClass;
+		VkSystemAllocationScope scope;
+	};
+
+	struct SizeClass {
+		std::mutex mutex;
+		// Free blocks, linked through their first bytes
+		void* freeList = nullptr;
+		std::vector<void*> chunks;
+	};
+
+	HostAllocatorMode mode;
+	VkAllocationCallbacks allocationCallbacks = {};
+	SizeClass sizeClasses[CLASS_COUNT];
+
+	std::atomic<int64_t> currentBytes{ 0 };
+	std::atomic<int64_t> maxBytes{ 0 };
+	std::atomic<int64_t> internalBytes{ 0 };
+	std::atomic<int64_t> scopeBytes[SCOPE_COUNT] = {};
+	std::atomic<uint64_t> allocationCount{ 0 };
+	std::atomic<uint64_t> reallocationCount{ 0 };
+	std::atomic<uint64_t> freeCount{ 0 };
+
+	static size_t alignUp(size_t value, size_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	static void* systemAlloc(size_t size, size_t alignment) {
+		if (alignment < sizeof(void*)) alignment = sizeof(void*);
+#ifdef _WIN32
+		return _aligned_malloc(size, alignment);
+#else
+		void* memory = nullptr;
+		return posix_memalign(&memory, alignment, size) == 0 ? memory : nullptr;
+#endif
+	}
+
+	static void systemFree(void* memory) {
+#ifdef _WIN32
+		_aligned_free(memory);
+#else
+		::free(memory);
+#endif
+	}
+
+	static Header* headerOf(void* memory) {
+		return (Header*) ((char*) memory - sizeof(Header));
+	}
+
+	void* allocate(size_t size, size_t alignment, VkSystemAllocationScope scope) {
+		if (size == 0) {
+			return nullptr;
+		}
+		if (alignment < alignof(Header)) {
+			alignment = alignof(Header);
+		}
+
+		// The header goes right before the returned pointer, which must stay aligned
+		size_t headerSpace = alignUp(sizeof(Header), alignment);
+		size_t total = headerSpace + size;
+
+		void* block = nullptr;
+		int32_t sizeClass = -1;
+		if (mode == HostAllocatorMode::Pool && total <= MAX_CLASS_SIZE) {
+			sizeClass = classIndex(total);
+			block = poolAlloc(sizeClass);
+		}
+		else {
+			block = systemAlloc(total, alignment);
+		}
+		// Returning nullptr tells the driver we're out of host memory
+		if (block == nullptr) {
+			return nullptr;
+		}
+
+		void* memory = (char*) block + headerSpace;
+		Header* header = headerOf(memory);
+		header->size = size;
+		header->offset = (uint32_t) headerSpace;
+		header->sizeClass = sizeClass;
+		header->scope = scope;
+
+		allocationCount++;
+		track(size, scope);
+		return memory;
+	}
+
+	void release(void* memory) {
+		if (memory == nullptr) {
+			return;
+		}
+
+		Header* header = headerOf(memory);
+		untrack(header->size, header->scope);
+		freeCount++;
+
+		void* block = (char*) memory - header->offset;
+		if (header->sizeClass >= 0) {
+			poolFree(header->sizeClass, block);
+		}
+		else {
+			systemFree(block);
+		}
+	}
+
+	void* reallocate(void* original, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+		reallocationCount++;
+
+		// Same semantics as realloc: no original means allocate, no size means free
+		if (original == nullptr) {
+			return allocate(size, alignment, scope);
+		}
+		if (size == 0) {
+			release(original);
+			return nullptr;
+		}
+
+		void* memory = allocate(size, alignment, scope);
+		if (memory == nullptr) {
+			// The original allocation must be left untouched when we fail
+			return nullptr;
+		}
+
+		size_t originalSize = headerOf(original)->size;
+		memcpy(memory, original, originalSize < size ? originalSize : size);
+		release(original);
+		return memory;
+	}
+
+	static int32_t classIndex(size_t size) {
+		int32_t index = 0;
+		for (size_t classSize = MIN_CLASS_SIZE; classSize < size; classSize *= 2) {
+			index++;
+		}
+		return index;
+	}
+
+	void* poolAlloc(int32_t index) {
+		SizeClass& sizeClass = sizeClasses[index];
+		std::lock_guard<std::mutex> lock(sizeClass.mutex);
+
+		if (sizeClass.freeList == nullptr) {
+			// Carve a new chunk into blocks of this class and put them on the free list
+			size_t classSize = MIN_CLASS_SIZE << index;
+			char* chunk = (char*) systemAlloc(CHUNK_SIZE, MAX_CLASS_SIZE);
+			if (chunk == nullptr) {
+				return nullptr;
+			}
+			sizeClass.chunks.push_back(chunk);
+
+			for (size_t offset = 0; offset + classSize <= CHUNK_SIZE; offset += classSize) {
+				*(void**) (chunk + offset) = sizeClass.freeList;
+				sizeClass.freeList = chunk + offset;
+			}
+		}
+
+		void* block = sizeClass.freeList;
+		sizeClass.freeList = *(void**) block;
+		return block;
+	}
+
+	void poolFree(int32_t index, void* block) {
+		SizeClass& sizeClass = sizeClasses[index];
+		std::lock_guard<std::mutex> lock(sizeClass.mutex);
+
+		*(void**) block = sizeClass.freeList;
+		sizeClass.freeList = block;
+	}
+
+	void track(size_t size, VkSystemAllocationScope scope) {
+		int64_t current = currentBytes += (int64_t) size;
+		scopeBytes[scope] += (int64_t) size;
+
+		// Lock free maximum
+		int64_t peak = maxBytes.load();
+		while (current > peak && !maxBytes.compare_exchange_weak(peak, current)) {}
+	}
+
+	void untrack(size_t size, VkSystemAllocationScope scope) {
+		currentBytes -= (int64_t) size;
+		scopeBytes[scope] -= (int64_t) size;
+	}
+
+	// The callbacks themselves, which forward to the instance in pUserData
+	static void* VKAPI_PTR allocationFunction(void* pUserData, size_t size, size_t alignment, VkSystemAllocationScope allocationScope) {
+		return ((HostAllocator*) pUserData)->allocate(size, alignment, allocationScope);
+	}
+
+	static void* VKAPI_PTR reallocationFunction(void* pUserData, void* pOriginal, size_t size, size_t alignment, VkSystemAllocationScope allocationScope) {
+		return ((HostAllocator*) pUserData)->reallocate(pOriginal, size, alignment, allocationScope);
+	}
+
+	static void VKAPI_PTR freeFunction(void* pUserData, void* pMemory) {
+		((HostAllocator*) pUserData)->release(pMemory);
+	}
+
+	// Memory the driver allocated itself (executable memory for shaders, for example),
+	//we're just told about it
+	static void VKAPI_PTR internalAllocationNotification(void* pUserData, size_t size, VkInternalAllocationType allocationType, VkSystemAllocationScope allocationScope) {
+		((HostAllocator*) pUserData)->internalBytes += (int64_t) size;
+	}
+
+	static void VKAPI_PTR internalFreeNotification(void* pUserData, size_t size, VkInternalAllocationType allocationType, VkSystemAllocationScope allocationScope) {
+		((HostAllocator*) pUserData)->internalBytes -= (int64_t) size;
+	}
+};
@@ -0,0 +1,173 @@
+#pragma once
+
+// Small pool of worker threads for CPU work that can be split in independent pieces,
+//like recording command buffers. Vulkan lets any thread record commands, as long as
+//a command pool (and everything allocated from it) is only used by one thread at a
+//time, so the usual setup is a command pool per thread.
+// https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#fundamentals-threadingbehavior
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem {
+public:
+	// threadCount includes the thread that calls parallelFor, which works too. 0 means
+	//one thread per hardware thread.
+	explicit JobSystem(uint32_t threadCount = 0) {
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		for (uint32_t i = 1; i < threadCount; i++) {
+			workers.emplace_back(&JobSystem::workerLoop, this);
+		}
+	}
+
+	~JobSystem() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeWorkers.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Workers plus the calling thread
+	uint32_t threadCount() const {
+		return (uint32_t) workers.size() + 1;
+	}
+
+	// Calls job(index) for every index in [0, count), spread over the workers and the
+	//calling thread, and returns once all of them are done. Every index runs exactly
+	//once, on a single thread, so per index resources (like a command pool) need no
+	//locking. The first exception thrown by a job is rethrown here.
+	void parallelFor(uint32_t count, const std::function<void(uint32_t)>& job) {
+		if (count == 0) {
+			return;
+		}
+		// Not worth waking anybody up for
+		if (count == 1 || workers.empty()) {
+			for (uint32_t i = 0; i < count; i++) {
+				job(i);
+			}
+			return;
+		}
+
+		Batch batch(count, job);
+		uint32_t helpers = std::min<uint32_t>(count - 1, (uint32_t) workers.size());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (uint32_t i = 0; i < helpers; i++) {
+				queue.push_back(&batch);
+			}
+		}
+		if (helpers == 1) {
+			wakeWorkers.notify_one();
+		}
+		else {
+			wakeWorkers.notify_all();
+		}
+
+		work(batch);
+
+		// All indices have been handed out. Helpers that didn't pick the batch up yet 
+		//are still queued and have nothing left to do, so take them out: after this no
+		//worker can start on the batch anymore.
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.erase(std::remove(queue.begin(), queue.end(), &batch), queue.end());
+		}
+		// The batch lives on our stack, so wait for the helpers that did pick it up to
+		//let go of it, not only for the indices to be done
+		{
+			std::unique_lock<std::mutex> lock(batch.mutex);
+			batch.finished.wait(lock, [&] { return batch.activeHelpers == 0 && batch.completed == batch.count; });
+		}
+
+		if (batch.error) {
+			std::rethrow_exception(batch.error);
+		}
+	}
+
+private:
+	struct Batch {
+		Batch(uint32_t count, const std::function<void(uint32_t)>& job) : count(count), job(job) {}
+
+		const uint32_t count;
+		const std::function<void(uint32_t)>& job;
+		// Next index to hand out
+		std::atomic<uint32_t> next{ 0 };
+
+		std::mutex mutex;
+		std::condition_variable finished;
+		uint32_t completed = 0;
+		uint32_t activeHelpers = 0;
+		std::exception_ptr error;
+	};
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wakeWorkers;
+	// One entry per helper a batch asked for
+	std::deque<Batch*> queue;
+	bool stopping = false;
+
+	// Takes indices off the batch until there are none left
+	static void work(Batch& batch) {
+		uint32_t done = 0;
+		std::exception_ptr error;
+		for (uint32_t index = batch.next++; index < batch.count; index = batch.next++) {
+			try {
+				batch.job(index);
+			}
+			catch (...) {
+				if (!error) {
+					error = std::current_exception();
+				}
+			}
+			done++;
+		}
+
+		std::lock_guard<std::mutex> lock(batch.mutex);
+		batch.completed += done;
+		if (error && !batch.error) {
+			batch.error = error;
+		}
+	}
+
+	void workerLoop() {
+		for (;;) {
+			Batch* batch;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeWorkers.wait(lock, [this] { return stopping || !queue.empty(); });
+				if (stopping) {
+					return;
+				}
+				batch = queue.front();
+				queue.pop_front();
+				// Registered while the queue lock is held, so parallelFor can't miss us
+				std::lock_guard<std::mutex> batchLock(batch->mutex);
+				batch->activeHelpers++;
+			}
+
+			work(*batch);
+
+			std::lock_guard<std::mutex> batchLock(batch->mutex);
+			batch->activeHelpers--;
+			batch->finished.notify_all();
+		}
+	}
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+// Read only memory mapped files. The pages are read in by the OS as they're touched,
+//so only the parts of a file that are used cost a read, and nothing is copied into a
+//buffer of our own first.
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#ifdef _WIN32
+// CreateFileMapping and MapViewOfFile. Without NOMINMAX windows.h defines min and
+//max macros, which break std::min and std::max.
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read only. The view is page aligned, which covers the 4 byte
+//alignment vkCreateShaderModule wants for the code.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER fileSize = {};
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize)) {
+			close();
+			throw std::runtime_error("failed to open file " + path + "!");
+		}
+		length = (size_t) fileSize.QuadPart;
+		// Empty files can't be mapped
+		if (length > 0) {
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			view = mapping != nullptr ? (const char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		}
+#else
+		file = open(path.c_str(), O_RDONLY);
+		struct stat info;
+		if (file < 0 || fstat(file, &info) != 0) {
+			close();
+			throw std::runtime_error("failed to open file " + path + "!");
+		}
+		length = (size_t) info.st_size;
+		if (length > 0) {
+			void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file, 0);
+			view = address != MAP_FAILED ? (const char*) address : nullptr;
+		}
+#endif
+		if (view == nullptr) {
+			close();
+			throw std::runtime_error("failed to map file " + path + "!");
+		}
+	}
+
+	~MappedFile() {
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data() const {
+		return view;
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int file = -1;
+#endif
+	const char* view = nullptr;
+	size_t length = 0;
+
+	void close() {
+#ifdef _WIN32
+		if (view != nullptr) UnmapViewOfFile(view);
+		if (mapping != nullptr) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (view != nullptr) munmap((void*) view, length);
+		if (file >= 0) ::close(file);
+#endif
+		view = nullptr;
+	}
+};
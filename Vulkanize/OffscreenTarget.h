@@ -0,0 +1,226 @@
+#pragma once
+
+// Images to render to when there is no window (headless mode), standing in for the
+//swap chain. Without a presentation engine there's nothing to acquire from or wait
+//for: every frame in flight gets its own image and the frames go as fast as the GPU
+//can draw them.
+// A rendered image can also be copied to a host visible buffer in the frame's
+//command buffer, and written to a file once the frame's fence says it's done.
+
+#include "VHandle.h"
+#include "DeviceMemoryAllocator.h"
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class OffscreenTarget {
+public:
+	OffscreenTarget(const VDevice& device, const VkAllocationCallbacks* allocator, DeviceMemoryAllocator& memoryAllocator)
+		: device(device), allocator(allocator), memoryAllocator(memoryAllocator) {}
+
+	~OffscreenTarget() {
+		destroy();
+	}
+
+	OffscreenTarget(const OffscreenTarget&) = delete;
+	OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+	// Creates imageCount color images of the given size, each with a view and, if
+	//readback is set, a buffer to copy it to. The images are left in whatever layout
+	//the render pass puts them in.
+	void create(VkExtent2D extent, uint32_t imageCount, bool readback) {
+		destroy();
+		targetExtent = extent;
+		targets.resize(imageCount);
+
+		for (Target& target : targets) {
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = IMAGE_FORMAT;
+			imageInfo.extent = { extent.width, extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			// Rendered to like a swap chain image, and copied from for the readback
+			imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			if (vkCreateImage(device, &imageInfo, allocator, target.image.replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create offscreen image!");
+			}
+			target.imageMemory = memoryAllocator.allocateAndBind(target.image, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+			VkImageViewCreateInfo viewInfo = {};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = target.image;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = IMAGE_FORMAT;
+			viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			viewInfo.subresourceRange.baseMipLevel = 0;
+			viewInfo.subresourceRange.levelCount = 1;
+			viewInfo.subresourceRange.baseArrayLayer = 0;
+			viewInfo.subresourceRange.layerCount = 1;
+
+			if (vkCreateImageView(device, &viewInfo, allocator, target.imageView.replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create image views!");
+			}
+
+			if (readback) {
+				VkBufferCreateInfo bufferInfo = {};
+				bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+				bufferInfo.size = imageSize();
+				bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+				bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+				if (vkCreateBuffer(device, &bufferInfo, allocator, target.readbackBuffer.replace(device, allocator)) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create readback buffer!");
+				}
+				// Cached memory makes reading it back on the CPU a lot faster
+				target.readbackMemory = memoryAllocator.allocateAndBind(target.readbackBuffer,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+			}
+		}
+
+		std::cout << "offscreen target: " << imageCount << " images, " << extent.width << "x" << extent.height
+			<< (readback ? ", with readback" : "") << std::endl;
+	}
+
+	// Destroys the images and buffers. The GPU must be done with them.
+	void destroy() {
+		for (Target& target : targets) {
+			target.imageView.reset();
+			target.image.reset();
+			memoryAllocator.free(target.imageMemory);
+			target.readbackBuffer.reset();
+			memoryAllocator.free(target.readbackMemory);
+		}
+		targets.clear();
+	}
+
+	VkFormat imageFormat() const {
+		return IMAGE_FORMAT;
+	}
+
+	VkExtent2D extent() const {
+		return targetExtent;
+	}
+
+	uint32_t imageCount() const {
+		return (uint32_t) targets.size();
+	}
+
+	VkImage image(uint32_t index) const {
+		return targets[index].image;
+	}
+
+	VkImageView imageView(uint32_t index) const {
+		return targets[index].imageView;
+	}
+
+	bool hasReadback() const {
+		return !targets.empty() && targets[0].readbackBuffer != VK_NULL_HANDLE;
+	}
+
+	VkBuffer readbackBuffer(uint32_t index) const {
+		return targets[index].readbackBuffer;
+	}
+
+	// Copies image index to its readback buffer. The barriers around it come from the
+	//render graph: the image has to be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, and
+	//the host reads the buffer once the fence is signaled. frameNumber names the file
+	//that writeReadbacks() produces later.
+	void recordReadback(VkCommandBuffer commandBuffer, uint32_t index, uint64_t frameNumber) {
+		Target& target = targets[index];
+
+		// Tightly packed rows
+		VkBufferImageCopy region = {};
+		region.bufferOffset = 0;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { targetExtent.width, targetExtent.height, 1 };
+
+		vkCmdCopyImageToBuffer(commandBuffer, target.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.readbackBuffer, 1, &region);
+
+		target.pendingFrame = frameNumber;
+		target.readbackPending = true;
+	}
+
+	// Writes the copy of image index to frame_<number>.ppm if one was recorded. Call it
+	//once the frame that recorded it is done (its fence was waited on).
+	void writeReadback(uint32_t index) {
+		Target& target = targets[index];
+		if (!target.readbackPending) {
+			return;
+		}
+		target.readbackPending = false;
+
+		memoryAllocator.invalidate(target.readbackMemory);
+		const std::string path = "frame_" + std::to_string(target.pendingFrame) + ".ppm";
+		writePpm(path, (const uint8_t*) target.readbackMemory.mapped);
+	}
+
+	// All of them, at shutdown after the device went idle
+	void writeReadbacks() {
+		for (uint32_t i = 0; i < imageCount(); i++) {
+			writeReadback(i);
+		}
+	}
+
+private:
+	// Same as what the swap chain usually gets, and 4 bytes per pixel for the readback
+	static const VkFormat IMAGE_FORMAT = VK_FORMAT_B8G8R8A8_UNORM;
+
+	struct Target {
+		VImage image;
+		DeviceAllocation imageMemory;
+		VImageView imageView;
+		VBuffer readbackBuffer;
+		DeviceAllocation readbackMemory;
+		bool readbackPending = false;
+		uint64_t pendingFrame = 0;
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+	DeviceMemoryAllocator& memoryAllocator;
+
+	std::vector<Target> targets;
+	VkExtent2D targetExtent = {};
+
+	VkDeviceSize imageSize() const {
+		return (VkDeviceSize) targetExtent.width * targetExtent.height * 4;
+	}
+
+	// Binary PPM: a tiny header and RGB bytes, which most image viewers open
+	void writePpm(const std::string& path, const uint8_t* pixels) const {
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		file << "P6\n" << targetExtent.width << " " << targetExtent.height << "\n255\n";
+
+		std::vector<uint8_t> row(targetExtent.width * 3);
+		for (uint32_t y = 0; y < targetExtent.height; y++) {
+			const uint8_t* source = pixels + (size_t) y * targetExtent.width * 4;
+			// BGRA to RGB
+			for (uint32_t x = 0; x < targetExtent.width; x++) {
+				row[3 * x + 0] = source[4 * x + 2];
+				row[3 * x + 1] = source[4 * x + 1];
+				row[3 * x + 2] = source[4 * x + 0];
+			}
+			file.write((const char*) row.data(), row.size());
+		}
+
+		if (!file) {
+			std::cerr << "failed to write " << path << std::endl;
+		}
+	}
+};
@@ -0,0 +1,272 @@
+#pragma once
+
+// Pipeline cache that survives restarts.
+// Most of the time spent creating a pipeline goes into compiling its shaders to GPU
+//code. A VkPipelineCache keeps those results, and its contents can be read back with
+//vkGetPipelineCacheData, saved to a file and handed to the next launch, so pipelines
+//that were built before come out of the cache instead of the compiler.
+// The data is only valid for the device and driver that produced it. Vulkan puts the
+//vendor, device and pipelineCacheUUID in a header in front of it; our own file header
+//adds the driver version and a checksum, so a driver update or a truncated file just
+//means starting with an empty cache.
+// https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#pipelines-cache
+
+#include "VHandle.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class PipelineCache {
+public:
+	PipelineCache(const VDevice& device, const VkAllocationCallbacks* allocator)
+		: device(device), allocator(allocator) {}
+
+	// Creates the cache, seeded with the contents of the file at path if it was
+	//written for this device and driver. An empty path keeps the cache in memory only.
+	void load(VkPhysicalDevice physicalDevice, const std::string& path) {
+		vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+		this->path = path;
+
+		std::vector<char> initialData;
+		loadStatus = path.empty() ? "not persisted" : readCacheFile(initialData);
+
+		VkPipelineCacheCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+		createInfo.initialDataSize = initialData.size();
+		createInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+		VkResult result = vkCreatePipelineCache(device, &createInfo, allocator, cache.replace(device, allocator));
+		// The driver has the last word on the data, if it refuses it we start empty
+		if (result != VK_SUCCESS && !initialData.empty()) {
+			loadStatus = "rejected by the driver";
+			initialData.clear();
+			createInfo.initialDataSize = 0;
+			createInfo.pInitialData = nullptr;
+			result = vkCreatePipelineCache(device, &createInfo, allocator, cache.replace(device, allocator));
+		}
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline cache!");
+		}
+
+		loadedBytes = initialData.size();
+	}
+
+	// Writes the cache contents back to the file. Call it when all pipelines have
+	//been created, at shutdown. Failing to save isn't fatal, the next launch just
+	//starts cold.
+	void save() {
+		if (path.empty() || cache == VK_NULL_HANDLE) {
+			return;
+		}
+
+		size_t dataSize = 0;
+		if (vkGetPipelineCacheData(device, cache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+			return;
+		}
+		std::vector<char> data(dataSize);
+		if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS) {
+			std::cerr << "failed to read back the pipeline cache" << std::endl;
+			return;
+		}
+		data.resize(dataSize);
+
+		FileHeader header = makeHeader(data);
+
+		// Written next to the real file and renamed over it, so a crash half way
+		//through never leaves a truncated cache behind
+		const std::string temporaryPath = path + ".tmp";
+		{
+			std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+			file.write((const char*) &header, sizeof(header));
+			file.write(data.data(), data.size());
+			if (!file) {
+				std::cerr << "failed to write pipeline cache " << temporaryPath << std::endl;
+				return;
+			}
+		}
+		std::remove(path.c_str());
+		if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+			std::cerr << "failed to replace pipeline cache " << path << std::endl;
+			return;
+		}
+
+		savedBytes = data.size();
+	}
+
+	VkPipelineCache handle() const {
+		return cache;
+	}
+
+	// vkCreateGraphicsPipelines through the cache, timed for the stats. Like the
+	//cache itself, these can be called from several threads at once.
+	VkResult createGraphicsPipelines(uint32_t count, const VkGraphicsPipelineCreateInfo* createInfos, VkPipeline* pipelines) {
+		auto start = std::chrono::steady_clock::now();
+		VkResult result = vkCreateGraphicsPipelines(device, cache, count, createInfos, allocator, pipelines);
+		record(count, start);
+		return result;
+	}
+
+	VkResult createComputePipelines(uint32_t count, const VkComputePipelineCreateInfo* createInfos, VkPipeline* pipelines) {
+		auto start = std::chrono::steady_clock::now();
+		VkResult result = vkCreateComputePipelines(device, cache, count, createInfos, allocator, pipelines);
+		record(count, start);
+		return result;
+	}
+
+	// A warm cache is one that was seeded from the file. Comparing the creation time
+	//of a warm and a cold launch shows what the cache hits are worth.
+	bool isWarm() const {
+		return loadedBytes > 0;
+	}
+
+	void printStats(std::ostream& out) const {
+		uint64_t count = pipelineCount.load();
+		double totalMs = creationNanoseconds.load() / 1e6;
+
+		out << "pipeline cache: " << (isWarm() ? "warm" : "cold") << " (" << loadStatus;
+		if (isWarm()) {
+			out << ", " << loadedBytes << " bytes";
+		}
+		out << "), " << count << " pipelines created in " << std::fixed << std::setprecision(3) << totalMs << " ms";
+		if (count > 0) {
+			out << " (" << totalMs / count << " ms each)";
+		}
+		out << std::defaultfloat;
+		if (savedBytes > 0) {
+			out << ", saved " << savedBytes << " bytes to " << path;
+		}
+		out << std::endl;
+	}
+
+private:
+	// In front of the driver's data in the file
+	struct FileHeader {
+		char magic[4];
+		// Of this header layout
+		uint32_t version;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+		// FNV-1a of the data
+		uint64_t checksum;
+	};
+
+	// The header the driver puts in front of its data (version one)
+	struct DriverHeader {
+		uint32_t headerSize;
+		uint32_t headerVersion;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	};
+
+	static const uint32_t FILE_VERSION = 1;
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+
+	VPipelineCache cache;
+	VkPhysicalDeviceProperties deviceProperties = {};
+	std::string path;
+
+	// What happened to the file at load time, for the stats
+	std::string loadStatus = "not loaded";
+	size_t loadedBytes = 0;
+	size_t savedBytes = 0;
+
+	std::atomic<uint64_t> pipelineCount{ 0 };
+	std::atomic<uint64_t> creationNanoseconds{ 0 };
+
+	void record(uint32_t count, std::chrono::steady_clock::time_point start) {
+		auto elapsed = std::chrono::steady_clock::now() - start;
+		pipelineCount += count;
+		creationNanoseconds += (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+	}
+
+	static uint64_t checksum(const std::vector<char>& data) {
+		uint64_t hash = 14695981039346656037ull;
+		for (char c : data) {
+			hash ^= (uint8_t) c;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	FileHeader makeHeader(const std::vector<char>& data) const {
+		// Zeroed first so the padding bytes in the file are deterministic
+		FileHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "VKPC", 4);
+		header.version = FILE_VERSION;
+		header.vendorID = deviceProperties.vendorID;
+		header.deviceID = deviceProperties.deviceID;
+		header.driverVersion = deviceProperties.driverVersion;
+		memcpy(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+		header.dataSize = data.size();
+		header.checksum = checksum(data);
+		return header;
+	}
+
+	// Reads and validates the file, filling data only if it can be used. Returns
+	//what happened, for the stats.
+	std::string readCacheFile(std::vector<char>& data) const {
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open()) {
+			return "no cache file yet";
+		}
+
+		FileHeader header;
+		if (!file.read((char*) &header, sizeof(header)) || memcmp(header.magic, "VKPC", 4) != 0 || header.version != FILE_VERSION) {
+			return "not a cache file, ignored";
+		}
+
+		FileHeader expected = makeHeader(std::vector<char>());
+		if (header.vendorID != expected.vendorID || header.deviceID != expected.deviceID ||
+			memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+			return "written for another device, ignored";
+		}
+		if (header.driverVersion != expected.driverVersion) {
+			return "written by another driver version, ignored";
+		}
+
+		// The size comes from the file too, so it has to match what's actually left in
+		//it before anything that big is allocated
+		file.seekg(0, std::ios::end);
+		std::streamoff remaining = (std::streamoff) file.tellg() - (std::streamoff) sizeof(header);
+		if (!file || remaining < 0 || header.dataSize != (uint64_t) remaining) {
+			return "corrupt, ignored";
+		}
+		file.seekg(sizeof(header), std::ios::beg);
+
+		std::vector<char> contents((size_t) header.dataSize);
+		if (!file.read(contents.data(), contents.size()) || checksum(contents) != header.checksum) {
+			return "corrupt, ignored";
+		}
+
+		// The driver checks its own header too, but there's no point in handing it data
+		//we already know it will throw away
+		DriverHeader driverHeader;
+		if (contents.size() < sizeof(driverHeader)) {
+			return "corrupt, ignored";
+		}
+		memcpy(&driverHeader, contents.data(), sizeof(driverHeader));
+		if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+			driverHeader.vendorID != expected.vendorID || driverHeader.deviceID != expected.deviceID ||
+			memcmp(driverHeader.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+			return "written for another device, ignored";
+		}
+
+		data.swap(contents);
+		return "loaded from " + path;
+	}
+};
@@ -0,0 +1,446 @@
+#pragma once
+
+// Graphics pipelines created on first use, on threads of their own, and shared by
+//everyone who asks for the same state.
+// Everything the pipelines can differ in goes into a GraphicsPipelineKey: the
+//shaders, the vertex layout, the specialization constants and what they render to.
+//The first request for a key starts creating its pipeline (through the persisted
+//pipeline cache) and returns nothing; the caller draws with another variant until
+//it's there, or waits for it when there is none. After that a request is a hash map
+//lookup, so variants can be asked for every frame and only the ones used are ever
+//built, instead of every permutation at startup.
+// Specialization constants turn one SPIR-V module into several pipelines: the
+//driver compiles each with the constant's value folded in, so the branches on it
+//cost nothing, and there's no shader file per variant.
+// With VK_KHR_dynamic_rendering the pipelines are made for the attachment formats
+//instead of a render pass, so there are neither render passes nor framebuffers to
+//keep in step with the swap chain. Viewport and scissor are dynamic state, so the
+//extent is never part of a key.
+// https://www.khronos.org/registry/vulkan/specs/1.3-extensions/html/vkspec.html#VK_KHR_dynamic_rendering
+
+#include "VHandle.h"
+#include "PipelineCache.h"
+#include "ShaderLibrary.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct GraphicsPipelineKey {
+	static const uint32_t MAX_CONSTANTS = 4;
+
+	// Names in the ShaderLibrary
+	std::string vertexShader;
+	std::string fragmentShader;
+	// See PipelineFactory::addVertexLayout
+	uint32_t vertexLayout = 0;
+	VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+	// VK_NULL_HANDLE with dynamic rendering
+	VkRenderPass renderPass = VK_NULL_HANDLE;
+	// Specialization constant i has constant_id i in both stages, those a stage
+	//doesn't declare are ignored
+	uint32_t constantCount = 0;
+	uint32_t constants[MAX_CONSTANTS] = {};
+
+	void setConstant(uint32_t id, uint32_t value) {
+		if (id >= MAX_CONSTANTS) {
+			throw std::runtime_error("too many specialization constants!");
+		}
+		constants[id] = value;
+		constantCount = std::max(constantCount, id + 1);
+	}
+
+	bool operator==(const GraphicsPipelineKey& other) const {
+		return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader
+			&& vertexLayout == other.vertexLayout && colorFormat == other.colorFormat && renderPass == other.renderPass
+			&& constantCount == other.constantCount && memcmp(constants, other.constants, sizeof(constants)) == 0;
+	}
+
+	// FNV-1a over the fields
+	struct Hash {
+		size_t operator()(const GraphicsPipelineKey& key) const {
+			uint64_t hash = 14695981039346656037ull;
+			auto add = [&hash](const void* data, size_t size) {
+				for (size_t i = 0; i < size; i++) {
+					hash = (hash ^ ((const uint8_t*) data)[i]) * 1099511628211ull;
+				}
+			};
+			add(key.vertexShader.data(), key.vertexShader.size());
+			add(key.fragmentShader.data(), key.fragmentShader.size());
+			add(&key.vertexLayout, sizeof(key.vertexLayout));
+			add(&key.colorFormat, sizeof(key.colorFormat));
+			// A pointer on 64-bit platforms and a uint64_t on 32-bit ones
+			add(&key.renderPass, sizeof(key.renderPass));
+			add(&key.constantCount, sizeof(key.constantCount));
+			add(key.constants, sizeof(key.constants));
+			return (size_t) hash;
+		}
+	};
+};
+
+// Not thread safe: requests come from the render thread (or from one thread at a
+//time during startup). The pipelines themselves are created on other threads.
+class PipelineFactory {
+public:
+	PipelineFactory(const VDevice& device, const VkAllocationCallbacks* allocator, PipelineCache& pipelineCache, ShaderLibrary& shaderLibrary)
+		: device(device), allocator(allocator), pipelineCache(pipelineCache), shaderLibrary(shaderLibrary) {}
+
+	// Waits for the pipelines still being created
+	~PipelineFactory() {
+		destroy();
+	}
+
+	PipelineFactory(const PipelineFactory&) = delete;
+	PipelineFactory& operator=(const PipelineFactory&) = delete;
+
+	static bool isDynamicRenderingSupported(const VkPhysicalDeviceDynamicRenderingFeaturesKHR& supported) {
+		return supported.dynamicRendering == VK_TRUE;
+	}
+
+	// The feature to chain into VkDeviceCreateInfo, next to dynamicRenderingExtensions()
+	static VkPhysicalDeviceDynamicRenderingFeaturesKHR enableDynamicRenderingFeatures() {
+		VkPhysicalDeviceDynamicRenderingFeaturesKHR enabled = {};
+		enabled.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+		enabled.dynamicRendering = VK_TRUE;
+		return enabled;
+	}
+
+	// VK_KHR_dynamic_rendering and the extensions it depends on on Vulkan 1.0
+	static std::vector<const char*> dynamicRenderingExtensions() {
+		return { VK_KHR_MULTIVIEW_EXTENSION_NAME, VK_KHR_MAINTENANCE2_EXTENSION_NAME, VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
+			VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME };
+	}
+
+	// Every pipeline gets layout. dynamicRendering needs the extensions and the
+	//feature on the device, the keys' render passes are ignored then.
+	void init(VkPipelineLayout layout, bool dynamicRendering) {
+		pipelineLayout = layout;
+		if (dynamicRendering) {
+			cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdBeginRenderingKHR");
+			cmdEndRendering = (PFN_vkCmdEndRenderingKHR) vkGetDeviceProcAddr(device, "vkCmdEndRenderingKHR");
+			if (cmdBeginRendering == nullptr || cmdEndRendering == nullptr) {
+				throw std::runtime_error("failed to load dynamic rendering functions!");
+			}
+		}
+	}
+
+	bool usesDynamicRendering() const {
+		return cmdBeginRendering != nullptr;
+	}
+
+	void beginRendering(VkCommandBuffer commandBuffer, const VkRenderingInfoKHR& renderingInfo) const {
+		cmdBeginRendering(commandBuffer, &renderingInfo);
+	}
+
+	void endRendering(VkCommandBuffer commandBuffer) const {
+		cmdEndRendering(commandBuffer);
+	}
+
+	// Vertex bindings and attributes for the keys' vertexLayout. Add them all before
+	//the first request, the creating threads read them.
+	uint32_t addVertexLayout(const std::vector<VkVertexInputBindingDescription>& bindings, const std::vector<VkVertexInputAttributeDescription>& attributes) {
+		vertexLayouts.push_back({ bindings, attributes });
+		return (uint32_t) vertexLayouts.size() - 1;
+	}
+
+	// The key's pipeline, VK_NULL_HANDLE until it has been created. The first request
+	//starts creating it. After invalidate() this is the old pipeline until the new one
+	//is there.
+	VkPipeline request(const GraphicsPipelineKey& key) {
+		auto found = entries.find(key);
+		if (found == entries.end()) {
+			found = entries.emplace(key, Entry()).first;
+			stats.variants++;
+		}
+		Entry& entry = found->second;
+		collect(entry);
+		if (entry.generation != generation && !entry.pending.valid()) {
+			start(found->first, entry);
+		}
+		return entry.pipeline;
+	}
+
+	// Same, but waits for the pipeline if it isn't there yet
+	VkPipeline wait(const GraphicsPipelineKey& key) {
+		VkPipeline pipeline = request(key);
+		if (pipeline != VK_NULL_HANDLE) {
+			return pipeline;
+		}
+		Entry& entry = entries.find(key)->second;
+		if (entry.pending.valid()) {
+			entry.pending.wait();
+			collect(entry);
+		}
+		if (entry.pipeline == VK_NULL_HANDLE) {
+			throw std::runtime_error("failed to create graphics pipeline!");
+		}
+		return entry.pipeline;
+	}
+
+	// Once per frame: takes in the pipelines that were created since. Returns whether
+	//there were any, whatever is drawn with them may look different now.
+	bool update() {
+		bool landed = false;
+		for (auto& entry : entries) {
+			if (entry.second.pending.valid() && entry.second.pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+				collect(entry.second);
+				landed = true;
+			}
+		}
+		return landed;
+	}
+
+	// While pipelines are being created, the shader library mustn't replace the
+	//modules they're created from
+	bool isBusy() const {
+		return creating > 0;
+	}
+
+	// The shaders changed: every pipeline is created again on its next request, and
+	//that request still gets the old one
+	void invalidate() {
+		generation++;
+	}
+
+	// Retires every pipeline, for when what they render to is gone
+	void clear() {
+		waitForCreations();
+		for (auto& entry : entries) {
+			if (entry.second.pipeline != VK_NULL_HANDLE) {
+				retired.push_back(std::move(entry.second.pipeline));
+			}
+		}
+		entries.clear();
+	}
+
+	// Pipelines that were replaced since the last call. They may still be in use by
+	//frames in flight, the caller destroys them once those are done.
+	std::vector<VPipeline> takeRetired() {
+		std::vector<VPipeline> taken = std::move(retired);
+		retired.clear();
+		return taken;
+	}
+
+	// Waits for every pipeline that is being created
+	void waitForCreations() {
+		for (auto& entry : entries) {
+			if (entry.second.pending.valid()) {
+				entry.second.pending.wait();
+				collect(entry.second);
+			}
+		}
+	}
+
+	// The GPU must be done with the pipelines
+	void destroy() {
+		waitForCreations();
+		entries.clear();
+		retired.clear();
+	}
+
+	void printStats(std::ostream& out) const {
+		out << "pipeline factory: " << (usesDynamicRendering() ? "dynamic rendering" : "render passes") << ", "
+			<< stats.variants << " variants requested, " << stats.created << " pipelines created, " << stats.failed << " failed" << std::endl;
+	}
+
+private:
+	struct VertexLayout {
+		std::vector<VkVertexInputBindingDescription> bindings;
+		std::vector<VkVertexInputAttributeDescription> attributes;
+	};
+
+	struct Entry {
+		VPipeline pipeline;
+		// While a pipeline for the key is being created
+		std::future<VPipeline> pending;
+		// The invalidate() count the last creation started at, ~0 before the first
+		uint64_t generation = UINT64_MAX;
+	};
+
+	struct Stats {
+		uint64_t variants = 0;
+		uint64_t created = 0;
+		uint64_t failed = 0;
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+	PipelineCache& pipelineCache;
+	ShaderLibrary& shaderLibrary;
+
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	PFN_vkCmdBeginRenderingKHR cmdBeginRendering = nullptr;
+	PFN_vkCmdEndRenderingKHR cmdEndRendering = nullptr;
+	std::vector<VertexLayout> vertexLayouts;
+
+	std::unordered_map<GraphicsPipelineKey, Entry, GraphicsPipelineKey::Hash> entries;
+	uint64_t generation = 0;
+	uint32_t creating = 0;
+	std::vector<VPipeline> retired;
+	// ShaderLibrary::module() waits for a module the first time and isn't thread safe
+	std::mutex moduleMutex;
+
+	Stats stats;
+
+	void start(const GraphicsPipelineKey& key, Entry& entry) {
+		entry.generation = generation;
+		creating++;
+		// The key is copied, the map may rehash meanwhile
+		entry.pending = std::async(std::launch::async, [this, key] { return create(key); });
+	}
+
+	// Takes the finished creation in, if there is one. A failed one keeps the old
+	//pipeline (a shader that doesn't compile, say), and isn't tried again until the
+	//next invalidate().
+	void collect(Entry& entry) {
+		if (!entry.pending.valid() || entry.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			return;
+		}
+		creating--;
+		try {
+			VPipeline created = entry.pending.get();
+			if (entry.pipeline != VK_NULL_HANDLE) {
+				retired.push_back(std::move(entry.pipeline));
+			}
+			entry.pipeline = std::move(created);
+			stats.created++;
+		}
+		catch (const std::exception& error) {
+			stats.failed++;
+			std::cerr << "pipelines: " << (entry.pipeline != VK_NULL_HANDLE ? "keeping the old pipeline, " : "") << error.what() << std::endl;
+		}
+	}
+
+	// Runs on a thread of its own. Pipelines are immutable, every piece of state is
+	//baked in here. Viewport and scissor are the exception: they're dynamic, so the
+	//same pipeline works for any swap chain size.
+	// https://vulkan-tutorial.com/Drawing_a_triangle/Graphics_pipeline_basics/Introduction
+	VPipeline create(const GraphicsPipelineKey& key) {
+		VkShaderModule vertShaderModule;
+		VkShaderModule fragShaderModule;
+		{
+			std::lock_guard<std::mutex> lock(moduleMutex);
+			vertShaderModule = shaderLibrary.module(key.vertexShader);
+			fragShaderModule = shaderLibrary.module(key.fragmentShader);
+		}
+
+		// Constant i is at offset 4 * i of the data
+		VkSpecializationMapEntry mapEntries[GraphicsPipelineKey::MAX_CONSTANTS];
+		for (uint32_t i = 0; i < key.constantCount; i++) {
+			mapEntries[i].constantID = i;
+			mapEntries[i].offset = i * sizeof(uint32_t);
+			mapEntries[i].size = sizeof(uint32_t);
+		}
+		VkSpecializationInfo specializationInfo = {};
+		specializationInfo.mapEntryCount = key.constantCount;
+		specializationInfo.pMapEntries = mapEntries;
+		specializationInfo.dataSize = key.constantCount * sizeof(uint32_t);
+		specializationInfo.pData = key.constants;
+
+		VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+		shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shaderStages[0].module = vertShaderModule;
+		shaderStages[0].pName = "main";
+		shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		shaderStages[1].module = fragShaderModule;
+		shaderStages[1].pName = "main";
+		if (key.constantCount > 0) {
+			shaderStages[0].pSpecializationInfo = &specializationInfo;
+			shaderStages[1].pSpecializationInfo = &specializationInfo;
+		}
+
+		const VertexLayout& vertexLayout = vertexLayouts.at(key.vertexLayout);
+		VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+		vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		vertexInputInfo.vertexBindingDescriptionCount = (uint32_t) vertexLayout.bindings.size();
+		vertexInputInfo.pVertexBindingDescriptions = vertexLayout.bindings.data();
+		vertexInputInfo.vertexAttributeDescriptionCount = (uint32_t) vertexLayout.attributes.size();
+		vertexInputInfo.pVertexAttributeDescriptions = vertexLayout.attributes.data();
+
+		VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+		inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+		inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+		// Only the counts matter, the values are set while recording
+		VkPipelineViewportStateCreateInfo viewportState = {};
+		viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		viewportState.viewportCount = 1;
+		viewportState.scissorCount = 1;
+
+		VkPipelineRasterizationStateCreateInfo rasterizer = {};
+		rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		rasterizer.depthClampEnable = VK_FALSE;
+		rasterizer.rasterizerDiscardEnable = VK_FALSE;
+		rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+		rasterizer.lineWidth = 1.0f;
+		rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+		rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+		rasterizer.depthBiasEnable = VK_FALSE;
+
+		VkPipelineMultisampleStateCreateInfo multisampling = {};
+		multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		multisampling.sampleShadingEnable = VK_FALSE;
+		multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+		// No blending, the fragment color is written as is
+		VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+		colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+		colorBlendAttachment.blendEnable = VK_FALSE;
+
+		VkPipelineColorBlendStateCreateInfo colorBlending = {};
+		colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		colorBlending.logicOpEnable = VK_FALSE;
+		colorBlending.attachmentCount = 1;
+		colorBlending.pAttachments = &colorBlendAttachment;
+
+		VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+		VkPipelineDynamicStateCreateInfo dynamicState = {};
+		dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		dynamicState.dynamicStateCount = 2;
+		dynamicState.pDynamicStates = dynamicStates;
+
+		VkGraphicsPipelineCreateInfo pipelineInfo = {};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.stageCount = 2;
+		pipelineInfo.pStages = shaderStages;
+		pipelineInfo.pVertexInputState = &vertexInputInfo;
+		pipelineInfo.pInputAssemblyState = &inputAssembly;
+		pipelineInfo.pViewportState = &viewportState;
+		pipelineInfo.pRasterizationState = &rasterizer;
+		pipelineInfo.pMultisampleState = &multisampling;
+		pipelineInfo.pColorBlendState = &colorBlending;
+		pipelineInfo.pDynamicState = &dynamicState;
+		pipelineInfo.layout = pipelineLayout;
+
+		// Without a render pass, the formats it would have had
+		VkPipelineRenderingCreateInfoKHR renderingInfo = {};
+		renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+		renderingInfo.colorAttachmentCount = 1;
+		renderingInfo.pColorAttachmentFormats = &key.colorFormat;
+		if (usesDynamicRendering()) {
+			pipelineInfo.pNext = &renderingInfo;
+		}
+		else {
+			pipelineInfo.renderPass = key.renderPass;
+			pipelineInfo.subpass = 0;
+		}
+
+		// Goes through the pipeline cache, which skips the shader compilation when
+		//the same pipeline was created in a previous run
+		VPipeline pipeline;
+		if (pipelineCache.createGraphicsPipelines(1, &pipelineInfo, pipeline.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create graphics pipeline!");
+		}
+		return pipeline;
+	}
+};
@@ -0,0 +1,588 @@
+#pragma once
+
+// Frame graph: the passes of a frame and the resources each of them uses, declared up
+//front so the barriers between them are worked out instead of written by hand.
+// The passes are declared again every frame (a few small vectors) with the resources
+//they read and write. execute() walks them in order and puts everything a pass needs
+//into a single vkCmdPipelineBarrier before it: layout transitions, waits on earlier
+//writes, execution dependencies for write-after-read, and nothing at all for a read
+//that follows a read in the same layout. The transitions imported resources need at
+//the end of the frame (to present, say) are batched into one more barrier.
+// Transient images only live within a frame. The graph creates them, and images whose
+//passes don't overlap share memory: the first barrier of the later one starts from
+//UNDEFINED and waits for the last use of the earlier one. Barriers also order work
+//across submissions on the same queue, so one copy serves every frame in flight.
+// Every pass is recorded into the frame's graphics command buffer, compute passes
+//included.
+// https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#synchronization-pipeline-barriers
+
+#include "DeviceMemoryAllocator.h"
+#include "VHandle.h"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+enum class RenderGraphQueue {
+	Graphics,
+	// A compute pass, recorded with the graphics passes
+	Compute
+};
+
+// How a pass uses a resource. Shader stages follow the pass: fragment shader for
+//graphics passes, compute shader for compute passes.
+enum class ResourceUsage {
+	// As a final usage: left as the last pass left it
+	None,
+	ColorAttachment,
+	Sampled,
+	StorageRead,
+	// Storage images and buffers written by a shader, and read too
+	StorageWrite,
+	TransferSrc,
+	TransferDst,
+	// Buffers the host reads once the frame's fence is signaled
+	HostRead,
+	// Draw commands and counts of indirect draws
+	IndirectRead,
+	// Swap chain images. As a previous usage it's the wait on the image available
+	//semaphore (at the color attachment stage), as a final usage the hand over to the
+	//presentation engine.
+	Present
+};
+
+class RenderGraph {
+public:
+	typedef uint32_t ResourceId;
+	typedef uint32_t PassId;
+
+	struct TransientImageDesc {
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkExtent2D extent = {};
+		VkImageUsageFlags usage = 0;
+		VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+
+		bool operator==(const TransientImageDesc& other) const {
+			return format == other.format && extent.width == other.extent.width && extent.height == other.extent.height
+				&& usage == other.usage && aspect == other.aspect;
+		}
+	};
+
+	RenderGraph(const VDevice& device, const VkAllocationCallbacks* allocator, DeviceMemoryAllocator& memoryAllocator)
+		: device(device), allocator(allocator), memoryAllocator(memoryAllocator) {}
+
+	~RenderGraph() {
+		while (!retired.empty()) {
+			releaseTransients(retired.front());
+			retired.pop_front();
+		}
+		releaseTransients(current);
+	}
+
+	RenderGraph(const RenderGraph&) = delete;
+	RenderGraph& operator=(const RenderGraph&) = delete;
+
+	// framesInFlight is how long replaced transient images are kept
+	void init(uint32_t framesInFlight) {
+		this->framesInFlight = framesInFlight;
+	}
+
+	// Starts declaring the frame
+	void begin(uint64_t frameNumber) {
+		this->frameNumber = frameNumber;
+		passes.clear();
+		resources.clear();
+
+		while (!retired.empty() && frameNumber >= retired.front().retiredAt + framesInFlight) {
+			releaseTransients(retired.front());
+			retired.pop_front();
+		}
+	}
+
+	// An image created elsewhere. previousUsage is how it was left before this frame;
+	//with discardContents its contents aren't needed, so the first pass starts it from
+	//UNDEFINED. finalUsage is the state it's left in at the end of the frame.
+	ResourceId importImage(const char* name, VkImage image, VkImageAspectFlags aspect, ResourceUsage previousUsage, ResourceUsage finalUsage, bool discardContents) {
+		Resource resource;
+		resource.name = name;
+		resource.image = image;
+		resource.aspect = aspect;
+		resource.finalUsage = finalUsage;
+		UsageInfo previous = usageInfo(previousUsage, RenderGraphQueue::Graphics);
+		resource.stages = previous.stages;
+		resource.access = previous.access;
+		resource.layout = discardContents ? VK_IMAGE_LAYOUT_UNDEFINED : previous.layout;
+		resources.push_back(resource);
+		return (ResourceId) resources.size() - 1;
+	}
+
+	ResourceId importBuffer(const char* name, VkBuffer buffer, ResourceUsage previousUsage, ResourceUsage finalUsage) {
+		Resource resource;
+		resource.name = name;
+		resource.buffer = buffer;
+		resource.finalUsage = finalUsage;
+		UsageInfo previous = usageInfo(previousUsage, RenderGraphQueue::Graphics);
+		resource.stages = previous.stages;
+		resource.access = previous.access;
+		resources.push_back(resource);
+		return (ResourceId) resources.size() - 1;
+	}
+
+	// An image that only lives within the frame, created (and aliased) by the graph.
+	//The same name gets the same image every frame while the description stays the
+	//same. image() and imageView() work once execute() started.
+	ResourceId createImage(const char* name, const TransientImageDesc& desc) {
+		Resource resource;
+		resource.name = name;
+		resource.aspect = desc.aspect;
+		resource.transientDesc = desc;
+		resource.transient = true;
+		resources.push_back(resource);
+		return (ResourceId) resources.size() - 1;
+	}
+
+	VkImage image(ResourceId id) const {
+		return resources[id].image;
+	}
+
+	VkImageView imageView(ResourceId id) const {
+		return resources[id].imageView;
+	}
+
+	PassId addPass(const char* name, RenderGraphQueue queue, const std::function<void(VkCommandBuffer)>& record) {
+		Pass pass;
+		pass.name = name;
+		pass.queue = queue;
+		pass.record = record;
+		passes.push_back(pass);
+		return (PassId) passes.size() - 1;
+	}
+
+	// Once per resource and pass, with the usage that covers everything the pass does
+	//with it (a storage image that's read and written is StorageWrite)
+	void use(PassId pass, ResourceId resource, ResourceUsage usage) {
+		for (const Use& existing : passes[pass].uses) {
+			if (existing.resource == resource) {
+				throw std::runtime_error("failed to add " + resources[resource].name + " to pass " + passes[pass].name + ", it's used twice!");
+			}
+		}
+		// Compute passes get compute shader stages, they don't render
+		if (passes[pass].queue != RenderGraphQueue::Graphics && (usage == ResourceUsage::ColorAttachment || usage == ResourceUsage::Present)) {
+			throw std::runtime_error("failed to add " + resources[resource].name + " to pass " + passes[pass].name + ", a compute pass can't render to it!");
+		}
+		Use use;
+		use.resource = resource;
+		use.usage = usage;
+		passes[pass].uses.push_back(use);
+	}
+
+	// Records the passes into commandBuffer, with their barriers
+	void execute(VkCommandBuffer commandBuffer) {
+		realizeTransients();
+
+		frames++;
+		passCount += passes.size();
+
+		for (Pass& pass : passes) {
+			recordBarriers(commandBuffer, pass.uses, pass.queue);
+			pass.record(commandBuffer);
+		}
+
+		recordFinalBarriers(commandBuffer);
+	}
+
+	void printStats(std::ostream& out) const {
+		if (frames == 0) {
+			return;
+		}
+		out << "render graph: " << std::fixed << std::setprecision(1) << (double) passCount / frames << " passes, "
+			<< (double) barrierCalls / frames << " barrier calls ("
+			<< (double) imageBarriers / frames << " image, " << (double) bufferBarriers / frames << " buffer barriers) and "
+			<< (double) elidedBarriers / frames << " barriers skipped per frame";
+		if (transientBytes > 0) {
+			out << ", transient images " << transientBytes / 1024 << " KiB in " << aliasedBytes / 1024 << " KiB of memory";
+		}
+		out << std::endl;
+	}
+
+private:
+	static const ResourceId INVALID_ID = ~0u;
+
+	struct UsageInfo {
+		VkPipelineStageFlags stages;
+		VkAccessFlags access;
+		VkImageLayout layout;
+	};
+
+	struct Use {
+		ResourceId resource;
+		ResourceUsage usage;
+	};
+
+	struct Pass {
+		std::string name;
+		RenderGraphQueue queue;
+		std::function<void(VkCommandBuffer)> record;
+		std::vector<Use> uses;
+	};
+
+	struct Resource {
+		std::string name;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView imageView = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkImageAspectFlags aspect = 0;
+		ResourceUsage finalUsage = ResourceUsage::None;
+		bool transient = false;
+		TransientImageDesc transientDesc;
+		// Memory slot of a transient image, and whether it was used yet this frame
+		uint32_t slot = 0;
+		bool touched = false;
+		// State after the passes recorded so far
+		VkPipelineStageFlags stages = 0;
+		VkAccessFlags access = 0;
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	};
+
+	// A transient image the graph owns, kept between frames
+	struct Transient {
+		std::string name;
+		TransientImageDesc desc;
+		VImage image;
+		VImageView view;
+		VkMemoryRequirements requirements = {};
+		uint32_t slot = 0;
+		// Passes it was used by, the last time the aliasing was worked out
+		uint32_t firstPass = 0;
+		uint32_t lastPass = 0;
+	};
+
+	// Memory shared by transient images whose passes don't overlap. The stages and
+	//accesses of its last use are what the next image in it waits for.
+	struct MemorySlot {
+		DeviceAllocation memory;
+		VkPipelineStageFlags lastStages = 0;
+		VkAccessFlags lastAccess = 0;
+	};
+
+	struct TransientSet {
+		std::vector<Transient> images;
+		std::vector<MemorySlot> slots;
+		uint64_t retiredAt = 0;
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+	DeviceMemoryAllocator& memoryAllocator;
+
+	uint32_t framesInFlight = 1;
+
+	uint64_t frameNumber = 0;
+	std::vector<Pass> passes;
+	std::vector<Resource> resources;
+	TransientSet current;
+	// Replaced transient images, until the frames that used them are done
+	std::deque<TransientSet> retired;
+
+	uint64_t frames = 0;
+	uint64_t passCount = 0;
+	uint64_t barrierCalls = 0;
+	uint64_t imageBarriers = 0;
+	uint64_t bufferBarriers = 0;
+	uint64_t elidedBarriers = 0;
+	VkDeviceSize transientBytes = 0;
+	VkDeviceSize aliasedBytes = 0;
+
+	static const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	static UsageInfo usageInfo(ResourceUsage usage, RenderGraphQueue queue) {
+		VkPipelineStageFlags shaderStage = queue == RenderGraphQueue::Graphics ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+		switch (usage) {
+		case ResourceUsage::ColorAttachment:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+		case ResourceUsage::Sampled:
+			return { shaderStage, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+		case ResourceUsage::StorageRead:
+			return { shaderStage, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+		case ResourceUsage::StorageWrite:
+			return { shaderStage, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL };
+		case ResourceUsage::TransferSrc:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL };
+		case ResourceUsage::TransferDst:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL };
+		case ResourceUsage::HostRead:
+			return { VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+		case ResourceUsage::IndirectRead:
+			return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_GENERAL };
+		case ResourceUsage::Present:
+			// The semaphores order everything else, the barrier only needs the layout
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR };
+		default:
+			return { 0, 0, VK_IMAGE_LAYOUT_UNDEFINED };
+		}
+	}
+
+	// Matches the declared transient images with the ones from earlier frames. When one
+	//is new, changed or the passes using them overlap differently, all of them are
+	//created again (the old ones retired) and the memory aliasing worked out anew.
+	void realizeTransients() {
+		std::vector<ResourceId> declared;
+		std::vector<uint32_t> firstPass(resources.size(), (uint32_t) INVALID_ID);
+		std::vector<uint32_t> lastPass(resources.size(), 0);
+		for (uint32_t p = 0; p < (uint32_t) passes.size(); p++) {
+			for (const Use& use : passes[p].uses) {
+				if (firstPass[use.resource] == INVALID_ID) {
+					firstPass[use.resource] = p;
+				}
+				lastPass[use.resource] = p;
+			}
+		}
+		for (ResourceId id = 0; id < (ResourceId) resources.size(); id++) {
+			if (resources[id].transient && firstPass[id] != INVALID_ID) {
+				declared.push_back(id);
+			}
+		}
+
+		bool same = declared.size() == current.images.size();
+		for (size_t i = 0; same && i < declared.size(); i++) {
+			const Transient& transient = current.images[i];
+			const Resource& resource = resources[declared[i]];
+			same = transient.name == resource.name && transient.desc == resource.transientDesc
+				&& transient.firstPass == firstPass[declared[i]] && transient.lastPass == lastPass[declared[i]];
+		}
+
+		if (!same) {
+			current.retiredAt = frameNumber;
+			if (!current.images.empty()) {
+				retired.push_back(std::move(current));
+			}
+			current = TransientSet();
+			for (ResourceId id : declared) {
+				Transient transient;
+				transient.name = resources[id].name;
+				transient.desc = resources[id].transientDesc;
+				transient.firstPass = firstPass[id];
+				transient.lastPass = lastPass[id];
+				current.images.push_back(std::move(transient));
+			}
+			allocateTransients();
+		}
+
+		for (size_t i = 0; i < declared.size(); i++) {
+			const Transient& transient = current.images[i];
+			Resource& resource = resources[declared[i]];
+			resource.image = transient.image;
+			resource.imageView = transient.view;
+			resource.slot = transient.slot;
+		}
+	}
+
+	void allocateTransients() {
+		for (Transient& transient : current.images) {
+			VkImageCreateInfo imageInfo = {};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = transient.desc.format;
+			imageInfo.extent = { transient.desc.extent.width, transient.desc.extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = transient.desc.usage;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			if (vkCreateImage(device, &imageInfo, allocator, transient.image.replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create transient image " + transient.name + "!");
+			}
+			vkGetImageMemoryRequirements(device, transient.image, &transient.requirements);
+		}
+
+		// Greedy interval packing, in the order the images are first used: an image
+		//moves into the first slot whose images are all done before it starts and whose
+		//memory types it can live in
+		std::vector<Transient*> order;
+		for (Transient& transient : current.images) {
+			order.push_back(&transient);
+		}
+		std::stable_sort(order.begin(), order.end(), [](const Transient* a, const Transient* b) { return a->firstPass < b->firstPass; });
+
+		std::vector<VkMemoryRequirements> slotRequirements;
+		std::vector<uint32_t> slotEnd;
+		transientBytes = 0;
+		for (Transient* transient : order) {
+			transientBytes += transient->requirements.size;
+			uint32_t slot = 0;
+			for (; slot < (uint32_t) slotRequirements.size(); slot++) {
+				if (slotEnd[slot] < transient->firstPass && (slotRequirements[slot].memoryTypeBits & transient->requirements.memoryTypeBits) != 0) {
+					break;
+				}
+			}
+			if (slot == slotRequirements.size()) {
+				slotRequirements.push_back(transient->requirements);
+				slotEnd.push_back(transient->lastPass);
+			}
+			else {
+				VkMemoryRequirements& requirements = slotRequirements[slot];
+				requirements.size = std::max(requirements.size, transient->requirements.size);
+				requirements.alignment = std::max(requirements.alignment, transient->requirements.alignment);
+				requirements.memoryTypeBits &= transient->requirements.memoryTypeBits;
+				slotEnd[slot] = transient->lastPass;
+			}
+			transient->slot = slot;
+		}
+
+		aliasedBytes = 0;
+		current.slots.resize(slotRequirements.size());
+		for (size_t i = 0; i < slotRequirements.size(); i++) {
+			current.slots[i].memory = memoryAllocator.allocate(slotRequirements[i], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, ResourceTiling::Optimal);
+			aliasedBytes += slotRequirements[i].size;
+		}
+
+		for (Transient& transient : current.images) {
+			const DeviceAllocation& memory = current.slots[transient.slot].memory;
+			if (vkBindImageMemory(device, transient.image, memory.memory, memory.offset) != VK_SUCCESS) {
+				throw std::runtime_error("failed to bind transient image memory!");
+			}
+
+			VkImageViewCreateInfo viewInfo = {};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = transient.image;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = transient.desc.format;
+			viewInfo.subresourceRange.aspectMask = transient.desc.aspect;
+			viewInfo.subresourceRange.levelCount = 1;
+			viewInfo.subresourceRange.layerCount = 1;
+			if (vkCreateImageView(device, &viewInfo, allocator, transient.view.replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create transient image view " + transient.name + "!");
+			}
+		}
+	}
+
+	void releaseTransients(TransientSet& set) {
+		set.images.clear();
+		for (MemorySlot& slot : set.slots) {
+			memoryAllocator.free(slot.memory);
+		}
+		set.slots.clear();
+	}
+
+	// One vkCmdPipelineBarrier with everything the uses need
+	void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Use>& uses, RenderGraphQueue queue) {
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		std::vector<VkImageMemoryBarrier> images;
+		std::vector<VkBufferMemoryBarrier> buffers;
+
+		for (const Use& use : uses) {
+			Resource& resource = resources[use.resource];
+			UsageInfo next = usageInfo(use.usage, queue);
+
+			// A transient image takes over its memory from the last image in it
+			if (resource.transient && !resource.touched) {
+				const MemorySlot& slot = current.slots[resource.slot];
+				resource.stages = slot.lastStages;
+				resource.access = slot.lastAccess;
+				resource.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			}
+			resource.touched = true;
+
+			if (!transition(resource, next, srcStages, dstStages, images, buffers)) {
+				// Reads in the same layout don't wait for each other, but the next write
+				//has to wait for all of them
+				resource.stages |= next.stages;
+				resource.access |= next.access;
+				elidedBarriers++;
+			}
+			if (resource.transient) {
+				MemorySlot& slot = current.slots[resource.slot];
+				slot.lastStages = resource.stages;
+				slot.lastAccess = resource.access;
+			}
+		}
+		submitBarriers(commandBuffer, srcStages, dstStages, images, buffers);
+	}
+
+	// The imported resources go into their final usage
+	void recordFinalBarriers(VkCommandBuffer commandBuffer) {
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		std::vector<VkImageMemoryBarrier> images;
+		std::vector<VkBufferMemoryBarrier> buffers;
+		for (Resource& resource : resources) {
+			if (resource.finalUsage == ResourceUsage::None || resource.transient) {
+				continue;
+			}
+			transition(resource, usageInfo(resource.finalUsage, RenderGraphQueue::Graphics), srcStages, dstStages, images, buffers);
+		}
+		submitBarriers(commandBuffer, srcStages, dstStages, images, buffers);
+	}
+
+	// Adds what's needed to go from the resource's state to next. Returns false if
+	//nothing is: a read after reads in the same layout.
+	bool transition(Resource& resource, const UsageInfo& next, VkPipelineStageFlags& srcStages, VkPipelineStageFlags& dstStages,
+		std::vector<VkImageMemoryBarrier>& images, std::vector<VkBufferMemoryBarrier>& buffers) {
+		bool isImage = resource.image != VK_NULL_HANDLE;
+		bool layoutChange = isImage && resource.layout != next.layout;
+		bool previousWrites = (resource.access & WRITE_ACCESS) != 0;
+		bool nextWrites = (next.access & WRITE_ACCESS) != 0;
+		if (!layoutChange && !previousWrites && !nextWrites) {
+			return false;
+		}
+
+		srcStages |= resource.stages != 0 ? resource.stages : (VkPipelineStageFlags) VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		dstStages |= next.stages != 0 ? next.stages : (VkPipelineStageFlags) VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		// Only writes have to be made available, a write after reads just waits
+		VkAccessFlags srcAccess = resource.access & WRITE_ACCESS;
+
+		if (isImage) {
+			VkImageMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = next.access;
+			barrier.oldLayout = resource.layout;
+			barrier.newLayout = next.layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = resource.image;
+			barrier.subresourceRange.aspectMask = resource.aspect;
+			barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+			barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+			images.push_back(barrier);
+			resource.layout = next.layout;
+		}
+		else if (srcAccess != 0) {
+			VkBufferMemoryBarrier barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = next.access;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = resource.buffer;
+			barrier.offset = 0;
+			barrier.size = VK_WHOLE_SIZE;
+			buffers.push_back(barrier);
+		}
+
+		resource.stages = next.stages;
+		resource.access = next.access;
+		return true;
+	}
+
+	void submitBarriers(VkCommandBuffer commandBuffer, VkPipelineStageFlags srcStages, VkPipelineStageFlags dstStages,
+		const std::vector<VkImageMemoryBarrier>& images, const std::vector<VkBufferMemoryBarrier>& buffers) {
+		if (srcStages == 0) {
+			return;
+		}
+		vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0,
+			0, nullptr, (uint32_t) buffers.size(), buffers.data(), (uint32_t) images.size(), images.data());
+		barrierCalls++;
+		imageBarriers += images.size();
+		bufferBarriers += buffers.size();
+	}
+};
@@ -0,0 +1,327 @@
+#pragma once
+
+// The objects of the scene as a structure of arrays: every property of every object
+//is in an array of its own, so the per frame passes over all of them (moving them,
+//testing them against the screen, writing them out for the GPU) stream through
+//exactly the data they need, several objects per SIMD instruction.
+// Objects are placed by an offset and a uniform scale, and bounded by a circle
+//around the offset. The arrays are padded to a whole number of SIMD batches, the
+//padding is never visible.
+// The instruction set is picked at compile time: AVX (8 lanes) when the compiler
+//targets it (/arch:AVX, -mavx), SSE2 (4 lanes) on any other x86-64 build, NEON (4
+//lanes) on ARM, and one lane of plain C++ otherwise.
+// https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VULKANIZE_SIMD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// A batch of floats and the few operations the scene needs on it. Comparisons give
+//masks, lanes that are all ones where they hold.
+struct SimdFloat {
+#if defined(__AVX__)
+	typedef __m256 Batch;
+	static const uint32_t WIDTH = 8;
+	static const char* name() { return "avx"; }
+	static Batch load(const float* p) { return _mm256_loadu_ps(p); }
+	static void store(float* p, Batch v) { _mm256_storeu_ps(p, v); }
+	static Batch set(float v) { return _mm256_set1_ps(v); }
+	static Batch add(Batch a, Batch b) { return _mm256_add_ps(a, b); }
+	static Batch sub(Batch a, Batch b) { return _mm256_sub_ps(a, b); }
+	static Batch mul(Batch a, Batch b) { return _mm256_mul_ps(a, b); }
+	static Batch min(Batch a, Batch b) { return _mm256_min_ps(a, b); }
+	static Batch max(Batch a, Batch b) { return _mm256_max_ps(a, b); }
+	static Batch abs(Batch v) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v); }
+	static Batch greater(Batch a, Batch b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static Batch orMask(Batch a, Batch b) { return _mm256_or_ps(a, b); }
+	// mask ? a : b, lane by lane
+	static Batch select(Batch mask, Batch a, Batch b) { return _mm256_blendv_ps(b, a, mask); }
+	// Bit i is lane i of the mask
+	static uint32_t bits(Batch mask) { return (uint32_t) _mm256_movemask_ps(mask); }
+#elif defined(VULKANIZE_SIMD_SSE)
+	typedef __m128 Batch;
+	static const uint32_t WIDTH = 4;
+	static const char* name() { return "sse2"; }
+	static Batch load(const float* p) { return _mm_loadu_ps(p); }
+	static void store(float* p, Batch v) { _mm_storeu_ps(p, v); }
+	static Batch set(float v) { return _mm_set1_ps(v); }
+	static Batch add(Batch a, Batch b) { return _mm_add_ps(a, b); }
+	static Batch sub(Batch a, Batch b) { return _mm_sub_ps(a, b); }
+	static Batch mul(Batch a, Batch b) { return _mm_mul_ps(a, b); }
+	static Batch min(Batch a, Batch b) { return _mm_min_ps(a, b); }
+	static Batch max(Batch a, Batch b) { return _mm_max_ps(a, b); }
+	static Batch abs(Batch v) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), v); }
+	static Batch greater(Batch a, Batch b) { return _mm_cmpgt_ps(a, b); }
+	static Batch orMask(Batch a, Batch b) { return _mm_or_ps(a, b); }
+	static Batch select(Batch mask, Batch a, Batch b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	static uint32_t bits(Batch mask) { return (uint32_t) _mm_movemask_ps(mask); }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	typedef float32x4_t Batch;
+	static const uint32_t WIDTH = 4;
+	static const char* name() { return "neon"; }
+	static Batch load(const float* p) { return vld1q_f32(p); }
+	static void store(float* p, Batch v) { vst1q_f32(p, v); }
+	static Batch set(float v) { return vdupq_n_f32(v); }
+	static Batch add(Batch a, Batch b) { return vaddq_f32(a, b); }
+	static Batch sub(Batch a, Batch b) { return vsubq_f32(a, b); }
+	static Batch mul(Batch a, Batch b) { return vmulq_f32(a, b); }
+	static Batch min(Batch a, Batch b) { return vminq_f32(a, b); }
+	static Batch max(Batch a, Batch b) { return vmaxq_f32(a, b); }
+	static Batch abs(Batch v) { return vabsq_f32(v); }
+	static Batch greater(Batch a, Batch b) { return vreinterpretq_f32_u32(vcgtq_f32(a, b)); }
+	static Batch orMask(Batch a, Batch b) { return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a), vreinterpretq_u32_f32(b))); }
+	static Batch select(Batch mask, Batch a, Batch b) { return vbslq_f32(vreinterpretq_u32_f32(mask), a, b); }
+	static uint32_t bits(Batch mask) {
+		uint32x4_t signs = vshrq_n_u32(vreinterpretq_u32_f32(mask), 31);
+		return vgetq_lane_u32(signs, 0) | (vgetq_lane_u32(signs, 1) << 1) | (vgetq_lane_u32(signs, 2) << 2) | (vgetq_lane_u32(signs, 3) << 3);
+	}
+#else
+	// A mask lane is 1.0 where it holds
+	typedef float Batch;
+	static const uint32_t WIDTH = 1;
+	static const char* name() { return "scalar"; }
+	static Batch load(const float* p) { return *p; }
+	static void store(float* p, Batch v) { *p = v; }
+	static Batch set(float v) { return v; }
+	static Batch add(Batch a, Batch b) { return a + b; }
+	static Batch sub(Batch a, Batch b) { return a - b; }
+	static Batch mul(Batch a, Batch b) { return a * b; }
+	static Batch min(Batch a, Batch b) { return a < b ? a : b; }
+	static Batch max(Batch a, Batch b) { return a > b ? a : b; }
+	static Batch abs(Batch v) { return std::fabs(v); }
+	static Batch greater(Batch a, Batch b) { return a > b ? 1.0f : 0.0f; }
+	static Batch orMask(Batch a, Batch b) { return a != 0.0f || b != 0.0f ? 1.0f : 0.0f; }
+	static Batch select(Batch mask, Batch a, Batch b) { return mask != 0.0f ? a : b; }
+	static uint32_t bits(Batch mask) { return mask != 0.0f ? 1u : 0u; }
+#endif
+};
+
+// What the GPU gets for every object, 16 bytes each: the objects the culling reads
+//and the per instance vertex data of shaders/instanced.vert (see shaders/cull.comp)
+struct SceneInstance {
+	float offset[2];
+	float scale;
+	// Of the circle around the object, after scaling
+	float radius;
+};
+
+class SceneStore {
+public:
+	void clear() {
+		count = 0;
+		for (std::vector<float>* array : arrays()) {
+			array->clear();
+		}
+	}
+
+	// Returns the new object's index. Objects don't move until they get a velocity.
+	uint32_t add(float x, float y, float scale, float radius) {
+		uint32_t index = count++;
+		// Grows by whole batches, the padding lanes stay zero
+		if (index % SimdFloat::WIDTH == 0) {
+			for (std::vector<float>* array : arrays()) {
+				array->resize(array->size() + SimdFloat::WIDTH, 0.0f);
+			}
+		}
+		this->x[index] = x;
+		this->y[index] = y;
+		this->scale[index] = scale;
+		this->radius[index] = radius;
+		return index;
+	}
+
+	// In screen units per second
+	void setVelocity(uint32_t index, float velocityX, float velocityY) {
+		this->velocityX[index] = velocityX;
+		this->velocityY[index] = velocityY;
+	}
+
+	uint32_t size() const {
+		return count;
+	}
+
+	float offsetX(uint32_t index) const {
+		return x[index];
+	}
+
+	float offsetY(uint32_t index) const {
+		return y[index];
+	}
+
+	float objectScale(uint32_t index) const {
+		return scale[index];
+	}
+
+	// Moves every object by seconds of its velocity. Objects bounce off the edges of
+	//the screen's [-1, 1] square at the camera's rest position.
+	void update(float seconds) {
+		auto start = std::chrono::steady_clock::now();
+		SimdFloat::Batch step = SimdFloat::set(seconds);
+		SimdFloat::Batch low = SimdFloat::set(-1.0f);
+		SimdFloat::Batch high = SimdFloat::set(1.0f);
+		for (uint32_t i = 0; i < paddedCount(); i += SimdFloat::WIDTH) {
+			move(&x[i], &velocityX[i], step, low, high);
+			move(&y[i], &velocityY[i], step, low, high);
+		}
+		updateTime.add(start);
+	}
+
+	// The objects whose circle reaches into the screen with the camera at center
+	//magnified by zoom, the same test shaders/cull.comp does. visible gets their
+	//indices in order, the count is returned.
+	uint32_t cull(const float center[2], float zoom, std::vector<uint32_t>& visible) const {
+		auto start = std::chrono::steady_clock::now();
+		visible.resize(paddedCount());
+		SimdFloat::Batch centerX = SimdFloat::set(center[0]);
+		SimdFloat::Batch centerY = SimdFloat::set(center[1]);
+		SimdFloat::Batch magnification = SimdFloat::set(zoom);
+		SimdFloat::Batch one = SimdFloat::set(1.0f);
+		uint32_t visibleCount = 0;
+		for (uint32_t i = 0; i < paddedCount(); i += SimdFloat::WIDTH) {
+			SimdFloat::Batch r = SimdFloat::mul(SimdFloat::load(&radius[i]), magnification);
+			SimdFloat::Batch distanceX = SimdFloat::abs(SimdFloat::mul(SimdFloat::sub(SimdFloat::load(&x[i]), centerX), magnification));
+			SimdFloat::Batch distanceY = SimdFloat::abs(SimdFloat::mul(SimdFloat::sub(SimdFloat::load(&y[i]), centerY), magnification));
+			SimdFloat::Batch outside = SimdFloat::orMask(
+				SimdFloat::greater(SimdFloat::sub(distanceX, r), one),
+				SimdFloat::greater(SimdFloat::sub(distanceY, r), one));
+			uint32_t visibleBits = ~SimdFloat::bits(outside) & laneMask(i);
+			// Branch free: every lane is written, the count only moves past visible ones
+			for (uint32_t lane = 0; lane < SimdFloat::WIDTH; lane++) {
+				visible[visibleCount] = i + lane;
+				visibleCount += (visibleBits >> lane) & 1;
+			}
+		}
+		visible.resize(visibleCount);
+		cullTime.add(start);
+		culledObjects += count - visibleCount;
+		return visibleCount;
+	}
+
+	// Writes all objects one after the other, as the GPU reads them. out is meant to
+	//be write combined mapped memory (host visible device local): it's only written,
+	//front to back, in whole 16 byte instances.
+	void writeInstances(SceneInstance* out) const {
+		auto start = std::chrono::steady_clock::now();
+		uint32_t i = 0;
+#if defined(__AVX__) || defined(VULKANIZE_SIMD_SSE)
+		// Four objects' properties in, four objects out
+		for (; i + 4 <= count; i += 4) {
+			__m128 row0 = _mm_loadu_ps(&x[i]);
+			__m128 row1 = _mm_loadu_ps(&y[i]);
+			__m128 row2 = _mm_loadu_ps(&scale[i]);
+			__m128 row3 = _mm_loadu_ps(&radius[i]);
+			_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+			float* destination = &out[i].offset[0];
+			_mm_storeu_ps(destination, row0);
+			_mm_storeu_ps(destination + 4, row1);
+			_mm_storeu_ps(destination + 8, row2);
+			_mm_storeu_ps(destination + 12, row3);
+		}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+		// The interleaving store does the transpose
+		for (; i + 4 <= count; i += 4) {
+			float32x4x4_t rows;
+			rows.val[0] = vld1q_f32(&x[i]);
+			rows.val[1] = vld1q_f32(&y[i]);
+			rows.val[2] = vld1q_f32(&scale[i]);
+			rows.val[3] = vld1q_f32(&radius[i]);
+			vst4q_f32(&out[i].offset[0], rows);
+		}
+#endif
+		for (; i < count; i++) {
+			SceneInstance instance;
+			instance.offset[0] = x[i];
+			instance.offset[1] = y[i];
+			instance.scale = scale[i];
+			instance.radius = radius[i];
+			out[i] = instance;
+		}
+		writeTime.add(start);
+	}
+
+	void printStats(std::ostream& out) const {
+		if (count == 0) {
+			return;
+		}
+		out << "scene store: " << count << " objects, " << SimdFloat::name() << std::fixed << std::setprecision(3);
+		updateTime.print(out, "update");
+		cullTime.print(out, "cull");
+		writeTime.print(out, "write");
+		if (cullTime.calls > 0) {
+			out << ", " << culledObjects / cullTime.calls << " culled per frame";
+		}
+		out << std::defaultfloat << std::endl;
+	}
+
+private:
+	// Average of the calls of one pass
+	struct PassTime {
+		uint64_t calls = 0;
+		uint64_t nanoseconds = 0;
+
+		void add(std::chrono::steady_clock::time_point start) {
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			nanoseconds += (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+			calls++;
+		}
+
+		void print(std::ostream& out, const char* name) const {
+			if (calls > 0) {
+				out << ", " << name << " " << nanoseconds / 1e6 / calls << " ms";
+			}
+		}
+	};
+
+	uint32_t count = 0;
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> velocityX;
+	std::vector<float> velocityY;
+	std::vector<float> scale;
+	// Of the circle around the object, after scaling
+	std::vector<float> radius;
+
+	// The passes are timed from const methods too
+	mutable PassTime updateTime;
+	mutable PassTime cullTime;
+	mutable PassTime writeTime;
+	mutable uint64_t culledObjects = 0;
+
+	std::vector<std::vector<float>*> arrays() {
+		return { &x, &y, &velocityX, &velocityY, &scale, &radius };
+	}
+
+	uint32_t paddedCount() const {
+		return (uint32_t) x.size();
+	}
+
+	// The lanes of the batch at first that are objects and not padding
+	uint32_t laneMask(uint32_t first) const {
+		uint32_t lanes = std::min(count - first, (uint32_t) SimdFloat::WIDTH);
+		return lanes >= 32 ? ~0u : (1u << lanes) - 1;
+	}
+
+	// One axis of a batch: position += velocity * step, and the velocity turns
+	//around past low or high (the position is pulled back inside)
+	static void move(float* position, float* velocity, SimdFloat::Batch step, SimdFloat::Batch low, SimdFloat::Batch high) {
+		SimdFloat::Batch v = SimdFloat::load(velocity);
+		SimdFloat::Batch p = SimdFloat::add(SimdFloat::load(position), SimdFloat::mul(v, step));
+		SimdFloat::Batch outside = SimdFloat::orMask(SimdFloat::greater(p, high), SimdFloat::greater(low, p));
+		SimdFloat::Batch zero = SimdFloat::set(0.0f);
+		SimdFloat::store(velocity, SimdFloat::select(outside, SimdFloat::sub(zero, v), v));
+		SimdFloat::store(position, SimdFloat::min(SimdFloat::max(p, low), high));
+	}
+};
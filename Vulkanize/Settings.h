@@ -0,0 +1,440 @@
+#pragma once
+
+// Startup options, so a deployment can be tuned without recompiling.
+// Every option can be passed on the command line as --name=value or through the
+//environment as VULKANIZE_NAME (uppercase, dashes become underscores). The
+//command line wins over the environment.
+
+#include <vulkan/vulkan.h>
+// HostAllocatorMode
+#include "HostAllocator.h"
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// What the validation layers check and report
+enum class ValidationMode {
+	// No layers at all
+	Off,
+	// Errors and warnings
+	On,
+	// Everything the layers have to say, info and verbose messages included
+	Verbose
+};
+
+// How linked GPUs (a device group, see DeviceGroup.h) share the frames
+enum class MultiGpuMode {
+	// One GPU, the others idle
+	Off,
+	// Every GPU renders whole frames, taking turns
+	AlternateFrame
+};
+
+// What the fragment shader draws, a specialization constant of the pipeline (see
+//PipelineFactory.h). The values are the constant's.
+enum class Shading : uint32_t {
+	// The vertex colors
+	Colors,
+	// Their luminance, in gray
+	Luminance
+};
+
+// Debug builds validate unless told not to. Release builds don't, and neither do
+//benchmark builds (whatever their configuration), the layers cost more than most of
+//what they measure. VULKANIZE_VALIDATION_DEFAULT overrides both, as a preprocessor
+//definition naming a ValidationMode (e.g. Off in a Debug build used for profiling).
+#if defined(VULKANIZE_VALIDATION_DEFAULT)
+const ValidationMode DEFAULT_VALIDATION = ValidationMode::VULKANIZE_VALIDATION_DEFAULT;
+#elif defined(NDEBUG) || defined(VULKANIZE_BENCHMARK)
+const ValidationMode DEFAULT_VALIDATION = ValidationMode::Off;
+#else
+const ValidationMode DEFAULT_VALIDATION = ValidationMode::On;
+#endif
+
+struct AppSettings {
+	// Presentation mode we would like to use. If the surface doesn't support it we
+	//fall back to the closest mode that does (FIFO is always available).
+	//	mailbox: lowest latency without tearing, GPU keeps rendering and the newest
+	//		image replaces the queued one
+	//	immediate: lowest latency, may tear
+	//	fifo-relaxed: vsync, but late frames are shown right away (may tear)
+	//	fifo: classic vsync, highest latency but never tears
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+
+	// Number of images requested for the swap chain. 0 means minImageCount + 1,
+	//which is what the tutorial recommends. It gets clamped to the surface limits.
+	uint32_t swapchainImageCount = 0;
+
+	// How many frames the CPU may record ahead of the GPU. With 1 the CPU waits for
+	//every frame to finish before recording the next one, 2 or 3 let both work at the
+	//same time at the cost of a frame of latency each.
+	uint32_t framesInFlight = 2;
+
+	// Pins the GPU to use by its deviceUUID (32 hex digits, dashes are ignored), 
+	//instead of letting the device scoring pick one. The UUIDs of all devices are 
+	//printed at startup. Empty means automatic selection.
+	std::string deviceUUID;
+
+	// Host memory allocator given to the driver: "driver" (its own, the default), 
+	//"tracking" (system heap, counted per allocation scope) or "pool" (counted, small
+	//allocations from size class pools). Stats are printed at shutdown.
+	HostAllocatorMode hostAllocator = HostAllocatorMode::Driver;
+
+	// File the pipeline cache is loaded from at startup and saved to at shutdown,
+	//relative to the working directory. Empty keeps the cache in memory only.
+	std::string pipelineCachePath = "pipeline_cache.bin";
+
+	// Threads recording command buffers, the main thread included. 0 means one per 
+	//hardware thread, 1 records everything on the main thread.
+	uint32_t recordThreads = 0;
+
+	// How many copies of the triangle are drawn every frame, each its own draw call.
+	//A stand-in for a real scene to put load on command recording.
+	uint32_t drawCount = 1;
+
+	// File the GPU profiler writes its recent frames to when F12 is pressed. Ending 
+	//in .json gives JSON, anything else CSV.
+	std::string gpuProfilePath = "gpu_profile.csv";
+
+	// Seconds between the frame time reports (percentiles of the CPU time spent in
+	//each step of a frame). 0 only reports once, at shutdown.
+	uint32_t statsInterval = 5;
+
+	// File that live stats (frame times, memory, submissions, validation messages)
+	//are appended to as one JSON line every statsExportInterval seconds. Empty
+	//doesn't export.
+	std::string statsExport;
+	uint32_t statsExportInterval = 1;
+
+	// Renders to offscreen images without opening a window, for machines without a
+	//display. There's no presentation, so no vsync either: frames go as fast as the
+	//GPU draws them.
+	bool headless = false;
+
+	// Frames to render before exiting. 0 means until the window is closed, or 1000
+	//frames when headless.
+	uint32_t frameCount = 0;
+
+	// Headless only: every Nth frame is copied back and written to frame_<n>.ppm in
+	//the working directory. 0 turns the readback off.
+	uint32_t readbackInterval = 0;
+
+	// Moves the view over the grid of draws along a fixed path, one step per frame, so
+	//every run renders the same frames no matter how fast they were drawn
+	bool cameraPath = false;
+
+	// Benchmark builds only: file the JSON report is written to at the end of the run
+	std::string benchmarkOutput = "benchmark.json";
+
+	// Validation layers: "off", "on" (errors and warnings) or "verbose". The default
+	//depends on the build, see DEFAULT_VALIDATION. Messages are printed by a thread of
+	//their own, so turning validation on in a release build costs the layers' checks
+	//but not console output on the render thread.
+	ValidationMode validation = DEFAULT_VALIDATION;
+
+	// How many messages with the same id are printed per second, the rest are counted
+	uint32_t validationRepeatLimit = 10;
+
+	// Headless only: "off" or "afr" (alternate frame rendering on all GPUs of the
+	//picked device's device group). Without a group it's off.
+	MultiGpuMode multiGpu = MultiGpuMode::Off;
+
+	// Compiles the GLSL in shaders/ at startup with glslangValidator (from the Vulkan
+	//SDK, or the PATH) instead of using the .spv files from the build. Results are
+	//cached next to the sources by their hash.
+	bool compileShaders = false;
+
+	// Watches the shaders (the sources when compiling, the .spv files otherwise) and
+	//recreates the pipeline when one of them changes
+	bool hotReloadShaders = false;
+
+	// Draws the grid with one indirect draw whose commands a compute shader writes
+	//after frustum culling. Needs the multiDrawIndirect and drawIndirectFirstInstance
+	//features, falls back to the direct draws without them.
+	bool gpuCulling = false;
+
+	// Moves the objects of the grid every frame, each in its own direction, bouncing
+	//off the edges of the screen
+	bool animateScene = false;
+
+	// Counts the submissions of the graphics, transfer and compute queues on timeline
+	//semaphores instead of a fence each, when the device has VK_KHR_timeline_semaphore.
+	//Turn it off to compare with the fences.
+	bool timelineSemaphores = true;
+
+	// Creates the pipelines for the attachment formats instead of a render pass, and
+	//renders without render passes and framebuffers, when the device has
+	//VK_KHR_dynamic_rendering
+	bool dynamicRendering = true;
+
+	// What is drawn at startup, F2 switches (mostly to show a pipeline variant being
+	//created while drawing goes on): colors or luminance
+	Shading shading = Shading::Colors;
+
+	// Windowed only: frames per second the main loop aims for, sleeping in between
+	//instead of spinning. Rounded to whole refresh cycles when the display reports its
+	//refresh rate (VK_GOOGLE_display_timing). 0 draws as fast as the present mode lets
+	//it.
+	uint32_t frameRate = 0;
+
+	// Windowed only: draws a frame only when something changed (the window was resized
+	//or exposed, a key was pressed, an upload or a shader reload landed, or the scene or
+	//camera moves) and sleeps until then
+	bool renderOnDemand = false;
+
+	// KTX2 textures to stream, comma separated. Their mip levels are loaded as the
+	//grid's objects get big enough on screen to need them.
+	std::vector<std::string> textures;
+
+	// MiB of device memory the streamed textures may use. 0 means half of the device
+	//local heap, or of its budget with VK_EXT_memory_budget.
+	uint32_t textureBudget = 0;
+};
+
+// Lookup of the raw option strings. Keeps the parsing code below free of
+//argv/getenv details.
+class SettingsSource {
+public:
+	SettingsSource(int argc, char** argv) {
+		for (int i = 1; i < argc; i++) {
+			arguments.push_back(argv[i]);
+		}
+	}
+
+	// Fetches the value of "name", returns false if it wasn't given anywhere
+	bool lookup(const char* name, std::string& value) const {
+		const std::string prefix = std::string("--") + name + "=";
+		// Later arguments override earlier ones
+		for (auto it = arguments.rbegin(); it != arguments.rend(); ++it) {
+			if (it->compare(0, prefix.size(), prefix) == 0) {
+				value = it->substr(prefix.size());
+				return true;
+			}
+		}
+
+		std::string variable = "VULKANIZE_";
+		for (const char* c = name; *c != '\0'; c++) {
+			variable += (*c == '-') ? '_' : (char) toupper(*c);
+		}
+		const char* environmentValue = getenv(variable.c_str());
+		if (environmentValue != nullptr) {
+			value = environmentValue;
+			return true;
+		}
+
+		return false;
+	}
+
+	// Flags without a value (--name) count as "true"
+	bool flag(const char* name) const {
+		const std::string option = std::string("--") + name;
+		for (const auto& argument : arguments) {
+			if (argument == option) {
+				return true;
+			}
+		}
+
+		std::string value;
+		if (lookup(name, value)) {
+			return value == "1" || value == "true" || value == "on" || value == "yes";
+		}
+		return false;
+	}
+
+private:
+	std::vector<std::string> arguments;
+};
+
+inline VkPresentModeKHR parsePresentMode(const std::string& value) {
+	if (value == "mailbox") return VK_PRESENT_MODE_MAILBOX_KHR;
+	if (value == "immediate") return VK_PRESENT_MODE_IMMEDIATE_KHR;
+	if (value == "fifo-relaxed") return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+	if (value == "fifo") return VK_PRESENT_MODE_FIFO_KHR;
+	throw std::runtime_error("unknown present mode '" + value + "' (use mailbox, immediate, fifo-relaxed or fifo)");
+}
+
+inline ValidationMode parseValidationMode(const std::string& value) {
+	if (value == "off") return ValidationMode::Off;
+	if (value == "on") return ValidationMode::On;
+	if (value == "verbose") return ValidationMode::Verbose;
+	throw std::runtime_error("unknown validation mode '" + value + "' (use off, on or verbose)");
+}
+
+inline MultiGpuMode parseMultiGpuMode(const std::string& value) {
+	if (value == "off") return MultiGpuMode::Off;
+	if (value == "afr") return MultiGpuMode::AlternateFrame;
+	throw std::runtime_error("unknown multi-gpu mode '" + value + "' (use off or afr)");
+}
+
+inline Shading parseShading(const std::string& value) {
+	if (value == "colors") return Shading::Colors;
+	if (value == "luminance") return Shading::Luminance;
+	throw std::runtime_error("unknown shading '" + value + "' (use colors or luminance)");
+}
+
+inline const char* presentModeName(VkPresentModeKHR mode) {
+	switch (mode) {
+	case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+	case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+	case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+	default: return "unknown";
+	}
+}
+
+// "a,b,c" into its parts, empty ones left out
+inline std::vector<std::string> parseList(const std::string& value) {
+	std::vector<std::string> parts;
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t end = value.find(',', start);
+		if (end == std::string::npos) {
+			end = value.size();
+		}
+		if (end > start) {
+			parts.push_back(value.substr(start, end - start));
+		}
+		start = end + 1;
+	}
+	return parts;
+}
+
+inline uint32_t parseUnsigned(const char* name, const std::string& value) {
+	char* end = nullptr;
+	unsigned long parsed = strtoul(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0') {
+		throw std::runtime_error(std::string("invalid value for ") + name + ": '" + value + "'");
+	}
+	return (uint32_t) parsed;
+}
+
+// Lowercase hex without separators, so UUIDs compare no matter how they were typed
+inline std::string normalizeUUID(const std::string& value) {
+	std::string normalized;
+	for (char c : value) {
+		if (c == '-' || c == '{' || c == '}') continue;
+		if (!isxdigit((unsigned char) c)) {
+			throw std::runtime_error("invalid device UUID '" + value + "'");
+		}
+		normalized += (char) tolower((unsigned char) c);
+	}
+	if (normalized.size() != 2 * VK_UUID_SIZE) {
+		throw std::runtime_error("invalid device UUID '" + value + "' (expected 32 hex digits)");
+	}
+	return normalized;
+}
+
+// Options not given on the command line or in the environment keep their value in
+//defaults, which lets the benchmark build start from its own
+inline AppSettings parseSettings(int argc, char** argv, const AppSettings& defaults = AppSettings()) {
+	SettingsSource source(argc, argv);
+	AppSettings settings = defaults;
+	std::string value;
+
+	if (source.lookup("present-mode", value)) {
+		settings.presentMode = parsePresentMode(value);
+	}
+	if (source.lookup("swapchain-images", value)) {
+		settings.swapchainImageCount = parseUnsigned("swapchain-images", value);
+	}
+	if (source.lookup("frames-in-flight", value)) {
+		settings.framesInFlight = parseUnsigned("frames-in-flight", value);
+		if (settings.framesInFlight < 1 || settings.framesInFlight > 8) {
+			throw std::runtime_error("frames-in-flight must be between 1 and 8");
+		}
+	}
+	if (source.lookup("host-allocator", value)) {
+		settings.hostAllocator = parseHostAllocatorMode(value);
+	}
+	if (source.lookup("device-uuid", value) && !value.empty()) {
+		settings.deviceUUID = normalizeUUID(value);
+	}
+	if (source.lookup("pipeline-cache", value)) {
+		settings.pipelineCachePath = value;
+	}
+	if (source.lookup("record-threads", value)) {
+		settings.recordThreads = parseUnsigned("record-threads", value);
+	}
+	if (source.lookup("draw-count", value)) {
+		settings.drawCount = parseUnsigned("draw-count", value);
+		if (settings.drawCount < 1) {
+			throw std::runtime_error("draw-count must be at least 1");
+		}
+	}
+	if (source.lookup("gpu-profile", value) && !value.empty()) {
+		settings.gpuProfilePath = value;
+	}
+	if (source.lookup("stats-interval", value)) {
+		settings.statsInterval = parseUnsigned("stats-interval", value);
+	}
+	if (source.lookup("stats-export", value)) {
+		settings.statsExport = value;
+	}
+	if (source.lookup("stats-export-interval", value)) {
+		settings.statsExportInterval = parseUnsigned("stats-export-interval", value);
+	}
+	// Flags given as --name=0 turn off what the defaults turned on
+	if (source.flag("headless") || source.lookup("headless", value)) {
+		settings.headless = source.flag("headless");
+	}
+	if (source.lookup("frames", value)) {
+		settings.frameCount = parseUnsigned("frames", value);
+	}
+	if (source.lookup("readback-every", value)) {
+		settings.readbackInterval = parseUnsigned("readback-every", value);
+	}
+	if (source.flag("camera-path") || source.lookup("camera-path", value)) {
+		settings.cameraPath = source.flag("camera-path");
+	}
+	if (source.lookup("benchmark-output", value) && !value.empty()) {
+		settings.benchmarkOutput = value;
+	}
+	if (source.lookup("validation", value)) {
+		settings.validation = parseValidationMode(value);
+	}
+	if (source.lookup("validation-repeat-limit", value)) {
+		settings.validationRepeatLimit = parseUnsigned("validation-repeat-limit", value);
+	}
+	if (source.lookup("multi-gpu", value)) {
+		settings.multiGpu = parseMultiGpuMode(value);
+	}
+	if (source.flag("compile-shaders") || source.lookup("compile-shaders", value)) {
+		settings.compileShaders = source.flag("compile-shaders");
+	}
+	if (source.flag("hot-reload-shaders") || source.lookup("hot-reload-shaders", value)) {
+		settings.hotReloadShaders = source.flag("hot-reload-shaders");
+	}
+	if (source.flag("gpu-culling") || source.lookup("gpu-culling", value)) {
+		settings.gpuCulling = source.flag("gpu-culling");
+	}
+	if (source.flag("animate-scene") || source.lookup("animate-scene", value)) {
+		settings.animateScene = source.flag("animate-scene");
+	}
+	if (source.flag("timeline-semaphores") || source.lookup("timeline-semaphores", value)) {
+		settings.timelineSemaphores = source.flag("timeline-semaphores");
+	}
+	if (source.flag("dynamic-rendering") || source.lookup("dynamic-rendering", value)) {
+		settings.dynamicRendering = source.flag("dynamic-rendering");
+	}
+	if (source.lookup("shading", value)) {
+		settings.shading = parseShading(value);
+	}
+	if (source.lookup("frame-rate", value)) {
+		settings.frameRate = parseUnsigned("frame-rate", value);
+	}
+	if (source.flag("render-on-demand") || source.lookup("render-on-demand", value)) {
+		settings.renderOnDemand = source.flag("render-on-demand");
+	}
+	if (source.lookup("textures", value)) {
+		settings.textures = parseList(value);
+	}
+	if (source.lookup("texture-budget", value)) {
+		settings.textureBudget = parseUnsigned("texture-budget", value);
+	}
+
+	return settings;
+}
@@ -0,0 +1,286 @@
+#pragma once
+
+// Shader modules, loaded on worker threads and optionally compiled and reloaded
+//while the program runs.
+// The SPIR-V files are mapped into memory instead of read into a buffer, so a shader
+//costs no copy, and vkCreateShaderModule (which the drivers use to parse and
+//sometimes already optimize the code) runs on a worker thread per shader, not on the
+//main thread during startup.
+// With runtime compilation the GLSL sources are compiled by glslangValidator from the
+//Vulkan SDK instead of using the .spv files from the build. The results are kept
+//next to the sources, named after a hash of the source text, so a shader is only
+//compiled again when it changed.
+// With hot reload the files are watched, and a shader that changed is loaded (and
+//compiled) again in the background. pollReload() tells the caller when a new module
+//is in, so it can rebuild the pipelines that use it, the old pipelines keep drawing
+//until then.
+// https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#shader-modules
+
+#include "VHandle.h"
+#include "MappedFile.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+
+class ShaderLibrary {
+public:
+	ShaderLibrary(const VDevice& device, const VkAllocationCallbacks* allocator)
+		: device(device), allocator(allocator) {}
+
+	// compile uses the GLSL sources instead of the SPIR-V from the build, hotReload
+	//watches whichever of the two is used. Call before adding shaders.
+	void configure(bool compile, bool hotReload) {
+		this->compile = compile;
+		this->hotReload = hotReload;
+	}
+
+	// Starts loading a shader on a worker thread, which can happen before the device
+	//exists. sourcePath is the GLSL the SPIR-V was compiled from, only used with
+	//runtime compilation.
+	void add(const std::string& name, const std::string& spirvPath, const std::string& sourcePath) {
+		Shader& shader = shaders[name];
+		shader.spirvPath = spirvPath;
+		shader.sourcePath = sourcePath;
+		shader.watchedTime = modifiedTime(watchedPath(shader));
+		shader.code = std::async(std::launch::async, [this, spirvPath, sourcePath] { return loadCode(spirvPath, sourcePath); });
+	}
+
+	// Once the device exists: turns the code of every shader into a module, each on
+	//a worker thread of its own
+	void createModules() {
+		for (auto& entry : shaders) {
+			Shader& shader = entry.second;
+			std::future<std::unique_ptr<MappedFile>>* code = &shader.code;
+			shader.pending = std::async(std::launch::async, [this, code] {
+				// The file is unmapped as soon as the module is made, the driver keeps its
+				//own copy of the code
+				std::unique_ptr<MappedFile> file = code->get();
+				return createModule(*file);
+			});
+		}
+	}
+
+	// Waits for the first module of the shader. Not thread safe against pollReload(),
+	//which can replace it: pipelines are created from the modules either before the
+	//render loop starts or while pollReload() isn't called.
+	VkShaderModule module(const std::string& name) {
+		auto found = shaders.find(name);
+		if (found == shaders.end()) {
+			throw std::runtime_error("failed to find shader " + name + "!");
+		}
+		Shader& shader = found->second;
+		if (shader.module == VK_NULL_HANDLE && shader.pending.valid()) {
+			shader.module = shader.pending.get();
+		}
+		return shader.module;
+	}
+
+	// Call once per frame with hot reload on. Looks at the files' modification times
+	//every now and then and starts loading the ones that changed; returns true when
+	//new modules came in since the last call, the pipelines have to be created again
+	//to pick them up. A shader that fails to load or compile keeps its old module.
+	bool pollReload() {
+		if (!hotReload) {
+			return false;
+		}
+
+		bool reloaded = false;
+		for (auto& entry : shaders) {
+			Shader& shader = entry.second;
+			if (!shader.pending.valid() || shader.pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+				continue;
+			}
+			try {
+				// The old module can go right away, pipelines don't need their modules
+				//after they're created
+				shader.module = shader.pending.get();
+				reloads++;
+				reloaded = true;
+				std::cout << "shaders: reloaded " << entry.first << std::endl;
+			}
+			catch (const std::exception& error) {
+				failedReloads++;
+				std::cerr << "shaders: keeping the old " << entry.first << ", " << error.what() << std::endl;
+			}
+		}
+
+		// stat() is cheap, but not free, and editors take a moment to write a file anyway
+		auto now = std::chrono::steady_clock::now();
+		if (now - lastWatch < std::chrono::milliseconds(WATCH_INTERVAL_MS)) {
+			return reloaded;
+		}
+		lastWatch = now;
+
+		for (auto& entry : shaders) {
+			Shader& shader = entry.second;
+			time_t time = modifiedTime(watchedPath(shader));
+			if (time == shader.watchedTime || shader.pending.valid()) {
+				continue;
+			}
+			shader.watchedTime = time;
+			std::string spirvPath = shader.spirvPath;
+			std::string sourcePath = shader.sourcePath;
+			shader.pending = std::async(std::launch::async, [this, spirvPath, sourcePath] {
+				std::unique_ptr<MappedFile> file = loadCode(spirvPath, sourcePath);
+				return createModule(*file);
+			});
+		}
+		return reloaded;
+	}
+
+	void printStats(std::ostream& out) const {
+		out << "shaders: " << shaders.size() << " loaded in " << std::fixed << std::setprecision(1)
+			<< loadMicroseconds.load() / 1000.0 << " ms on worker threads";
+		if (compile) {
+			out << ", compiled " << compiledCount.load() << ", from the cache " << cacheHits.load();
+		}
+		if (hotReload) {
+			out << ", reloaded " << reloads << " (" << failedReloads << " failed)";
+		}
+		out << std::endl;
+	}
+
+private:
+	// How often pollReload() looks at the files
+	static const uint32_t WATCH_INTERVAL_MS = 500;
+	// First word of every SPIR-V module
+	static const uint32_t SPIRV_MAGIC = 0x07230203;
+
+	struct Shader {
+		std::string spirvPath;
+		std::string sourcePath;
+		// The code while it's loaded, taken by createModules()
+		std::future<std::unique_ptr<MappedFile>> code;
+		// Module being created, the first one or a reload
+		std::future<VShaderModule> pending;
+		VShaderModule module;
+		// Modification time of the watched file when it was last loaded
+		time_t watchedTime = 0;
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+	bool compile = false;
+	bool hotReload = false;
+	std::map<std::string, Shader> shaders;
+	std::chrono::steady_clock::time_point lastWatch;
+
+	std::atomic<uint64_t> loadMicroseconds{ 0 };
+	std::atomic<uint32_t> compiledCount{ 0 };
+	std::atomic<uint32_t> cacheHits{ 0 };
+	uint32_t reloads = 0;
+	uint32_t failedReloads = 0;
+
+	const std::string& watchedPath(const Shader& shader) const {
+		return compile && !shader.sourcePath.empty() ? shader.sourcePath : shader.spirvPath;
+	}
+
+	// 0 when the file doesn't exist
+	static time_t modifiedTime(const std::string& path) {
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 ? info.st_mtime : 0;
+	}
+
+	// Runs on a worker thread
+	std::unique_ptr<MappedFile> loadCode(const std::string& spirvPath, const std::string& sourcePath) {
+		auto start = std::chrono::steady_clock::now();
+		std::string path = compile && !sourcePath.empty() ? compiledPath(sourcePath) : spirvPath;
+		std::unique_ptr<MappedFile> file(new MappedFile(path));
+
+		uint32_t magic = 0;
+		if (file->size() >= sizeof(magic)) {
+			memcpy(&magic, file->data(), sizeof(magic));
+		}
+		if (file->size() % 4 != 0 || magic != SPIRV_MAGIC) {
+			throw std::runtime_error("failed to load shader " + path + ", not SPIR-V!");
+		}
+
+		loadMicroseconds += (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		return file;
+	}
+
+	// Compiles the GLSL source unless it was compiled before, returns the path of the
+	//SPIR-V. Old results aren't cleaned up, every version of a source that was ever
+	//compiled stays next to it.
+	std::string compiledPath(const std::string& sourcePath) {
+		std::ifstream source(sourcePath, std::ios::binary);
+		if (!source.is_open()) {
+			throw std::runtime_error("failed to open file " + sourcePath + "!");
+		}
+		std::string text((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+
+		std::ostringstream path;
+		path << sourcePath << "." << std::hex << std::setw(16) << std::setfill('0') << hash(text) << ".spv";
+		if (std::ifstream(path.str()).good()) {
+			cacheHits++;
+			return path.str();
+		}
+
+		std::string command = "\"" + compilerPath() + "\" -V \"" + sourcePath + "\" -o \"" + path.str() + "\"";
+#ifdef _WIN32
+		// cmd /c drops the outer quotes, which would otherwise be the executable's
+		command = "\"" + command + "\"";
+#endif
+		if (std::system(command.c_str()) != 0) {
+			// Don't leave half a file behind that would count as compiled
+			std::remove(path.str().c_str());
+			throw std::runtime_error("failed to compile shader " + sourcePath + "!");
+		}
+		compiledCount++;
+		return path.str();
+	}
+
+	// glslangValidator from the Vulkan SDK, or whichever is on the PATH
+	static std::string compilerPath() {
+		const char* sdk = getenv("VULKAN_SDK");
+		if (sdk == nullptr) {
+			return "glslangValidator";
+		}
+#ifdef _WIN32
+		return std::string(sdk) + "\\Bin\\glslangValidator.exe";
+#else
+		return std::string(sdk) + "/bin/glslangValidator";
+#endif
+	}
+
+	// 64 bit FNV-1a, good enough to tell versions of a source apart
+	static uint64_t hash(const std::string& text) {
+		uint64_t value = 14695981039346656037ull;
+		for (char c : text) {
+			value ^= (uint8_t) c;
+			value *= 1099511628211ull;
+		}
+		return value;
+	}
+
+	// vkCreateShaderModule can be called from any thread
+	VShaderModule createModule(const MappedFile& code) {
+		auto start = std::chrono::steady_clock::now();
+		VkShaderModuleCreateInfo createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize = code.size();
+		createInfo.pCode = (const uint32_t*) code.data();
+
+		VShaderModule shaderModule;
+		if (vkCreateShaderModule(device, &createInfo, allocator, shaderModule.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create shader module!");
+		}
+		loadMicroseconds += (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		return shaderModule;
+	}
+};
@@ -0,0 +1,234 @@
+#pragma once
+
+// Live numbers of a running instance, for whoever watches it from outside.
+// Counters live next to the code that bumps them and are atomics incremented with
+//relaxed ordering, which costs about as much as a plain increment and is safe from
+//any thread. The registry knows them by name, together with sources: functions that
+//read the numbers other parts keep anyway (the memory allocator's heaps, the GPU
+//profiler, the validation messages) when a snapshot is taken.
+// Every interval the render thread takes a snapshot, the frame time percentiles of
+//the interval included, and the registry's own thread appends it to the export file
+//as one JSON object per line. The file can be followed (tail -f, a log shipper) and
+//every line is a complete snapshot, and the render thread never waits for the disk.
+// Counters are totals since the start, so rates come from two snapshots and nothing
+//is lost when one is dropped.
+
+#include "FrameStats.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class StatsCounter {
+public:
+	void add(uint64_t count = 1) {
+		value.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	uint64_t load() const {
+		return value.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> value{ 0 };
+};
+
+// The named values of one snapshot, in the order they were set
+class StatsSnapshot {
+public:
+	void setCount(const std::string& name, uint64_t count) {
+		values.push_back({ name, std::to_string(count) });
+	}
+
+	void setValue(const std::string& name, double value) {
+		std::ostringstream formatted;
+		formatted << std::fixed << std::setprecision(3) << value;
+		values.push_back({ name, formatted.str() });
+	}
+
+	// One line of JSON. The names are our own, so they don't need escaping.
+	std::string json() const {
+		std::string line = "{";
+		for (size_t i = 0; i < values.size(); i++) {
+			line += (i > 0 ? ", \"" : "\"") + values[i].first + "\": " + values[i].second;
+		}
+		return line + "}\n";
+	}
+
+private:
+	// Name and already formatted JSON value
+	std::vector<std::pair<std::string, std::string>> values;
+};
+
+class StatsRegistry {
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef std::function<void(StatsSnapshot&)> Source;
+
+	StatsRegistry() : epoch(Clock::now()) {}
+
+	// Writes what's still queued
+	~StatsRegistry() {
+		stop();
+	}
+
+	StatsRegistry(const StatsRegistry&) = delete;
+	StatsRegistry& operator=(const StatsRegistry&) = delete;
+
+	// Counters and sources are added before start(), and have to stay valid until
+	//stop(). Sources run on the render thread, when the snapshot is taken.
+	void addCounter(const std::string& name, const StatsCounter& counter) {
+		counters.push_back({ name, &counter });
+	}
+
+	void addSource(Source source) {
+		sources.push_back(std::move(source));
+	}
+
+	// Appends a snapshot to path every intervalSeconds (at least 1)
+	void start(const std::string& path, uint32_t intervalSeconds) {
+		if (writer.joinable()) {
+			return;
+		}
+		file.open(path, std::ios::app);
+		if (!file.is_open()) {
+			throw std::runtime_error("failed to open " + path + " for the stats export!");
+		}
+		this->path = path;
+		interval = std::chrono::seconds(std::max(1u, intervalSeconds));
+		intervalStart = Clock::now();
+		running = true;
+		writer = std::thread(&StatsRegistry::writeLoop, this);
+	}
+
+	// Takes a last snapshot, and returns once everything is written
+	void stop() {
+		if (!writer.joinable()) {
+			return;
+		}
+		publish(Clock::now());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		wake.notify_one();
+		writer.join();
+		file.close();
+	}
+
+	bool isEnabled() const {
+		return writer.joinable();
+	}
+
+	// Call once per main loop iteration, on the render thread. The frame time is the
+	//time between two calls, and the snapshot is taken when its interval has passed.
+	void endFrame() {
+		if (!isEnabled()) {
+			return;
+		}
+		Clock::time_point now = Clock::now();
+		if (frameStarted) {
+			frameTimes.add((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastFrameEnd).count());
+		}
+		frameStarted = true;
+		lastFrameEnd = now;
+		if (now - intervalStart >= interval) {
+			publish(now);
+		}
+	}
+
+	void printStats(std::ostream& out) const {
+		if (path.empty()) {
+			return;
+		}
+		out << "stats export: " << published << " snapshots to " << path << ", " << dropped.load() << " dropped (writer behind)" << std::endl;
+	}
+
+private:
+	// Snapshots waiting for the writer, past this the oldest are dropped
+	static const size_t MAX_PENDING = 16;
+
+	std::vector<std::pair<std::string, const StatsCounter*>> counters;
+	std::vector<Source> sources;
+
+	std::string path;
+	std::ofstream file;
+	Clock::duration interval = std::chrono::seconds(1);
+	Clock::time_point epoch;
+
+	// Only touched by the render thread
+	LatencyHistogram frameTimes;
+	bool frameStarted = false;
+	Clock::time_point lastFrameEnd;
+	Clock::time_point intervalStart;
+	uint64_t published = 0;
+
+	std::deque<std::string> pending;
+	std::atomic<uint64_t> dropped{ 0 };
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool running = false;
+
+	void publish(Clock::time_point now) {
+		std::chrono::duration<double> seconds = now - intervalStart;
+		StatsSnapshot snapshot;
+		snapshot.setValue("seconds", std::chrono::duration<double>(now - epoch).count());
+		snapshot.setValue("intervalSeconds", seconds.count());
+		snapshot.setCount("frames", frameTimes.sampleCount());
+		snapshot.setValue("fps", seconds.count() > 0.0 ? frameTimes.sampleCount() / seconds.count() : 0.0);
+		snapshot.setValue("frameMs.p50", frameTimes.percentile(0.50) / 1e6);
+		snapshot.setValue("frameMs.p95", frameTimes.percentile(0.95) / 1e6);
+		snapshot.setValue("frameMs.p99", frameTimes.percentile(0.99) / 1e6);
+		snapshot.setValue("frameMs.max", frameTimes.largest() / 1e6);
+		for (const auto& counter : counters) {
+			snapshot.setCount(counter.first, counter.second->load());
+		}
+		for (const Source& source : sources) {
+			source(snapshot);
+		}
+		frameTimes.clear();
+		intervalStart = now;
+		published++;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending.push_back(snapshot.json());
+			if (pending.size() > MAX_PENDING) {
+				pending.pop_front();
+				dropped.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		wake.notify_one();
+	}
+
+	void writeLoop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;) {
+			wake.wait(lock, [this] { return !pending.empty() || !running; });
+			if (pending.empty()) {
+				return;
+			}
+			std::string line = std::move(pending.front());
+			pending.pop_front();
+
+			lock.unlock();
+			file << line;
+			file.flush();
+			lock.lock();
+		}
+	}
+};
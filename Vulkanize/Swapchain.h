@@ -0,0 +1,359 @@
+#pragma once
+
+// Swap chain layer: queries what the surface supports, picks format, present mode,
+//extent and image count from that and the startup settings, and owns the
+//swap chain with its image views.
+// https://vulkan-tutorial.com/Drawing_a_triangle/Presentation/Swap_chain
+
+#include "VHandle.h"
+#include "Settings.h"
+//Reporting and error propagation
+#include <iostream>
+#include <stdexcept>
+// For std::min/std::max when clamping the extent and image count
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Just checking if a swap chain is available is not sufficient, because it may not
+//actually be compatible with our window surface. There are basically three kinds
+//of properties we need to check
+struct SwapChainSupportDetails {
+	// Basic surface capabilities (min/max number of images, min/max width and height of images)
+	VkSurfaceCapabilitiesKHR capabilities;
+	// Surface formats (pixel format, color space)
+	std::vector<VkSurfaceFormatKHR> formats;
+	// Available presentation modes
+	std::vector<VkPresentModeKHR> presentModes;
+
+	// At least one format and one presentation mode are needed to present anything
+	bool isAdequate() const {
+		return !formats.empty() && !presentModes.empty();
+	}
+};
+
+// Same structure as other queries: ask for the amount, then allocate and ask for the details
+inline SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface) {
+	SwapChainSupportDetails details;
+
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
+
+	uint32_t formatCount;
+	vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+	if (formatCount != 0) {
+		details.formats.resize(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats.data());
+	}
+
+	uint32_t presentModeCount;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
+	if (presentModeCount != 0) {
+		details.presentModes.resize(presentModeCount);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
+	}
+
+	return details;
+}
+
+class Swapchain {
+public:
+	// What's left of a swap chain after it was replaced. Frames that were submitted
+	//before the replacement may still render to and present its images, so it's kept
+	//alive until those frames are done and then simply dropped.
+	struct Retired {
+		VSwapchain swapChain;
+		std::vector<VImageView> imageViews;
+	};
+
+	// The swap chain and its views are children of the logical device, which only 
+	//exists once create() is called, so we keep a reference to its wrapper
+	Swapchain(const VDevice& device, const VkAllocationCallbacks* allocator)
+		: device(device), allocator(allocator) {}
+
+	// Creates the swap chain (and its image views) for the given surface, from what
+	//the surface supports (see DeviceCapabilities). The window extent is only used
+	//when the surface lets us pick the resolution.
+	void create(
+		const SwapChainSupportDetails& swapChainSupport,
+		VkSurfaceKHR surface,
+		uint32_t graphicsFamily,
+		uint32_t presentFamily,
+		const AppSettings& settings,
+		VkExtent2D windowExtent
+	) {
+		build(swapChainSupport, surface, graphicsFamily, presentFamily, settings, windowExtent, VK_NULL_HANDLE);
+	}
+
+	// Replaces the swap chain with one that matches the surface as it is now (after a
+	//resize, or after the window moved to another monitor). The current swap chain is
+	//handed to the new one as oldSwapchain, which lets the presentation engine keep
+	//showing its images until the new ones take over and lets the driver reuse its
+	//resources, so there's no need to wait for the device to go idle. The old one is 
+	//returned, the caller destroys it once nothing uses it anymore.
+	// swapChainSupport has to be up to date, at least its capabilities.
+	Retired recreate(
+		const SwapChainSupportDetails& swapChainSupport,
+		VkSurfaceKHR surface,
+		uint32_t graphicsFamily,
+		uint32_t presentFamily,
+		const AppSettings& settings,
+		VkExtent2D windowExtent
+	) {
+		Retired retired;
+		retired.swapChain = std::move(swapChain);
+		retired.imageViews = std::move(swapChainImageViews);
+		swapChainImageViews.clear();
+		swapChainImages.clear();
+
+		build(swapChainSupport, surface, graphicsFamily, presentFamily, settings, windowExtent, retired.swapChain);
+		return retired;
+	}
+
+	// A zero sized surface (a minimized window on Windows) can't have a swap chain, 
+	//presenting has to wait until it gets a size again
+	static bool canPresent(const VkSurfaceCapabilitiesKHR& capabilities, VkExtent2D windowExtent) {
+		VkExtent2D extent = capabilities.currentExtent.width != UINT32_MAX ? capabilities.currentExtent : windowExtent;
+		return extent.width > 0 && extent.height > 0;
+	}
+
+	VkSwapchainKHR handle() const {
+		return swapChain;
+	}
+
+	VkFormat imageFormat() const {
+		return swapChainImageFormat;
+	}
+
+	VkExtent2D extent() const {
+		return swapChainExtent;
+	}
+
+	VkPresentModeKHR presentMode() const {
+		return swapChainPresentMode;
+	}
+
+	uint32_t imageCount() const {
+		return (uint32_t) swapChainImages.size();
+	}
+
+	VkImage image(uint32_t index) const {
+		return swapChainImages[index];
+	}
+
+	VkImageView imageView(uint32_t index) const {
+		return swapChainImageViews[index];
+	}
+
+private:
+	const VDevice& device;
+	// Host allocator the swap chain and its views are created with
+	const VkAllocationCallbacks* allocator;
+
+	VSwapchain swapChain;
+	// The images are created by the implementation for the swap chain and will be
+	//cleaned up once the swap chain is destroyed
+	std::vector<VkImage> swapChainImages;
+	// To use an image we need a view into it, describing how to access it
+	std::vector<VImageView> swapChainImageViews;
+
+	VkFormat swapChainImageFormat;
+	VkExtent2D swapChainExtent;
+	VkPresentModeKHR swapChainPresentMode;
+
+	void build(
+		const SwapChainSupportDetails& swapChainSupport,
+		VkSurfaceKHR surface,
+		uint32_t graphicsFamily,
+		uint32_t presentFamily,
+		const AppSettings& settings,
+		VkExtent2D windowExtent,
+		VkSwapchainKHR oldSwapchain
+	) {
+		VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
+		VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes, settings.presentMode);
+		VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities, windowExtent);
+		uint32_t imageCount = chooseImageCount(swapChainSupport.capabilities, settings.swapchainImageCount);
+
+		VkSwapchainCreateInfoKHR createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+		createInfo.surface = surface;
+		createInfo.minImageCount = imageCount;
+		createInfo.imageFormat = surfaceFormat.format;
+		createInfo.imageColorSpace = surfaceFormat.colorSpace;
+		createInfo.imageExtent = extent;
+		// Always 1 unless developing a stereoscopic 3D application
+		createInfo.imageArrayLayers = 1;
+		// We render directly to the images, so they're used as color attachment
+		createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+		// If graphics and presentation are done by different families, the images are
+		//shared between them. Concurrent mode avoids explicit ownership transfers, at
+		//some cost. When they're the same family (most hardware), exclusive is the
+		//fastest option.
+		uint32_t queueFamilyIndices[] = { graphicsFamily, presentFamily };
+		if (graphicsFamily != presentFamily) {
+			createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+			createInfo.queueFamilyIndexCount = 2;
+			createInfo.pQueueFamilyIndices = queueFamilyIndices;
+		}
+		else {
+			createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		}
+
+		// No transform (rotation, flip...) on the images
+		createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+		createInfo.compositeAlpha = chooseCompositeAlpha(swapChainSupport.capabilities.supportedCompositeAlpha);
+		createInfo.presentMode = presentMode;
+		// We don't care about the color of pixels hidden by other windows
+		createInfo.clipped = VK_TRUE;
+		// The swap chain this one replaces, if any. Its images that aren't acquired
+		//are released, the ones we acquired can still be presented.
+		createInfo.oldSwapchain = oldSwapchain;
+
+		if (vkCreateSwapchainKHR(device, &createInfo, allocator, swapChain.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create swap chain!");
+		}
+
+		// We only asked for a minimum amount of images, the implementation is allowed
+		//to create more, so query the actual amount
+		vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
+		swapChainImages.resize(imageCount);
+		vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
+
+		swapChainImageFormat = surfaceFormat.format;
+		swapChainExtent = extent;
+		swapChainPresentMode = presentMode;
+
+		createImageViews();
+
+		std::cout << (oldSwapchain != VK_NULL_HANDLE ? "swap chain recreated: " : "swap chain: ") << imageCount << " images, " << extent.width << "x" << extent.height
+			<< ", present mode " << presentModeName(presentMode)
+			<< " (requested " << presentModeName(settings.presentMode) << ")" << std::endl;
+	}
+
+	// Prefer 8 bit BGRA with sRGB color space, which gives more accurate perceived colors
+	VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
+		// The surface has no preferred format at all, so we're free to choose
+		if (availableFormats.size() == 1 && availableFormats[0].format == VK_FORMAT_UNDEFINED) {
+			return{ VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+		}
+
+		for (const auto& availableFormat : availableFormats) {
+			if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+				return availableFormat;
+			}
+		}
+
+		// Otherwise we could rank the formats, but settling with the first one is fine
+		return availableFormats[0];
+	}
+
+	// The present mode is where latency and throughput are traded. When the requested
+	//mode isn't available we go for the one that keeps its intent best, ending on FIFO,
+	//which is the only mode guaranteed to be available. A mode that tears is only
+	//chosen when tearing was accepted by asking for one.
+	VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes, VkPresentModeKHR requested) {
+		std::vector<VkPresentModeKHR> preference;
+		switch (requested) {
+		case VK_PRESENT_MODE_MAILBOX_KHR:
+			// Never tears, so neither does the fallback: vsync latency it is
+			preference = { VK_PRESENT_MODE_MAILBOX_KHR };
+			break;
+		case VK_PRESENT_MODE_IMMEDIATE_KHR:
+			preference = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR };
+			break;
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+			preference = { VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+			break;
+		default:
+			break;
+		}
+
+		for (VkPresentModeKHR mode : preference) {
+			for (const auto& availablePresentMode : availablePresentModes) {
+				if (availablePresentMode == mode) {
+					return mode;
+				}
+			}
+		}
+
+		return VK_PRESENT_MODE_FIFO_KHR;
+	}
+
+	// The swap extent is the resolution of the swap chain images. Some window managers
+	//set currentExtent to the maximum uint32_t value to indicate that we may pick, in
+	//that case we use the window size within the allowed bounds.
+	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities, VkExtent2D windowExtent) {
+		if (capabilities.currentExtent.width != UINT32_MAX) {
+			return capabilities.currentExtent;
+		}
+
+		VkExtent2D actualExtent = windowExtent;
+		actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
+		actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+
+		return actualExtent;
+	}
+
+	// More images let the GPU run further ahead of presentation (needed for mailbox to
+	//actually drop frames instead of blocking), fewer images mean less queued latency
+	//and memory.
+	uint32_t chooseImageCount(const VkSurfaceCapabilitiesKHR& capabilities, uint32_t requested) {
+		uint32_t imageCount = requested != 0 ? requested : capabilities.minImageCount + 1;
+
+		imageCount = std::max(imageCount, capabilities.minImageCount);
+		// A maximum of 0 means that there is no limit besides memory requirements
+		if (capabilities.maxImageCount > 0) {
+			imageCount = std::min(imageCount, capabilities.maxImageCount);
+		}
+
+		return imageCount;
+	}
+
+	VkCompositeAlphaFlagBitsKHR chooseCompositeAlpha(VkCompositeAlphaFlagsKHR supported) {
+		// We want to ignore the alpha channel when blending with other windows
+		if (supported & VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR) {
+			return VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+		}
+		// Some platforms only offer ways that take the alpha channel into account
+		const VkCompositeAlphaFlagBitsKHR fallbacks[] = {
+			VK_COMPOSITE_ALPHA_INHERIT_BIT_KHR,
+			VK_COMPOSITE_ALPHA_PRE_MULTIPLIED_BIT_KHR,
+			VK_COMPOSITE_ALPHA_POST_MULTIPLIED_BIT_KHR
+		};
+		for (VkCompositeAlphaFlagBitsKHR fallback : fallbacks) {
+			if (supported & fallback) {
+				return fallback;
+			}
+		}
+		return VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+	}
+
+	// One basic 2D color view per swap chain image, without mipmapping or multiple layers
+	// https://vulkan-tutorial.com/Drawing_a_triangle/Presentation/Image_views
+	void createImageViews() {
+		swapChainImageViews.clear();
+		swapChainImageViews.resize(swapChainImages.size());
+
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			VkImageViewCreateInfo createInfo = {};
+			createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			createInfo.image = swapChainImages[i];
+			createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			createInfo.format = swapChainImageFormat;
+			createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+			createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+			createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+			createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+			createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			createInfo.subresourceRange.baseMipLevel = 0;
+			createInfo.subresourceRange.levelCount = 1;
+			createInfo.subresourceRange.baseArrayLayer = 0;
+			createInfo.subresourceRange.layerCount = 1;
+
+			if (vkCreateImageView(device, &createInfo, allocator, swapChainImageViews[i].replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create image views!");
+			}
+		}
+	}
+};
@@ -0,0 +1,643 @@
+#pragma once
+
+// Textures streamed in by mip level, under a memory budget.
+// Textures come from KTX2 files, which store the VkFormat and every mip level the way
+//the GPU wants it, so BC and ASTC data goes into the staging ring untouched. The
+//files are memory mapped and opened on a worker thread, and only the levels that are
+//uploaded are ever read from disk.
+// Every texture keeps its smallest levels (the tail, up to TAIL_SIZE texels) in an
+//image of their own, so there's always something to sample. Draws ask for the most
+//detailed level they need with request(), and the levels from there down go into a
+//second image, created and staged on a worker thread (reading the file there too).
+//Workers never submit or wait for the GPU: when the staging ring is full they stop,
+//and the levels that are left get another worker once the ring has room for them.
+//The frame's flush() submits the copies, and the tail keeps being sampled until they
+//have landed. Replaced images are destroyed once the frames in flight that could
+//still sample them are done, and each image has its own bindless slot, so the slot
+//of a texture changes with its levels.
+// Everything resident, on its way in or waiting to be destroyed counts against the
+//budget: the configured one, and with VK_EXT_memory_budget no more than what the
+//device local heap has left once everyone else's use is counted. When a request
+//doesn't fit, the textures that haven't been asked for the longest drop back to their
+//tails.
+// https://github.khronos.org/KTX-Specification/
+
+#include "VHandle.h"
+#include "BindlessDescriptors.h"
+#include "DeviceMemoryAllocator.h"
+#include "MappedFile.h"
+#include "UploadService.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+typedef uint32_t TextureId;
+
+// The parts of a KTX2 file that we use. Only 2D textures with one layer and face and
+//no supercompression, which is what BC and ASTC encoders write.
+struct KtxTexture {
+	struct Level {
+		uint64_t offset = 0;
+		uint64_t size = 0;
+	};
+
+	std::unique_ptr<MappedFile> file;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	// Level 0 is the most detailed one
+	std::vector<Level> levels;
+
+	static KtxTexture open(const std::string& path) {
+		static const uint8_t IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+		// Identifier, 9 header fields, the data format, key/value and supercompression
+		//indices, then a level index entry per level
+		static const size_t HEADER_SIZE = 80;
+		static const size_t LEVEL_INDEX_ENTRY_SIZE = 24;
+
+		KtxTexture texture;
+		texture.file.reset(new MappedFile(path));
+		const char* data = texture.file->data();
+		size_t size = texture.file->size();
+		if (size < HEADER_SIZE || memcmp(data, IDENTIFIER, sizeof(IDENTIFIER)) != 0) {
+			throw std::runtime_error(path + " is not a KTX2 file!");
+		}
+
+		uint32_t header[9];
+		memcpy(header, data + sizeof(IDENTIFIER), sizeof(header));
+		texture.format = (VkFormat) header[0];
+		texture.width = header[2];
+		texture.height = std::max(header[3], 1u);
+		uint32_t depth = header[4];
+		uint32_t layerCount = header[5];
+		uint32_t faceCount = header[6];
+		// 0 asks the loader to generate the levels, there's just the one then
+		uint32_t levelCount = std::max(header[7], 1u);
+		uint32_t supercompression = header[8];
+		if (texture.format == VK_FORMAT_UNDEFINED || supercompression != 0 || depth > 1 || layerCount > 1 || faceCount != 1 || texture.width == 0) {
+			throw std::runtime_error(path + " is not a plain 2D KTX2 texture!");
+		}
+
+		if (size < HEADER_SIZE + levelCount * LEVEL_INDEX_ENTRY_SIZE) {
+			throw std::runtime_error(path + " is truncated!");
+		}
+		texture.levels.resize(levelCount);
+		for (uint32_t i = 0; i < levelCount; i++) {
+			uint64_t entry[3];
+			memcpy(entry, data + HEADER_SIZE + i * LEVEL_INDEX_ENTRY_SIZE, sizeof(entry));
+			if (entry[0] > size || entry[1] > size - entry[0]) {
+				throw std::runtime_error(path + " is truncated!");
+			}
+			texture.levels[i].offset = entry[0];
+			texture.levels[i].size = entry[1];
+		}
+		return texture;
+	}
+
+	uint32_t levelCount() const {
+		return (uint32_t) levels.size();
+	}
+
+	VkExtent3D extent(uint32_t level) const {
+		return { std::max(width >> level, 1u), std::max(height >> level, 1u), 1 };
+	}
+
+	const char* levelData(uint32_t level) const {
+		return file->data() + levels[level].offset;
+	}
+
+	// Bytes of levels [baseLevel, levelCount), close to what the image will need
+	uint64_t levelsSize(uint32_t baseLevel) const {
+		uint64_t total = 0;
+		for (uint32_t i = baseLevel; i < levelCount(); i++) {
+			total += levels[i].size;
+		}
+		return total;
+	}
+};
+
+class TextureStreamer {
+public:
+	static const uint32_t INVALID_SLOT = BindlessDescriptors::INVALID_SLOT;
+
+	TextureStreamer(const VDevice& device, const VkAllocationCallbacks* allocator, DeviceMemoryAllocator& memoryAllocator,
+		UploadService& uploadService, BindlessDescriptors& bindlessDescriptors)
+		: device(device), allocator(allocator), memoryAllocator(memoryAllocator), uploadService(uploadService), bindlessDescriptors(bindlessDescriptors) {}
+
+	~TextureStreamer() {
+		destroy();
+	}
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// The compressed formats the device can sample are features that have to be
+	//enabled, on top of what is already in enabled
+	static void enableFeatures(const VkPhysicalDeviceFeatures& supported, VkPhysicalDeviceFeatures& enabled) {
+		enabled.textureCompressionBC |= supported.textureCompressionBC;
+		enabled.textureCompressionASTC_LDR |= supported.textureCompressionASTC_LDR;
+		enabled.textureCompressionETC2 |= supported.textureCompressionETC2;
+	}
+
+	// budget is in bytes, 0 means half of the device local heap's budget. The images
+	//are shared between the graphics and transfer families when they differ.
+	void init(VkPhysicalDevice physicalDevice, uint32_t graphicsFamily, uint32_t transferFamily, VkDeviceSize budget, uint32_t framesInFlight) {
+		this->physicalDevice = physicalDevice;
+		this->framesInFlight = framesInFlight;
+		configuredBudget = budget;
+		queueFamilies[0] = graphicsFamily;
+		queueFamilies[1] = transferFamily;
+		heapIndex = memoryAllocator.deviceLocalHeap();
+
+		VkSamplerCreateInfo samplerInfo = {};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = VK_FILTER_LINEAR;
+		samplerInfo.minFilter = VK_FILTER_LINEAR;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+		if (vkCreateSampler(device, &samplerInfo, allocator, textureSampler.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create texture sampler!");
+		}
+		refreshBudget();
+	}
+
+	// Waits for the worker threads. The GPU must be done with the images.
+	void destroy() {
+		for (auto& texture : textures) {
+			if (texture->opening.valid()) {
+				texture->opening.wait();
+			}
+			if (texture->incoming.valid()) {
+				try {
+					texture->incoming.get();
+				}
+				catch (const std::exception&) {
+				}
+			}
+			if (texture->staging) {
+				release(*texture->staging);
+			}
+			if (texture->landing) {
+				release(*texture->landing);
+			}
+			if (texture->tail) {
+				release(*texture->tail);
+			}
+			if (texture->detail) {
+				release(*texture->detail);
+			}
+		}
+		textures.clear();
+		for (auto& residency : retired) {
+			release(*residency);
+		}
+		retired.clear();
+		textureSampler.reset();
+	}
+
+	// Starts opening the file on a worker thread, the texture shows up in a later
+	//update(). Failures are reported there.
+	TextureId load(const std::string& path) {
+		std::unique_ptr<Texture> texture(new Texture());
+		texture->path = path;
+		texture->opening = std::async(std::launch::async, [path] { return KtxTexture::open(path); });
+		textures.push_back(std::move(texture));
+		return (TextureId) textures.size() - 1;
+	}
+
+	// The most detailed level a draw of this frame needs. The finest level asked for
+	//in a frame wins.
+	void request(TextureId id, uint32_t level, uint64_t frameNumber) {
+		Texture& texture = *textures[id];
+		if (texture.lastRequested != frameNumber || level < texture.wantedLevel) {
+			texture.wantedLevel = level;
+		}
+		texture.lastRequested = frameNumber;
+	}
+
+	// The level whose texels are about as big as pixels on screen for a texture that
+	//is pixels wide there, 0 until the file has been opened
+	uint32_t levelFor(TextureId id, float pixels) const {
+		const Texture& texture = *textures[id];
+		if (!texture.isOpen()) {
+			return 0;
+		}
+		uint32_t size = std::max(texture.file.width, texture.file.height);
+		uint32_t level = 0;
+		while (level + 1 < texture.file.levelCount() && (float) (size >> (level + 1)) >= pixels) {
+			level++;
+		}
+		return level;
+	}
+
+	// Bindless slot of the most detailed image that is in, INVALID_SLOT while there
+	//is none (or without bindless descriptors)
+	uint32_t slot(TextureId id) const {
+		const Texture& texture = *textures[id];
+		const Residency* residency = texture.sampled();
+		return residency != nullptr ? residency->slot : INVALID_SLOT;
+	}
+
+	VkImageView imageView(TextureId id) const {
+		const Residency* residency = textures[id]->sampled();
+		return residency != nullptr ? residency->view.get() : VK_NULL_HANDLE;
+	}
+
+	VkSampler sampler() const {
+		return textureSampler;
+	}
+
+	size_t textureCount() const {
+		return textures.size();
+	}
+
+	// Call once per frame, before the bindless descriptors are flushed: takes in the
+	//opened files and the images whose uploads landed, frees the images of frames that
+	//are done, and starts streaming what was requested, most recently requested first.
+	void update(uint64_t frameNumber) {
+		if (frameNumber % BUDGET_REFRESH_FRAMES == 0) {
+			refreshBudget();
+		}
+		while (!retired.empty() && frameNumber >= retired.front()->retiredAt + framesInFlight) {
+			retiredBytes -= retired.front()->size;
+			usedBytes -= retired.front()->size;
+			release(*retired.front());
+			retired.pop_front();
+		}
+
+		std::vector<Texture*> streaming;
+		for (auto& texture : textures) {
+			finishOpening(*texture);
+			finishIncoming(*texture, frameNumber);
+			if (texture->isOpen() && !texture->isStreaming()) {
+				streaming.push_back(texture.get());
+			}
+		}
+		std::sort(streaming.begin(), streaming.end(), [](const Texture* a, const Texture* b) {
+			return a->lastRequested > b->lastRequested;
+		});
+
+		VkDeviceSize streamedBytes = 0;
+		const VkDeviceSize maxStreamedBytes = uploadService.stagingSize() / 4;
+		for (Texture* texture : streaming) {
+			if (streamedBytes >= maxStreamedBytes) {
+				break;
+			}
+			uint32_t target = std::max(texture->wantedLevel, texture->finestLevel);
+			// The tail goes first, without budget: it's what gets sampled otherwise
+			if (!texture->tail) {
+				streamedBytes += startResidency(*texture, texture->tailLevel);
+				continue;
+			}
+			uint32_t current = texture->detail ? texture->detail->baseLevel : texture->tailLevel;
+			if (target >= current || texture->lastRequested + framesInFlight < frameNumber) {
+				continue;
+			}
+
+			VkDeviceSize needed = texture->file.levelsSize(target);
+			while (usedBytes - retiredBytes + needed > budget && evictOne(frameNumber)) {
+			}
+			if (usedBytes + needed > budget) {
+				// Either it'll fit once the evicted images are gone, or not at all
+				stats.waitingForMemory++;
+				continue;
+			}
+			streamedBytes += startResidency(*texture, target);
+		}
+
+		// The budget can shrink under us
+		while (usedBytes - retiredBytes > budget && evictOne(frameNumber)) {
+		}
+	}
+
+	void printStats(std::ostream& out) const {
+		if (textures.empty()) {
+			return;
+		}
+		const double MiB = 1024.0 * 1024.0;
+		uint32_t failed = 0;
+		for (const auto& texture : textures) {
+			failed += texture->failed ? 1 : 0;
+		}
+		out << "textures: " << textures.size() << " (" << failed << " failed), " << peakBytes / MiB << " MiB at most of a "
+			<< budget / MiB << " MiB budget" << (budgetReported ? " (memory budget)" : "") << ", "
+			<< stats.levelsStreamed << " levels (" << stats.bytesStreamed / MiB << " MiB) streamed in, "
+			<< stats.evictions << " evictions, " << stats.waitingForMemory << " requests waited for memory, "
+			<< stats.stagingRetries << " times for staging space" << std::endl;
+	}
+
+private:
+	// Textures at most this many texels wide and high at a level are in their tail
+	static const uint32_t TAIL_SIZE = 64;
+	// Asking the driver for the budget is a couple of microseconds, it changes slowly
+	static const uint64_t BUDGET_REFRESH_FRAMES = 30;
+
+	// One image with levels [baseLevel, levelCount) of a texture
+	struct Residency {
+		VImage image;
+		VImageView view;
+		DeviceAllocation memory;
+		uint32_t baseLevel = 0;
+		VkDeviceSize size = 0;
+		uint32_t slot = INVALID_SLOT;
+		// Levels staged so far, most detailed first, and the upload of the last one
+		uint32_t stagedLevels = 0;
+		UploadTicket ticket = 0;
+		uint64_t retiredAt = 0;
+	};
+
+	struct Texture {
+		std::string path;
+		std::future<KtxTexture> opening;
+		KtxTexture file;
+		bool failed = false;
+		// Levels [tailLevel, levelCount) are the tail. Levels before finestLevel are
+		//too big for the staging ring and aren't streamed.
+		uint32_t tailLevel = 0;
+		uint32_t finestLevel = 0;
+		uint32_t wantedLevel = UINT32_MAX;
+		uint64_t lastRequested = 0;
+		std::unique_ptr<Residency> tail;
+		std::unique_ptr<Residency> detail;
+		// Being created and staged, estimated at incomingBytes until its image exists.
+		//Only the worker of incoming touches it while that runs. Then landing until its
+		//upload has landed.
+		std::unique_ptr<Residency> staging;
+		std::future<void> incoming;
+		VkDeviceSize incomingBytes = 0;
+		std::unique_ptr<Residency> landing;
+
+		bool isOpen() const {
+			return !failed && file.file != nullptr;
+		}
+
+		bool isStreaming() const {
+			return staging || landing;
+		}
+
+		// What draws sample, the detail once it's in
+		const Residency* sampled() const {
+			return detail ? detail.get() : tail.get();
+		}
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+	DeviceMemoryAllocator& memoryAllocator;
+	UploadService& uploadService;
+	BindlessDescriptors& bindlessDescriptors;
+
+	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	uint32_t queueFamilies[2] = {};
+	uint32_t framesInFlight = 1;
+	uint32_t heapIndex = 0;
+	VSampler textureSampler;
+
+	std::vector<std::unique_ptr<Texture>> textures;
+	// Replaced images, oldest first, destroyed framesInFlight frames after that
+	std::deque<std::unique_ptr<Residency>> retired;
+
+	VkDeviceSize configuredBudget = 0;
+	VkDeviceSize budget = 0;
+	bool budgetReported = false;
+	// Everything counted against the budget, and the retired part of it
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize retiredBytes = 0;
+	VkDeviceSize peakBytes = 0;
+
+	struct Stats {
+		uint64_t levelsStreamed = 0;
+		uint64_t bytesStreamed = 0;
+		uint64_t evictions = 0;
+		uint64_t waitingForMemory = 0;
+		uint64_t stagingRetries = 0;
+	};
+	Stats stats;
+
+	// What everyone else uses of the heap stays theirs, and a tenth of what's left is
+	//kept free so the driver doesn't have to start moving things out
+	void refreshBudget() {
+		MemoryHeapBudget heap = memoryAllocator.heapBudget(heapIndex);
+		VkDeviceSize others = heap.usage > usedBytes ? heap.usage - usedBytes : 0;
+		VkDeviceSize available = heap.budget > others ? heap.budget - others : 0;
+		VkDeviceSize limit = configuredBudget != 0 ? configuredBudget : heap.budget / 2;
+		budget = std::min(limit, available - available / 10);
+		budgetReported = heap.reported;
+	}
+
+	void finishOpening(Texture& texture) {
+		if (!texture.opening.valid() || texture.opening.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			return;
+		}
+		try {
+			texture.file = texture.opening.get();
+		}
+		catch (const std::exception& error) {
+			std::cerr << "textures: " << error.what() << std::endl;
+			texture.failed = true;
+			return;
+		}
+
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, texture.file.format, &formatProperties);
+		if ((formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) == 0) {
+			std::cerr << "textures: the device can't sample the format of " << texture.path << " (" << texture.file.format << ")" << std::endl;
+			texture.failed = true;
+			return;
+		}
+
+		uint32_t levelCount = texture.file.levelCount();
+		texture.tailLevel = levelCount - 1;
+		while (texture.tailLevel > 0 && std::max(texture.file.extent(texture.tailLevel - 1).width, texture.file.extent(texture.tailLevel - 1).height) <= TAIL_SIZE) {
+			texture.tailLevel--;
+		}
+		texture.finestLevel = 0;
+		while (texture.finestLevel < texture.tailLevel && texture.file.levels[texture.finestLevel].size > uploadService.stagingSize()) {
+			texture.finestLevel++;
+		}
+	}
+
+	void finishIncoming(Texture& texture, uint64_t frameNumber) {
+		if (texture.incoming.valid() && texture.incoming.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			try {
+				texture.incoming.get();
+				// The estimate becomes the real size
+				if (texture.incomingBytes != 0) {
+					usedBytes = usedBytes - texture.incomingBytes + texture.staging->size;
+					peakBytes = std::max(peakBytes, usedBytes);
+					texture.incomingBytes = 0;
+				}
+			}
+			catch (const std::exception& error) {
+				std::cerr << "textures: " << texture.path << ": " << error.what() << std::endl;
+				usedBytes -= texture.incomingBytes != 0 ? texture.incomingBytes : texture.staging->size;
+				texture.incomingBytes = 0;
+				release(*texture.staging);
+				texture.staging.reset();
+				texture.failed = !texture.tail;
+			}
+		}
+		if (texture.staging && !texture.incoming.valid()) {
+			Residency& staging = *texture.staging;
+			uint32_t level = staging.baseLevel + staging.stagedLevels;
+			if (level == texture.file.levelCount()) {
+				texture.landing = std::move(texture.staging);
+			}
+			// The ring was full, the rest goes in once the next level fits
+			else if (uploadService.hasRoom(texture.file.levels[level].size)) {
+				stats.stagingRetries++;
+				startStaging(texture);
+			}
+		}
+		// Drawn with once the upload has landed
+		if (!texture.landing || !uploadService.isComplete(texture.landing->ticket)) {
+			return;
+		}
+
+		std::unique_ptr<Residency> residency = std::move(texture.landing);
+		if (bindlessDescriptors.isEnabled()) {
+			residency->slot = bindlessDescriptors.addTexture(residency->view, textureSampler);
+		}
+		if (residency->baseLevel == texture.tailLevel && !texture.tail) {
+			texture.tail = std::move(residency);
+			return;
+		}
+		retire(std::move(texture.detail), frameNumber);
+		texture.detail = std::move(residency);
+	}
+
+	// Creates the image for levels [baseLevel, levelCount) and uploads them, on
+	//worker threads. Returns the bytes it will stream.
+	VkDeviceSize startResidency(Texture& texture, uint32_t baseLevel) {
+		VkDeviceSize size = texture.file.levelsSize(baseLevel);
+		texture.incomingBytes = size;
+		usedBytes += size;
+		peakBytes = std::max(peakBytes, usedBytes);
+		stats.levelsStreamed += texture.file.levelCount() - baseLevel;
+		stats.bytesStreamed += size;
+
+		texture.staging.reset(new Residency());
+		texture.staging->baseLevel = baseLevel;
+		startStaging(texture);
+		return size;
+	}
+
+	void startStaging(Texture& texture) {
+		const KtxTexture* file = &texture.file;
+		Residency* residency = texture.staging.get();
+		texture.incoming = std::async(std::launch::async, [this, file, residency] { stageResidency(*file, *residency); });
+	}
+
+	// On a worker thread: creates the image the first time, then stages the levels
+	//that are left until the ring is full
+	void stageResidency(const KtxTexture& file, Residency& residency) {
+		if (!residency.image) {
+			createImage(file, residency);
+		}
+		// Reading the levels from the mapped file is where the disk is touched
+		uint32_t levelCount = file.levelCount() - residency.baseLevel;
+		for (uint32_t i = residency.stagedLevels; i < levelCount; i++) {
+			uint32_t level = residency.baseLevel + i;
+			VkImageSubresourceLayers subresource = {};
+			subresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			subresource.mipLevel = i;
+			subresource.baseArrayLayer = 0;
+			subresource.layerCount = 1;
+			if (!uploadService.tryUploadImage(residency.image, subresource, file.extent(level),
+				file.levelData(level), file.levels[level].size, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, residency.ticket)) {
+				return;
+			}
+			residency.stagedLevels++;
+		}
+	}
+
+	// Whatever this leaves behind when it throws is released by finishIncoming
+	void createImage(const KtxTexture& file, Residency& residency) {
+		uint32_t levelCount = file.levelCount() - residency.baseLevel;
+
+		VkImageCreateInfo imageInfo = {};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = file.format;
+		imageInfo.extent = file.extent(residency.baseLevel);
+		imageInfo.mipLevels = levelCount;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		// Written by the transfer queue, sampled by the graphics queue
+		if (queueFamilies[0] != queueFamilies[1]) {
+			imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			imageInfo.queueFamilyIndexCount = 2;
+			imageInfo.pQueueFamilyIndices = queueFamilies;
+		}
+		else {
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		}
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		if (vkCreateImage(device, &imageInfo, allocator, residency.image.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create texture image!");
+		}
+		residency.memory = memoryAllocator.allocateAndBind(residency.image, VK_IMAGE_TILING_OPTIMAL, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		residency.size = residency.memory.size;
+
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = residency.image;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = file.format;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = levelCount;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		if (vkCreateImageView(device, &viewInfo, allocator, residency.view.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create texture image view!");
+		}
+	}
+
+	// Drops the detail of the texture that was asked for the longest ago, not counting
+	//the ones of this frame. False when there's nothing left to drop.
+	bool evictOne(uint64_t frameNumber) {
+		Texture* oldest = nullptr;
+		for (auto& texture : textures) {
+			if (texture->detail && texture->lastRequested < frameNumber && (oldest == nullptr || texture->lastRequested < oldest->lastRequested)) {
+				oldest = texture.get();
+			}
+		}
+		if (oldest == nullptr) {
+			return false;
+		}
+		retire(std::move(oldest->detail), frameNumber);
+		stats.evictions++;
+		return true;
+	}
+
+	void retire(std::unique_ptr<Residency> residency, uint64_t frameNumber) {
+		if (!residency) {
+			return;
+		}
+		bindlessDescriptors.release(BindlessDescriptors::Textures, residency->slot, frameNumber);
+		residency->slot = INVALID_SLOT;
+		residency->retiredAt = frameNumber;
+		retiredBytes += residency->size;
+		retired.push_back(std::move(residency));
+	}
+
+	void release(Residency& residency) {
+		residency.view.reset();
+		residency.image.reset();
+		memoryAllocator.free(residency.memory);
+	}
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+// Timeline semaphores (VK_KHR_timeline_semaphore, core in Vulkan 1.2): a semaphore
+//with a 64 bit counter instead of a signaled bit. Submissions signal it to a value
+//and wait for it to reach one, and the host can read the counter or wait for a value
+//without a fence.
+// A queue that numbers its submissions 1, 2, 3... and signals the number on one
+//timeline replaces a fence per submission: submission N is done once the counter is
+//at least N, which also says every submission before it is done. Other queues can
+//wait for N on the GPU, where a binary semaphore would need one semaphore per
+//dependency and a fence for the host to know when it can be reused.
+// The instance stays on Vulkan 1.0: the extension only needs
+//VK_KHR_get_physical_device_properties2 to query its feature, and its functions are
+//loaded from the device.
+// https://www.khronos.org/registry/vulkan/specs/1.2-extensions/html/vkspec.html#synchronization-semaphores
+
+#include "VHandle.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+class TimelineSemaphore {
+public:
+	TimelineSemaphore(const VDevice& device, const VkAllocationCallbacks* allocator)
+		: device(device), allocator(allocator) {}
+
+	TimelineSemaphore(const TimelineSemaphore&) = delete;
+	TimelineSemaphore& operator=(const TimelineSemaphore&) = delete;
+
+	static bool isSupported(const VkPhysicalDeviceTimelineSemaphoreFeaturesKHR& supported) {
+		return supported.timelineSemaphore == VK_TRUE;
+	}
+
+	// The feature to chain into VkDeviceCreateInfo, next to the extension
+	static VkPhysicalDeviceTimelineSemaphoreFeaturesKHR enableFeatures() {
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR enabled = {};
+		enabled.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+		enabled.timelineSemaphore = VK_TRUE;
+		return enabled;
+	}
+
+	// Creates the semaphore with its counter at 0. The device needs the extension and
+	//the feature.
+	void init() {
+		getCounterValue = (PFN_vkGetSemaphoreCounterValueKHR) vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+		waitSemaphores = (PFN_vkWaitSemaphoresKHR) vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+		if (getCounterValue == nullptr || waitSemaphores == nullptr) {
+			throw std::runtime_error("failed to load timeline semaphore functions!");
+		}
+
+		VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+		typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+		typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+		typeInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphoreInfo.pNext = &typeInfo;
+		if (vkCreateSemaphore(device, &semaphoreInfo, allocator, semaphore.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create timeline semaphore!");
+		}
+		completedValue = 0;
+	}
+
+	void destroy() {
+		semaphore.reset();
+	}
+
+	bool isEnabled() const {
+		return semaphore != VK_NULL_HANDLE;
+	}
+
+	VkSemaphore handle() const {
+		return semaphore;
+	}
+
+	// Whether the counter has reached value. Only asks the driver when the last answer
+	//was lower.
+	bool isComplete(uint64_t value) {
+		if (value <= completedValue) {
+			return true;
+		}
+		uint64_t counter = 0;
+		if (getCounterValue(device, semaphore, &counter) != VK_SUCCESS) {
+			throw std::runtime_error("failed to read timeline semaphore!");
+		}
+		completedValue = std::max(completedValue, counter);
+		return value <= completedValue;
+	}
+
+	// Blocks until the counter reaches value
+	void wait(uint64_t value) {
+		if (isComplete(value)) {
+			return;
+		}
+
+		VkSemaphoreWaitInfoKHR waitInfo = {};
+		waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+		waitInfo.semaphoreCount = 1;
+		waitInfo.pSemaphores = &semaphore;
+		waitInfo.pValues = &value;
+		if (waitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+			throw std::runtime_error("failed to wait for timeline semaphore!");
+		}
+		completedValue = value;
+		blockingWaits++;
+	}
+
+	// Host waits that had to block, the others were answered by the counter
+	uint64_t blockingWaitCount() const {
+		return blockingWaits;
+	}
+
+private:
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+
+	PFN_vkGetSemaphoreCounterValueKHR getCounterValue = nullptr;
+	PFN_vkWaitSemaphoresKHR waitSemaphores = nullptr;
+	VSemaphore semaphore;
+
+	uint64_t completedValue = 0;
+	uint64_t blockingWaits = 0;
+};
+
+// The semaphores of one VkSubmitInfo, binary and timeline ones mixed. Binary
+//semaphores have no value (it's ignored), timeline ones wait for or signal theirs.
+class SemaphoreSubmit {
+public:
+	void wait(VkSemaphore semaphore, VkPipelineStageFlags stages, uint64_t value = 0) {
+		waitSemaphores.push_back(semaphore);
+		waitStages.push_back(stages);
+		waitValues.push_back(value);
+		hasTimeline |= value != 0;
+	}
+
+	void signal(VkSemaphore semaphore, uint64_t value = 0) {
+		signalSemaphores.push_back(semaphore);
+		signalValues.push_back(value);
+		hasTimeline |= value != 0;
+	}
+
+	// Points submitInfo at the semaphores. With a timeline among them the values are
+	//chained in front of submitInfo's pNext, so this has to outlive the submission.
+	void apply(VkSubmitInfo& submitInfo) {
+		submitInfo.waitSemaphoreCount = (uint32_t) waitSemaphores.size();
+		submitInfo.pWaitSemaphores = waitSemaphores.data();
+		submitInfo.pWaitDstStageMask = waitStages.data();
+		submitInfo.signalSemaphoreCount = (uint32_t) signalSemaphores.size();
+		submitInfo.pSignalSemaphores = signalSemaphores.data();
+		if (!hasTimeline) {
+			return;
+		}
+
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		timelineInfo.waitSemaphoreValueCount = (uint32_t) waitValues.size();
+		timelineInfo.pWaitSemaphoreValues = waitValues.data();
+		timelineInfo.signalSemaphoreValueCount = (uint32_t) signalValues.size();
+		timelineInfo.pSignalSemaphoreValues = signalValues.data();
+		timelineInfo.pNext = submitInfo.pNext;
+		submitInfo.pNext = &timelineInfo;
+	}
+
+private:
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<VkPipelineStageFlags> waitStages;
+	std::vector<uint64_t> waitValues;
+	std::vector<VkSemaphore> signalSemaphores;
+	std::vector<uint64_t> signalValues;
+	bool hasTimeline = false;
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+};
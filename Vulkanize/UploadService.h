@@ -0,0 +1,647 @@
+#pragma once
+
+// Streaming uploads to device local buffers and images.
+// Device local memory is the fastest for the GPU but usually not visible to the host,
+//so data goes through a staging buffer the host can write to, and a transfer command
+//copies it over. The tutorial does that with a staging buffer per upload and a
+//vkQueueWaitIdle after every copy. Here the staging memory is one persistently
+//mapped ring buffer, copies are collected and submitted in batches on the transfer
+//queue, and every upload gets a ticket that can be polled (or waited on) instead of
+//stalling the queue.
+// With timeline semaphores a batch signals its ticket on the service's timeline:
+//no fence per batch, and other queues can wait for a ticket on the GPU.
+// https://vulkan-tutorial.com/Vertex_buffers/Staging_buffer
+
+#include "VHandle.h"
+#include "DeviceMemoryAllocator.h"
+#include "StatsRegistry.h"
+#include "TimelineSemaphore.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// Identifies the batch an upload was submitted in. Tickets grow by one with every
+//batch, so a ticket is complete once all batches up to it are.
+typedef uint64_t UploadTicket;
+
+class UploadService {
+public:
+	UploadService(const VDevice& device, const VkAllocationCallbacks* allocator, DeviceMemoryAllocator& memoryAllocator)
+		: device(device), allocator(allocator), memoryAllocator(memoryAllocator), timeline(device, allocator) {}
+
+	~UploadService() {
+		destroy();
+	}
+
+	UploadService(const UploadService&) = delete;
+	UploadService& operator=(const UploadService&) = delete;
+
+	// Creates the staging ring and the command pool for the queue the copies are
+	//submitted to (the transfer queue, which may be the graphics queue on devices
+	//without a dedicated one). timelineSemaphore needs VK_KHR_timeline_semaphore on
+	//the device, batches get a fence each without it.
+	void init(uint32_t queueFamily, VkQueue queue, bool timelineSemaphore, VkDeviceSize ringSize = 32 * 1024 * 1024) {
+		this->queue = queue;
+		this->ringSize = ringSize;
+		if (timelineSemaphore) {
+			timeline.init();
+		}
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = ringSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		if (vkCreateBuffer(device, &bufferInfo, allocator, stagingBuffer.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create staging buffer!");
+		}
+		// Coherent memory saves the flushes, but isn't required
+		stagingMemory = memoryAllocator.allocateAndBind(stagingBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+		// Command buffers are reused batch after batch, each reset on its own
+		VkCommandPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.queueFamilyIndex = queueFamily;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+		if (vkCreateCommandPool(device, &poolInfo, allocator, commandPool.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload command pool!");
+		}
+	}
+
+	// The GPUs of a device group that the copies run on, 0 when there's no group
+	void setDeviceMask(uint32_t mask) {
+		deviceMask = mask;
+	}
+
+	// Waits for the uploads in flight and releases everything. Called by the
+	//destructor, which makes the service safe to declare after the device and the
+	//memory allocator.
+	void destroy() {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto& batch : batches) {
+			if (batch->inFlight) {
+				waitForBatch(*batch);
+			}
+		}
+		batches.clear();
+		inFlight.clear();
+		timeline.destroy();
+		commandPool.reset();
+		stagingBuffer.reset();
+		memoryAllocator.free(stagingMemory);
+	}
+
+	// Copies size bytes from data into the staging ring right away (data can be
+	//reused as soon as this returns) and queues a copy to dst at dstOffset. The copy is
+	//submitted with the next flush(), the ticket tells when it has landed.
+	// Uploads bigger than the ring are split up. When the ring is full this submits
+	//and waits for the GPU itself, so like flush() it's for the thread that submits to
+	//the queue. Other threads use tryUploadImage.
+	UploadTicket uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// Leave room for a batch of other uploads while a big one streams through
+		const VkDeviceSize maxChunk = ringSize / 2;
+		const char* bytes = (const char*) data;
+		for (VkDeviceSize done = 0; done < size; ) {
+			VkDeviceSize chunk = std::min(size - done, maxChunk);
+			VkDeviceSize stagingOffset = stage(bytes + done, chunk);
+
+			PendingBufferCopy copy;
+			copy.dst = dst;
+			copy.region.srcOffset = stagingOffset;
+			copy.region.dstOffset = dstOffset + done;
+			copy.region.size = chunk;
+			pendingBufferCopies.push_back(copy);
+
+			done += chunk;
+		}
+
+		stats.uploads++;
+		stats.bytes += size;
+		return nextTicket;
+	}
+
+	// Uploads tightly packed texel data into one mip level (and its layers) of an
+	//image. The image is moved from UNDEFINED (its old contents are thrown away) to
+	//TRANSFER_DST for the copy and left in finalLayout. Must fit in the ring. Submits
+	//and waits when the ring is full, like uploadBuffer.
+	UploadTicket uploadImage(
+		VkImage dst,
+		const VkImageSubresourceLayers& subresource,
+		VkExtent3D extent,
+		const void* data,
+		VkDeviceSize size,
+		VkImageLayout finalLayout
+	) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (size > ringSize) {
+			throw std::runtime_error("image upload is bigger than the staging ring!");
+		}
+		queueImageCopy(dst, subresource, extent, stage(data, size), size, finalLayout);
+		return nextTicket;
+	}
+
+	// uploadImage for any thread: it never submits and never waits for the GPU. False
+	//when the ring has no room for the data right now, nothing is queued then. The room
+	//comes back once flush() has submitted what's queued and the GPU is done with it, so
+	//try again after hasRoom says so.
+	bool tryUploadImage(
+		VkImage dst,
+		const VkImageSubresourceLayers& subresource,
+		VkExtent3D extent,
+		const void* data,
+		VkDeviceSize size,
+		VkImageLayout finalLayout,
+		UploadTicket& ticket
+	) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (size > ringSize) {
+			throw std::runtime_error("image upload is bigger than the staging ring!");
+		}
+		uint64_t position = 0;
+		if (!reserve(size, position)) {
+			stats.ringFull++;
+			return false;
+		}
+		queueImageCopy(dst, subresource, extent, write(data, size, position), size, finalLayout);
+		ticket = nextTicket;
+		return true;
+	}
+
+	// Whether size bytes would fit in the ring now. Only asks, the ring stays as it is:
+	//batches that are done count as in use until isComplete, isUsable or an upload
+	//retires them.
+	bool hasRoom(VkDeviceSize size) {
+		std::lock_guard<std::mutex> lock(mutex);
+		uint64_t position = 0;
+		return size <= ringSize && fits(size, position);
+	}
+
+	// Submits everything queued since the last flush as one batch and returns its
+	//ticket. Cheap when there is nothing to submit, so it can be called every frame.
+	// Submits to the queue given to init: when that's the graphics queue too, call it
+	//from the thread that submits the frames.
+	UploadTicket flush() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return submitPending();
+	}
+
+	// Whether the uploads of the ticket have landed. Never blocks.
+	bool isComplete(UploadTicket ticket) {
+		std::lock_guard<std::mutex> lock(mutex);
+		retireCompleted();
+		return ticket <= completedTicket;
+	}
+
+	// Whether a submission made now can use the uploads of the ticket: once they've
+	//landed, or with a timeline as soon as they're submitted, if the submission waits
+	//for them with addGpuWait
+	bool isUsable(UploadTicket ticket) {
+		std::lock_guard<std::mutex> lock(mutex);
+		retireCompleted();
+		if (timeline.isEnabled()) {
+			return ticket < nextTicket;
+		}
+		return ticket <= completedTicket;
+	}
+
+	// Has the submission wait for the uploads of the ticket at stages, on the GPU.
+	//Nothing is added when they've landed already, or without a timeline (isUsable
+	//only says yes once they have then).
+	void addGpuWait(UploadTicket ticket, SemaphoreSubmit& submit, VkPipelineStageFlags stages) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!timeline.isEnabled() || ticket >= nextTicket || timeline.isComplete(ticket)) {
+			return;
+		}
+		submit.wait(timeline.handle(), stages, ticket);
+		stats.gpuWaits++;
+	}
+
+	// Blocks until the uploads of the ticket have landed, submitting them first if
+	//they are still queued
+	void wait(UploadTicket ticket) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (ticket >= nextTicket) {
+			submitPending();
+		}
+		while (ticket > completedTicket && !inFlight.empty()) {
+			retireOldest();
+		}
+	}
+
+	// The biggest single image upload
+	VkDeviceSize stagingSize() const {
+		return ringSize;
+	}
+
+	// Batches submitted to the transfer queue, readable from any thread
+	const StatsCounter& submitCounter() const {
+		return submits;
+	}
+
+	void printStats(std::ostream& out) const {
+		out << "uploads: " << stats.uploads << " (" << stats.bytes << " bytes) in " << stats.batches << " batches, "
+			<< stats.ringStalls << " waits for staging space and " << stats.ringFull << " uploads put off (ring of " << ringSize << " bytes)";
+		if (timeline.isEnabled()) {
+			out << ", " << stats.gpuWaits << " waits on the GPU, " << timeline.blockingWaitCount() << " on the host";
+		}
+		out << std::endl;
+	}
+
+private:
+	// vkCmdCopyBufferToImage needs the buffer offset to be a multiple of 4 and of
+	//the texel block size, 16 covers the compressed formats and all power of two
+	//texel sizes
+	static const VkDeviceSize COPY_ALIGNMENT = 16;
+
+	struct PendingBufferCopy {
+		VkBuffer dst;
+		VkBufferCopy region;
+	};
+
+	struct PendingImageCopy {
+		VkImage dst;
+		VkBufferImageCopy region;
+		VkImageLayout finalLayout;
+	};
+
+	struct Batch {
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		// Only without a timeline
+		VFence fence;
+		UploadTicket ticket = 0;
+		// Ring position right after the batch's staging data, the ring is free up to
+		//there once the batch completes
+		uint64_t ringEnd = 0;
+		bool inFlight = false;
+	};
+
+	struct Stats {
+		uint64_t uploads = 0;
+		uint64_t bytes = 0;
+		uint64_t batches = 0;
+		uint64_t ringStalls = 0;
+		uint64_t ringFull = 0;
+		uint64_t gpuWaits = 0;
+	};
+
+	const VDevice& device;
+	const VkAllocationCallbacks* allocator;
+	DeviceMemoryAllocator& memoryAllocator;
+
+	VkQueue queue = VK_NULL_HANDLE;
+	uint32_t deviceMask = 0;
+	VCommandPool commandPool;
+	// Counts the submitted batches by their tickets, when enabled
+	TimelineSemaphore timeline;
+	StatsCounter submits;
+
+	VBuffer stagingBuffer;
+	DeviceAllocation stagingMemory;
+	VkDeviceSize ringSize = 0;
+	// Positions in the ring only ever grow, the offset in the buffer is position %
+	//ringSize. Everything between tail and head is still needed by queued or in flight
+	//copies.
+	uint64_t ringHead = 0;
+	uint64_t ringTail = 0;
+
+	std::vector<PendingBufferCopy> pendingBufferCopies;
+	std::vector<PendingImageCopy> pendingImageCopies;
+
+	// Batches are recycled, at most as many exist as were ever in flight at once
+	std::vector<std::unique_ptr<Batch>> batches;
+	// Submitted batches, oldest first
+	std::deque<Batch*> inFlight;
+
+	// Ticket the queued uploads will get, and the newest one that completed
+	UploadTicket nextTicket = 1;
+	UploadTicket completedTicket = 0;
+
+	Stats stats;
+
+	// Uploads can come from any thread
+	std::mutex mutex;
+
+	static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	bool hasPending() const {
+		return !pendingBufferCopies.empty() || !pendingImageCopies.empty();
+	}
+
+	// Where size bytes would go in the ring, and whether they fit there. Changes
+	//nothing.
+	bool fits(VkDeviceSize size, uint64_t& position) const {
+		position = alignUp(ringHead, COPY_ALIGNMENT);
+		// A copy can't wrap around the end of the buffer, skip to the start
+		if (position % ringSize + size > ringSize) {
+			position = alignUp(position, ringSize);
+		}
+		if (position + size - ringTail <= ringSize) {
+			return true;
+		}
+		if (inFlight.empty() && !hasPending()) {
+			// Nothing uses the ring anymore, it can start over at its beginning
+			position = alignUp(ringHead, ringSize);
+			return true;
+		}
+		return false;
+	}
+
+	// Finds the ring position for size bytes, after the batches that are done have
+	//given their space back. False when the ring is full, never blocks.
+	bool reserve(VkDeviceSize size, uint64_t& position) {
+		retireCompleted();
+		if (!fits(size, position)) {
+			return false;
+		}
+		// With nothing in the ring, everything before the position is free
+		if (inFlight.empty() && !hasPending()) {
+			ringTail = position;
+		}
+		return true;
+	}
+
+	// Copies data in at a reserved position and returns its offset in the staging
+	//buffer
+	VkDeviceSize write(const void* data, VkDeviceSize size, uint64_t position) {
+		VkDeviceSize offset = position % ringSize;
+		memcpy((char*) stagingMemory.mapped + offset, data, (size_t) size);
+		memoryAllocator.flush(stagingMemory, offset, size);
+
+		ringHead = position + size;
+		return offset;
+	}
+
+	// Reserves size bytes of the ring, copies data in and returns its offset in the
+	//staging buffer. Submits and waits for older batches if the ring is full.
+	VkDeviceSize stage(const void* data, VkDeviceSize size) {
+		uint64_t position = 0;
+		while (!reserve(size, position)) {
+			// The space is held by copies that haven't even been submitted
+			if (inFlight.empty()) {
+				submitPending();
+			}
+			stats.ringStalls++;
+			retireOldest();
+		}
+		return write(data, size, position);
+	}
+
+	void queueImageCopy(
+		VkImage dst,
+		const VkImageSubresourceLayers& subresource,
+		VkExtent3D extent,
+		VkDeviceSize stagingOffset,
+		VkDeviceSize size,
+		VkImageLayout finalLayout
+	) {
+		PendingImageCopy copy;
+		copy.dst = dst;
+		copy.finalLayout = finalLayout;
+		copy.region.bufferOffset = stagingOffset;
+		copy.region.bufferRowLength = 0;
+		copy.region.bufferImageHeight = 0;
+		copy.region.imageSubresource = subresource;
+		copy.region.imageOffset = { 0, 0, 0 };
+		copy.region.imageExtent = extent;
+		pendingImageCopies.push_back(copy);
+
+		stats.uploads++;
+		stats.bytes += size;
+	}
+
+	Batch* acquireBatch() {
+		for (auto& batch : batches) {
+			if (!batch->inFlight) {
+				return batch.get();
+			}
+		}
+
+		std::unique_ptr<Batch> batch(new Batch());
+
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device, &allocInfo, &batch->commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate upload command buffer!");
+		}
+
+		if (!timeline.isEnabled()) {
+			VkFenceCreateInfo fenceInfo = {};
+			fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			if (vkCreateFence(device, &fenceInfo, allocator, batch->fence.replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create upload fence!");
+			}
+		}
+
+		batches.push_back(std::move(batch));
+		return batches.back().get();
+	}
+
+	UploadTicket submitPending() {
+		if (!hasPending()) {
+			return nextTicket - 1;
+		}
+
+		Batch* batch = acquireBatch();
+		vkResetCommandBuffer(batch->commandBuffer, 0);
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		if (vkBeginCommandBuffer(batch->commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording upload command buffer!");
+		}
+
+		recordBufferCopies(batch->commandBuffer);
+		recordImageCopies(batch->commandBuffer);
+
+		if (vkEndCommandBuffer(batch->commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record upload command buffer!");
+		}
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &batch->commandBuffer;
+
+		// In a device group every GPU has its own instance of the destination, so the
+		//copies run on all of them
+		VkDeviceGroupSubmitInfoKHR deviceGroupInfo = {};
+		deviceGroupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO_KHR;
+		deviceGroupInfo.commandBufferCount = 1;
+		deviceGroupInfo.pCommandBufferDeviceMasks = &deviceMask;
+		if (deviceMask != 0) {
+			submitInfo.pNext = &deviceGroupInfo;
+		}
+
+		SemaphoreSubmit semaphores;
+		if (timeline.isEnabled()) {
+			semaphores.signal(timeline.handle(), nextTicket);
+		}
+		semaphores.apply(submitInfo);
+
+		if (vkQueueSubmit(queue, 1, &submitInfo, timeline.isEnabled() ? VK_NULL_HANDLE : batch->fence.get()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit uploads!");
+		}
+
+		batch->ticket = nextTicket++;
+		batch->ringEnd = ringHead;
+		batch->inFlight = true;
+		inFlight.push_back(batch);
+		stats.batches++;
+		submits.add();
+
+		pendingBufferCopies.clear();
+		pendingImageCopies.clear();
+		return batch->ticket;
+	}
+
+	// Consecutive copies to the same buffer go into one vkCmdCopyBuffer. A region
+	//that overlaps an earlier one of the same command starts a new command, so later
+	//uploads still win.
+	void recordBufferCopies(VkCommandBuffer commandBuffer) {
+		std::vector<VkBufferCopy> regions;
+		VkBuffer dst = VK_NULL_HANDLE;
+
+		auto emit = [&]() {
+			if (!regions.empty()) {
+				vkCmdCopyBuffer(commandBuffer, stagingBuffer, dst, (uint32_t) regions.size(), regions.data());
+				regions.clear();
+			}
+		};
+
+		for (const auto& copy : pendingBufferCopies) {
+			bool overlaps = false;
+			if (copy.dst == dst) {
+				for (const auto& region : regions) {
+					if (copy.region.dstOffset < region.dstOffset + region.size && region.dstOffset < copy.region.dstOffset + copy.region.size) {
+						overlaps = true;
+						break;
+					}
+				}
+			}
+			if (copy.dst != dst || overlaps) {
+				emit();
+				dst = copy.dst;
+			}
+			regions.push_back(copy.region);
+		}
+		emit();
+	}
+
+	// All layout transitions to TRANSFER_DST in one barrier, the copies, then all
+	//transitions to the final layouts in another
+	void recordImageCopies(VkCommandBuffer commandBuffer) {
+		if (pendingImageCopies.empty()) {
+			return;
+		}
+
+		std::vector<VkImageMemoryBarrier> barriers;
+		for (const auto& copy : pendingImageCopies) {
+			barriers.push_back(imageBarrier(copy, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT));
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+			0, nullptr, 0, nullptr, (uint32_t) barriers.size(), barriers.data());
+
+		for (const auto& copy : pendingImageCopies) {
+			vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, copy.dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy.region);
+		}
+
+		// Whoever uses the images waits for the ticket first, which makes the writes
+		//visible, so no destination access here (a transfer queue couldn't name the
+		//shader stages anyway)
+		barriers.clear();
+		for (const auto& copy : pendingImageCopies) {
+			barriers.push_back(imageBarrier(copy, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copy.finalLayout, VK_ACCESS_TRANSFER_WRITE_BIT, 0));
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, 0, nullptr, (uint32_t) barriers.size(), barriers.data());
+	}
+
+	static VkImageMemoryBarrier imageBarrier(
+		const PendingImageCopy& copy,
+		VkImageLayout oldLayout,
+		VkImageLayout newLayout,
+		VkAccessFlags srcAccessMask,
+		VkAccessFlags dstAccessMask
+	) {
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = srcAccessMask;
+		barrier.dstAccessMask = dstAccessMask;
+		barrier.oldLayout = oldLayout;
+		barrier.newLayout = newLayout;
+		// Images shared between the transfer and graphics families are created with
+		//VK_SHARING_MODE_CONCURRENT, so there is no ownership to transfer
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = copy.dst;
+		barrier.subresourceRange.aspectMask = copy.region.imageSubresource.aspectMask;
+		barrier.subresourceRange.baseMipLevel = copy.region.imageSubresource.mipLevel;
+		barrier.subresourceRange.levelCount = 1;
+		barrier.subresourceRange.baseArrayLayer = copy.region.imageSubresource.baseArrayLayer;
+		barrier.subresourceRange.layerCount = copy.region.imageSubresource.layerCount;
+		return barrier;
+	}
+
+	bool isDone(const Batch& batch) {
+		if (timeline.isEnabled()) {
+			return timeline.isComplete(batch.ticket);
+		}
+		return vkGetFenceStatus(device, batch.fence) == VK_SUCCESS;
+	}
+
+	void waitForBatch(const Batch& batch) {
+		if (timeline.isEnabled()) {
+			timeline.wait(batch.ticket);
+		}
+		else {
+			vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+		}
+	}
+
+	void retire(Batch* batch) {
+		if (!timeline.isEnabled()) {
+			vkResetFences(device, 1, &batch->fence);
+		}
+		completedTicket = batch->ticket;
+		ringTail = batch->ringEnd;
+		batch->inFlight = false;
+	}
+
+	// Batches complete in submission order, stop at the first one that isn't done
+	void retireCompleted() {
+		while (!inFlight.empty() && isDone(*inFlight.front())) {
+			retire(inFlight.front());
+			inFlight.pop_front();
+		}
+	}
+
+	void retireOldest() {
+		if (inFlight.empty()) {
+			return;
+		}
+		waitForBatch(*inFlight.front());
+		retire(inFlight.front());
+		inFlight.pop_front();
+	}
+};
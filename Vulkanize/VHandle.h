@@ -0,0 +1,197 @@
+#pragma once
+
+//Vulkan functions, structures and enumerations
+#include <vulkan/vulkan.h>
+// std::addressof, operator& is taken by the wrappers
+#include <memory>
+
+// Wrappers to allow automatic Vulkan Object cleanup.
+// The destroy function is a template parameter, so there is nothing to call through
+//at runtime: a wrapper is just the handle, its parent (instance or device) and the
+//host allocator it was created with. They can be moved but not copied, which means
+//they can live in std::vector and be passed around without ever destroying an
+//object twice.
+
+//vkDestroyXXX(object, callbacks)
+// Objects without a parent: the instance and the logical device
+template <typename T, void (VKAPI_PTR *Destroy)(T, const VkAllocationCallbacks*)>
+class VRootHandle {
+public:
+	VRootHandle() = default;
+
+	// Takes ownership of an object that was created with the given allocator
+	VRootHandle(T object, const VkAllocationCallbacks* allocator = nullptr)
+		: object(object), allocator(allocator) {}
+
+	// When the wrapped object goes out of scope, the destructor is invoked, which in
+	//turn calls the cleanup function of the type.
+	~VRootHandle() {
+		reset();
+	}
+
+	VRootHandle(const VRootHandle&) = delete;
+	VRootHandle& operator=(const VRootHandle&) = delete;
+
+	// Moving leaves the other wrapper empty
+	VRootHandle(VRootHandle&& other) noexcept
+		: object(other.object), allocator(other.allocator) {
+		other.object = VK_NULL_HANDLE;
+	}
+
+	VRootHandle& operator=(VRootHandle&& other) noexcept {
+		if (this != std::addressof(other)) {
+			reset();
+			object = other.object;
+			allocator = other.allocator;
+			other.object = VK_NULL_HANDLE;
+		}
+		return *this;
+	}
+
+	// The address-of operator returns a constant pointer to make sure that the object
+	//within the wrapper is not unexpectedly changed...
+	const T* operator &() const {
+		return &object;
+	}
+
+	// ... if you want to replace the handle within the wrapper through a pointer,
+	//then you should use the replace() function instead. It destroys the existing
+	//object, so you can safely overwrite it afterwards. Objects must be destroyed with
+	//the same host allocator they were created with, so pass the callbacks that are
+	//given to vkCreateXXX (nullptr is the driver's own allocator).
+	T* replace(const VkAllocationCallbacks* allocator = nullptr) {
+		reset();
+		this->allocator = allocator;
+		return &object;
+	}
+
+	// Destroys the object now instead of when the wrapper goes away
+	void reset() {
+		if (object != VK_NULL_HANDLE) {
+			Destroy(object, allocator);
+		}
+		object = VK_NULL_HANDLE;
+	}
+
+	// Gives up ownership, the caller has to destroy the object
+	T release() {
+		T released = object;
+		object = VK_NULL_HANDLE;
+		return released;
+	}
+
+	T get() const {
+		return object;
+	}
+
+	operator T() const {
+		return object;
+	}
+
+private:
+	T object = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocator = nullptr;
+};
+
+//vkDestroyXXX(parent, object, callbacks)
+// Everything else needs the VkInstance or VkDevice it was created from. The parent
+//is stored next to the handle (the parent wrapper has to outlive it, as before).
+template <typename T, typename Parent, void (VKAPI_PTR *Destroy)(Parent, T, const VkAllocationCallbacks*)>
+class VHandle {
+public:
+	VHandle() = default;
+
+	VHandle(Parent parent, T object, const VkAllocationCallbacks* allocator = nullptr)
+		: object(object), parent(parent), allocator(allocator) {}
+
+	~VHandle() {
+		reset();
+	}
+
+	VHandle(const VHandle&) = delete;
+	VHandle& operator=(const VHandle&) = delete;
+
+	VHandle(VHandle&& other) noexcept
+		: object(other.object), parent(other.parent), allocator(other.allocator) {
+		other.object = VK_NULL_HANDLE;
+	}
+
+	VHandle& operator=(VHandle&& other) noexcept {
+		if (this != std::addressof(other)) {
+			reset();
+			object = other.object;
+			parent = other.parent;
+			allocator = other.allocator;
+			other.object = VK_NULL_HANDLE;
+		}
+		return *this;
+	}
+
+	const T* operator &() const {
+		return &object;
+	}
+
+	// Same as VRootHandle::replace, plus the parent the new object is created from
+	T* replace(Parent parent, const VkAllocationCallbacks* allocator = nullptr) {
+		reset();
+		this->parent = parent;
+		this->allocator = allocator;
+		return &object;
+	}
+
+	void reset() {
+		if (object != VK_NULL_HANDLE) {
+			Destroy(parent, object, allocator);
+		}
+		object = VK_NULL_HANDLE;
+	}
+
+	T release() {
+		T released = object;
+		object = VK_NULL_HANDLE;
+		return released;
+	}
+
+	T get() const {
+		return object;
+	}
+
+	Parent getParent() const {
+		return parent;
+	}
+
+	operator T() const {
+		return object;
+	}
+
+private:
+	T object = VK_NULL_HANDLE;
+	Parent parent = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocator = nullptr;
+};
+
+// Wrapped versions of the objects we use
+using VInstance = VRootHandle<VkInstance, vkDestroyInstance>;
+using VDevice = VRootHandle<VkDevice, vkDestroyDevice>;
+
+using VSurface = VHandle<VkSurfaceKHR, VkInstance, vkDestroySurfaceKHR>;
+
+using VSwapchain = VHandle<VkSwapchainKHR, VkDevice, vkDestroySwapchainKHR>;
+using VImage = VHandle<VkImage, VkDevice, vkDestroyImage>;
+using VImageView = VHandle<VkImageView, VkDevice, vkDestroyImageView>;
+using VBuffer = VHandle<VkBuffer, VkDevice, vkDestroyBuffer>;
+using VBufferView = VHandle<VkBufferView, VkDevice, vkDestroyBufferView>;
+using VSampler = VHandle<VkSampler, VkDevice, vkDestroySampler>;
+using VRenderPass = VHandle<VkRenderPass, VkDevice, vkDestroyRenderPass>;
+using VFramebuffer = VHandle<VkFramebuffer, VkDevice, vkDestroyFramebuffer>;
+using VShaderModule = VHandle<VkShaderModule, VkDevice, vkDestroyShaderModule>;
+using VPipelineCache = VHandle<VkPipelineCache, VkDevice, vkDestroyPipelineCache>;
+using VPipelineLayout = VHandle<VkPipelineLayout, VkDevice, vkDestroyPipelineLayout>;
+using VPipeline = VHandle<VkPipeline, VkDevice, vkDestroyPipeline>;
+using VDescriptorSetLayout = VHandle<VkDescriptorSetLayout, VkDevice, vkDestroyDescriptorSetLayout>;
+using VDescriptorPool = VHandle<VkDescriptorPool, VkDevice, vkDestroyDescriptorPool>;
+using VCommandPool = VHandle<VkCommandPool, VkDevice, vkDestroyCommandPool>;
+using VQueryPool = VHandle<VkQueryPool, VkDevice, vkDestroyQueryPool>;
+using VSemaphore = VHandle<VkSemaphore, VkDevice, vkDestroySemaphore>;
+using VFence = VHandle<VkFence, VkDevice, vkDestroyFence>;
+using VEvent = VHandle<VkEvent, VkDevice, vkDestroyEvent>;
@@ -0,0 +1,404 @@
+#pragma once
+
+// Validation layer messages through VK_EXT_debug_utils, without slowing down the
+//threads that trigger them.
+// The layers call the messenger callback synchronously, on whatever thread made the
+//Vulkan call: the render thread, a recording worker, the upload service. Writing to
+//std::cerr right there stalls that thread on console I/O, and a message that fires
+//every frame quickly turns into most of the frame time. So the callback only copies
+//the message into a fixed size lock-free queue and returns, and a thread of our own
+//prints the messages a few milliseconds later.
+// The same message tends to repeat every frame. Each message id gets a budget of
+//repeatLimit messages per second: past it the callback only counts (without even
+//touching the queue) and once per second the printing thread says how many were
+//skipped. If the queue is full the message is dropped and counted as well.
+// Objects can be given names, which the layers then use in their messages.
+// https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#debugging-debug-utils
+
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Proxy functions to find the extension functions, declared like the real Vulkan
+//functions so the destroy one can be the destroy function of a VHandle
+inline VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pMessenger) {
+	auto func = (PFN_vkCreateDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
+	if (func != nullptr) {
+		return func(instance, pCreateInfo, pAllocator, pMessenger);
+	}
+	return VK_ERROR_EXTENSION_NOT_PRESENT;
+}
+
+inline VKAPI_ATTR void VKAPI_CALL DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT messenger, const VkAllocationCallbacks* pAllocator) {
+	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+	if (func != nullptr) {
+		func(instance, messenger, pAllocator);
+	}
+}
+
+class ValidationMessenger {
+public:
+	// repeatLimit is how many messages with the same id are printed per second
+	explicit ValidationMessenger(uint32_t repeatLimit)
+		: repeatLimit(std::max(1u, repeatLimit)), slots(new Slot[QUEUE_SIZE]) {
+		for (uint32_t i = 0; i < QUEUE_SIZE; i++) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		for (auto& counter : budgetUsed) {
+			counter.store(0, std::memory_order_relaxed);
+		}
+		for (auto& counter : skipped) {
+			counter.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// Prints what's still queued. Destroy it after the instance: the instance's own
+	//messages (see messengerCreateInfo) can come until vkDestroyInstance returns.
+	~ValidationMessenger() {
+		stop();
+	}
+
+	ValidationMessenger(const ValidationMessenger&) = delete;
+	ValidationMessenger& operator=(const ValidationMessenger&) = delete;
+
+	// The validation layer to enable: VK_LAYER_KHRONOS_validation, or the older
+	//LunarG meta layer on SDKs that don't have it yet. nullptr if neither is installed.
+	static const char* findLayer() {
+		uint32_t layerCount = 0;
+		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+		std::vector<VkLayerProperties> layers(layerCount);
+		vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+
+		for (const char* candidate : { "VK_LAYER_KHRONOS_validation", "VK_LAYER_LUNARG_standard_validation" }) {
+			for (const auto& layer : layers) {
+				if (strcmp(layer.layerName, candidate) == 0) {
+					return candidate;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	// VK_EXT_debug_utils comes from the loader or from the layer itself
+	static bool isDebugUtilsAvailable(const char* layer) {
+		for (const char* source : { (const char*) nullptr, layer }) {
+			uint32_t extensionCount = 0;
+			vkEnumerateInstanceExtensionProperties(source, &extensionCount, nullptr);
+			std::vector<VkExtensionProperties> extensions(extensionCount);
+			vkEnumerateInstanceExtensionProperties(source, &extensionCount, extensions.data());
+			for (const auto& extension : extensions) {
+				if (strcmp(extension.extensionName, VK_EXT_DEBUG_UTILS_EXTENSION_NAME) == 0) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Starts the printing thread. Call it before the instance is created.
+	void start() {
+		if (printer.joinable()) {
+			return;
+		}
+		running = true;
+		printer = std::thread(&ValidationMessenger::printLoop, this);
+	}
+
+	// For vkCreateDebugUtilsMessengerEXT, and for VkInstanceCreateInfo::pNext: chained
+	//there, it reports the messages of vkCreateInstance and vkDestroyInstance, which
+	//happen while no messenger object exists. Verbose adds the info and verbose
+	//severities to warnings and errors.
+	VkDebugUtilsMessengerCreateInfoEXT messengerCreateInfo(bool verbose) {
+		VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
+		createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+		createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		if (verbose) {
+			createInfo.messageSeverity |= VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT;
+		}
+		createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+		createInfo.pfnUserCallback = callback;
+		createInfo.pUserData = this;
+		return createInfo;
+	}
+
+	// Loads vkSetDebugUtilsObjectNameEXT, once the instance has VK_EXT_debug_utils.
+	//Names are ignored until then.
+	void loadObjectNaming(VkInstance instance) {
+		setObjectNameFunction = (PFN_vkSetDebugUtilsObjectNameEXT) vkGetInstanceProcAddr(instance, "vkSetDebugUtilsObjectNameEXT");
+	}
+
+	// Names an object, so messages about it say which one it is. The name is copied.
+	void setObjectName(VkDevice device, VkObjectType type, uint64_t handle, const char* name) const {
+		if (setObjectNameFunction == nullptr || handle == 0) {
+			return;
+		}
+		VkDebugUtilsObjectNameInfoEXT nameInfo = {};
+		nameInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_OBJECT_NAME_INFO_EXT;
+		nameInfo.objectType = type;
+		nameInfo.objectHandle = handle;
+		nameInfo.pObjectName = name;
+		setObjectNameFunction(device, &nameInfo);
+	}
+
+	// Same for any handle type: dispatchable handles are pointers, non-dispatchable
+	//ones are pointers too on 64-bit platforms but uint64_t on 32-bit ones
+	template <typename T>
+	void setObjectName(VkDevice device, VkObjectType type, T* handle, const std::string& name) const {
+		setObjectName(device, type, (uint64_t) reinterpret_cast<uintptr_t>(handle), name.c_str());
+	}
+
+	void setObjectName(VkDevice device, VkObjectType type, uint64_t handle, const std::string& name) const {
+		setObjectName(device, type, handle, name.c_str());
+	}
+
+	// Since the start, for the stats export
+	struct Counts {
+		uint64_t received;
+		uint64_t errors;
+		uint64_t skipped;
+		uint64_t dropped;
+	};
+
+	Counts counts() const {
+		return { received.load(), errors.load(), totalSkipped.load(), dropped.load() };
+	}
+
+	// Message counts since the start
+	void printStats(std::ostream& out) const {
+		if (!printer.joinable()) {
+			return;
+		}
+		out << "validation: " << received.load() << " messages (" << errors.load() << " errors), " << printed.load() << " printed, "
+			<< totalSkipped.load() << " over the repeat limit, " << dropped.load() << " dropped (queue full)" << std::endl;
+	}
+
+private:
+	// Messages longer than this are cut off
+	static const size_t TEXT_SIZE = 1024;
+	static const size_t ID_NAME_SIZE = 96;
+	// Power of two
+	static const uint32_t QUEUE_SIZE = 256;
+	// Message ids are hashed into this many rate limit counters. Two ids that land in
+	//the same one share the budget, which at worst skips a few more messages.
+	static const uint32_t BUDGET_COUNTERS = 512;
+
+	struct Message {
+		VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+		VkDebugUtilsMessageTypeFlagsEXT type;
+		uint32_t budget;
+		char idName[ID_NAME_SIZE];
+		char text[TEXT_SIZE];
+	};
+
+	// A bounded queue for many producers and one consumer (D. Vyukov's design). Each
+	//slot's sequence says whose turn it is: equal to the position when it can be
+	//written, position + 1 once written and ready to be read.
+	struct Slot {
+		std::atomic<size_t> sequence;
+		Message message;
+	};
+
+	const uint32_t repeatLimit;
+	std::unique_ptr<Slot[]> slots;
+	std::atomic<size_t> enqueuePosition{ 0 };
+	// Only touched by the printing thread
+	size_t dequeuePosition = 0;
+
+	// Messages let through this second, and the ones skipped, per budget counter
+	std::atomic<uint32_t> budgetUsed[BUDGET_COUNTERS];
+	std::atomic<uint32_t> skipped[BUDGET_COUNTERS];
+	// The id name last printed for each counter, for the skipped messages summary.
+	//Only touched by the printing thread.
+	std::string budgetNames[BUDGET_COUNTERS];
+
+	std::atomic<uint64_t> received{ 0 };
+	std::atomic<uint64_t> errors{ 0 };
+	std::atomic<uint64_t> printed{ 0 };
+	std::atomic<uint64_t> totalSkipped{ 0 };
+	std::atomic<uint64_t> dropped{ 0 };
+
+	PFN_vkSetDebugUtilsObjectNameEXT setObjectNameFunction = nullptr;
+
+	std::thread printer;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool running = false;
+
+	// Called by the layers on the thread that made the Vulkan call, so it stays short
+	//and never blocks. Returning VK_FALSE lets the call go on as usual.
+	static VKAPI_ATTR VkBool32 VKAPI_CALL callback(
+		VkDebugUtilsMessageSeverityFlagBitsEXT severity,
+		VkDebugUtilsMessageTypeFlagsEXT type,
+		const VkDebugUtilsMessengerCallbackDataEXT* data,
+		void* userData
+	) {
+		static_cast<ValidationMessenger*>(userData)->push(severity, type, data);
+		return VK_FALSE;
+	}
+
+	void push(VkDebugUtilsMessageSeverityFlagBitsEXT severity, VkDebugUtilsMessageTypeFlagsEXT type, const VkDebugUtilsMessengerCallbackDataEXT* data) {
+		received.fetch_add(1, std::memory_order_relaxed);
+		if (severity >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+			errors.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		uint32_t budget = budgetIndex(data);
+		if (budgetUsed[budget].fetch_add(1, std::memory_order_relaxed) >= repeatLimit) {
+			skipped[budget].fetch_add(1, std::memory_order_relaxed);
+			totalSkipped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		size_t position = enqueuePosition.load(std::memory_order_relaxed);
+		Slot* slot;
+		for (;;) {
+			slot = &slots[position & (QUEUE_SIZE - 1)];
+			size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+			if (difference == 0) {
+				// Our turn, if no other thread claims the position first
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (difference < 0) {
+				// The slot still holds a message from one lap ago: full
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			else {
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+
+		Message& message = slot->message;
+		message.severity = severity;
+		message.type = type;
+		message.budget = budget;
+		copyText(message.idName, ID_NAME_SIZE, data->pMessageIdName);
+		copyText(message.text, TEXT_SIZE, data->pMessage);
+		slot->sequence.store(position + 1, std::memory_order_release);
+	}
+
+	// The message id number identifies the check that fired. Some messages have none
+	//(0), their id name stands in.
+	static uint32_t budgetIndex(const VkDebugUtilsMessengerCallbackDataEXT* data) {
+		uint32_t key = (uint32_t) data->messageIdNumber;
+		if (key == 0 && data->pMessageIdName != nullptr) {
+			// FNV-1a
+			key = 2166136261u;
+			for (const char* c = data->pMessageIdName; *c != '\0'; c++) {
+				key = (key ^ (uint8_t) *c) * 16777619u;
+			}
+		}
+		// Fibonacci hashing spreads ids that only differ in the low bits
+		return (uint32_t) ((key * 2654435769u) >> 23) % BUDGET_COUNTERS;
+	}
+
+	static void copyText(char* destination, size_t size, const char* source) {
+		if (source == nullptr) {
+			destination[0] = '\0';
+			return;
+		}
+		size_t length = strlen(source);
+		if (length < size) {
+			memcpy(destination, source, length + 1);
+			return;
+		}
+		memcpy(destination, source, size - 4);
+		memcpy(destination + size - 4, "...", 4);
+	}
+
+	bool pop(Message& message) {
+		Slot& slot = slots[dequeuePosition & (QUEUE_SIZE - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != dequeuePosition + 1) {
+			return false;
+		}
+		message = slot.message;
+		// Free for the producers a lap later
+		slot.sequence.store(dequeuePosition + QUEUE_SIZE, std::memory_order_release);
+		dequeuePosition++;
+		return true;
+	}
+
+	// Polls the queue: producers never signal anything, a missed wakeup costs at most
+	//one poll interval
+	void printLoop() {
+		const std::chrono::milliseconds POLL_INTERVAL(10);
+		auto budgetStart = std::chrono::steady_clock::now();
+		bool stopping = false;
+
+		while (!stopping) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait_for(lock, POLL_INTERVAL, [this] { return !running; });
+				stopping = !running;
+			}
+
+			drain();
+
+			auto now = std::chrono::steady_clock::now();
+			if (stopping || now - budgetStart >= std::chrono::seconds(1)) {
+				reportSkipped();
+				budgetStart = now;
+			}
+		}
+	}
+
+	void drain() {
+		Message message;
+		while (pop(message)) {
+			budgetNames[message.budget] = message.idName;
+			std::cerr << "validation " << severityName(message.severity);
+			if (message.type & VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT) {
+				std::cerr << " (performance)";
+			}
+			if (message.idName[0] != '\0') {
+				std::cerr << " [" << message.idName << "]";
+			}
+			std::cerr << ": " << message.text << std::endl;
+			printed.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// Starts a new second for the budgets and says what was skipped in the last one
+	void reportSkipped() {
+		for (uint32_t i = 0; i < BUDGET_COUNTERS; i++) {
+			budgetUsed[i].store(0, std::memory_order_relaxed);
+			uint32_t count = skipped[i].exchange(0, std::memory_order_relaxed);
+			if (count > 0) {
+				std::cerr << "validation: " << count << " more " << (budgetNames[i].empty() ? "messages" : budgetNames[i])
+					<< " skipped (over " << repeatLimit << " per second)" << std::endl;
+			}
+		}
+	}
+
+	void stop() {
+		if (!printer.joinable()) {
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running = false;
+		}
+		wake.notify_one();
+		printer.join();
+	}
+
+	static const char* severityName(VkDebugUtilsMessageSeverityFlagBitsEXT severity) {
+		if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) return "error";
+		if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) return "warning";
+		if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) return "info";
+		return "verbose";
+	}
+};
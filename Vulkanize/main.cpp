@@ -1,5 +1,7 @@
 // Following a tutorial. Currently on this part:
-// https://vulkan-tutorial.com/Drawing_a_triangle/Presentation/Swap_chain
+// https://vulkan-tutorial.com/Vertex_buffers/Staging_buffer
+// (with swap chain recreation from
+//https://vulkan-tutorial.com/Drawing_a_triangle/Swap_chain_recreation)
 
 //Vulkan functions, structures and enumerations
 //Same as "#include <vulkan/vulkan.h>" but with GLFW
@@ -12,157 +14,248 @@
 #include <functional>
 //STD Vector
 #include <vector>
+// Swap chains waiting to be destroyed after a resize
+#include <deque>
 // For strcmp
 #include <cstring>
 // For the set of all unique queue families that are necessary for the required queues
 #include <set>
+// For the set of required extensions that haven't been found yet
+#include <string>
+// To sort the devices by score
+#include <algorithm>
+// Laying out the draws on a grid
+#include <cmath>
+// Timing the startup and the benchmark run
+#include <chrono>
+// Overlapping independent startup stages
+#include <future>
+// Formatting device UUIDs
+#include <iomanip>
+#include <sstream>
+// Loading the SPIR-V shaders
+#include <fstream>
+// Vertex attribute descriptions
+#include <array>
+#include <cstddef>
+
+// Automatic cleanup wrappers for Vulkan objects
+#include "VHandle.h"
+// Startup options (command line and environment)
+#include "Settings.h"
+// Swap chain creation and ownership
+#include "Swapchain.h"
+// What each physical device supports, queried once
+#include "DeviceCapabilities.h"
+// Sub-allocation of device memory for buffers and images
+#include "DeviceMemoryAllocator.h"
+// VkAllocationCallbacks implementations
+#include "HostAllocator.h"
+// Pipeline cache persisted between runs
+#include "PipelineCache.h"
+// Shader modules loaded on worker threads, compiled and reloaded at runtime
+#include "ShaderLibrary.h"
+// Pipeline variants by state, created on first use on worker threads
+#include "PipelineFactory.h"
+// Worker threads for command recording
+#include "JobSystem.h"
+// Images to render to without a window
+#include "OffscreenTarget.h"
+// Staging ring and batched copies on the transfer queue
+#include "UploadService.h"
+// Timestamp queries around the GPU work of a frame
+#include "GpuProfiler.h"
+// CPU timing of the main loop steps
+#include "FrameStats.h"
+// Live counters and their periodic export
+#include "StatsRegistry.h"
+// One descriptor set with every texture and storage buffer
+#include "BindlessDescriptors.h"
+// Per frame, linearly allocated uniform and vertex data
+#include "FrameAllocator.h"
+// Alternate frame rendering on linked GPUs
+#include "DeviceGroup.h"
+// Passes and the resources they use, with the barriers between them worked out
+#include "RenderGraph.h"
+// The grid's objects as arrays of their properties, moved and culled with SIMD
+#include "SceneStore.h"
+// Frustum culling in a compute shader feeding indirect draws
+#include "GpuCulling.h"
+// Semaphores with a counter, which replace the frame and upload fences
+#include "TimelineSemaphore.h"
+// Sleeping between frames to hit a frame rate, and asking the display when to show them
+#include "FramePacer.h"
+// Mip levels of KTX2 textures streamed in under a memory budget
+#include "TextureStreamer.h"
+// Startup stage timing and the benchmark report
+#include "Benchmark.h"
+// Validation layer messages, printed on a thread of their own
+#include "ValidationMessenger.h"
 
 const int WIDTH = 800;
 const int HEIGHT = 600;
 
-const std::vector<const char*> validationLayers = {
-	"VK_LAYER_LUNARG_standard_validation"
-};
+// Fewer draws than this per recording task and the cost of handing work to another
+//thread is bigger than the recording itself
+const uint32_t MIN_DRAWS_PER_TASK = 512;
 
-#ifdef NDEBUG
-	const bool enableValidationLayers = false;
-#else
-	// To configure validation layers better, see
-	//the Config folder on the VulkanSDK Directory
-	//and read vk_layer_settings
-	const bool enableValidationLayers = true;
-#endif
-
- //  Proxy function to find the extension method and create the VkDebugReportCallbackEXT object
- VkResult CreateDebugReportCallbackEXT(VkInstance instance, const VkDebugReportCallbackCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugReportCallbackEXT* pCallback) {
-     // look up the vkCreateDebugReportCallbackEXT function's address (beacause it's an extension)
-     auto func = (PFN_vkCreateDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugReportCallbackEXT");
-     if (func != nullptr) {
-         return func(instance, pCreateInfo, pAllocator, pCallback);
-     }
-     else {
-         return VK_ERROR_EXTENSION_NOT_PRESENT;
-     }
- }
-
- //  Proxy function to find the extension method and destroy the VkDebugReportCallbackEXT object
- void DestroyDebugReportCallbackEXT(VkInstance instance, VkDebugReportCallbackEXT callback, const VkAllocationCallbacks* pAllocator) {
-	 auto func = (PFN_vkDestroyDebugReportCallbackEXT)vkGetInstanceProcAddr(instance, "vkDestroyDebugReportCallbackEXT");
-	 if (func != nullptr) {
-		 func(instance, callback, pAllocator);
-	 }
- }
-
-// Wrapper to allow automatic Vulkan Object cleanup
-template <typename T>
-class VDeleter {
-public:
-	// Default constructor with a dummy deleter function that can be used to initialize 
-	//it later, which will be useful for lists of deleters.
-	VDeleter() : VDeleter([](T, VkAllocationCallbacks*) {}) {}
+// With settings.renderOnDemand and nothing to draw, how often the main loop still
+//looks at pending shader reloads
+const double IDLE_POLL_SECONDS = 0.25;
 
-	//The three non-default constructors allow you to specify all three types of 
-	//deletion functions used in Vulkan:
+// How far the scene moves per frame with settings.animateScene. A fixed step, so a
+//given frame always looks the same, like the camera path.
+const float SCENE_STEP_SECONDS = 1.0f / 60.0f;
 
-	//vkDestroyXXX(object, callbacks)
-	// Only the object itself needs to be passed to the cleanup function, so we can 
-	//simply construct a VDeleter with just the function as argument.
-	VDeleter(
-		std::function<void(T, VkAllocationCallbacks*)> deletef
-	) {
-		this->deleter = [=](T obj) { deletef(obj, nullptr); };
-	}
+// Frames rendered in headless mode when settings.frameCount is 0
+const uint32_t DEFAULT_HEADLESS_FRAMES = 1000;
+
+// Device extensions that are required. Presenting images to a surface is not part
+//of the Vulkan core, so the swap chain has to be explicitly enabled.
+const std::vector<const char*> deviceExtensions = {
+	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+};
+
+// Validation is selected by settings.validation, see Settings.h. To configure the
+//layers further, see the Config folder on the VulkanSDK Directory and read 
+//vk_layer_settings
+using VDebugUtilsMessenger = VHandle<VkDebugUtilsMessengerEXT, VkInstance, DestroyDebugUtilsMessengerEXT>;
 
-	//vkDestroyXXX(instance, object, callbacks)
-	// A VkInstance also needs to be passed to the cleanup function, so we use the 
-	//VDeleter constructor that takes the VkInstance reference and cleanup function as 
-	//parameters.
-	VDeleter(
-		const VDeleter<VkInstance>& instance, 
-		std::function<void(VkInstance, T, VkAllocationCallbacks*)> deletef
-	) {
-		this->deleter = [&instance, deletef](T obj) { deletef(instance, obj, nullptr); };
+// structure for queue family querying, where an index of -1 will denote "not found"
+struct QueueFamilyIndices {
+	int graphicsFamily = -1;
+	// It's actually possible that the queue families supporting drawing commands and 
+	//the ones supporting presentation do not overlap. Therefore we have to take into 
+	//account that there could be a distinct presentation queue
+	int presentFamily = -1;
+	// Families that let other work run next to graphics. If the device has none, these
+	//are the graphics family, whose queues can always do transfers and, on every
+	//device that supports graphics and compute, compute work.
+	// A transfer-only family usually maps to the DMA engines, which copy without 
+	//taking time from the shader cores
+	int transferFamily = -1;
+	// A compute family without graphics runs compute dispatches concurrently with 
+	//the graphics queue ("async compute")
+	int computeFamily = -1;
+
+	// Only graphics and presentation are required, the others fall back to graphics
+	bool isComplete() const {
+		return graphicsFamily >= 0 && presentFamily >= 0;
 	}
 
-	//vkDestroyXXX(device, object, callbacks)
-	// Similar to the previous case, but a VkDevice must be passed instead of a 
-	//VkInstance.
-	VDeleter(
-		const VDeleter<VkDevice>& device, 
-		std::function<void(VkDevice, T, VkAllocationCallbacks*)> deletef
-	) {
-		this->deleter = [&device, deletef](T obj) { deletef(device, obj, nullptr); };
+	bool hasDedicatedTransfer() const {
+		return transferFamily >= 0 && transferFamily != graphicsFamily;
 	}
 
-	//Ps.: The callbacks parameter is optional and we always pass nullptr to it, as 
-	//you can see in the VDeleter definition.
+	bool hasAsyncCompute() const {
+		return computeFamily >= 0 && computeFamily != graphicsFamily;
+	}
+};
 
-	// When the wrapped object goes out of scope, the destructor is invoked, which in 
-	//turn calls the cleanup function we specified.
-	~VDeleter() {
-		cleanup();
+// The vertex layout of the vertex buffer, which has to match the inputs of 
+//shaders/shader.vert
+struct Vertex {
+	float pos[2];
+	float color[3];
+
+	// Vertices are tightly packed in a single buffer, one Vertex per vertex
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(Vertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return bindingDescription;
 	}
 
-	// Any extra arguments that are needed for the deleter functions must also be 
-	//passed, usually the parent object. It overloads the address-of, assignment, 
-	//comparison and casting operators to make the wrapper as transparent as possible:
+	// One attribute per vertex shader input, the format is the type of the input 
+	//(vec2 and vec3 of floats)
+	static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions = {};
 
-	// The address-of operator returns a constant pointer to make sure that the object 
-	//within the wrapper is not unexpectedly changed...
-	const T* operator &() const {
-		return &object;
-	}
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(Vertex, pos);
 
-	// ... if you want to replace the handle within the wrapper through a pointer, 
-	//then you should use the replace() function instead. It will invoke the cleanup 
-	//function for the existing handle so that you can safely overwrite it afterwards.
-	T* replace() {
-		cleanup();
-		return &object;
-	}
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[1].offset = offsetof(Vertex, color);
 
-	operator T() const {
-		return object;
+		return attributeDescriptions;
 	}
+};
 
-	void operator=(T rhs) {
-		if (rhs != object) {
-			cleanup();
-			object = rhs;
-		}
-	}
+const std::vector<Vertex> vertices = {
+	{ { 0.0f, -0.5f }, { 1.0f, 0.0f, 0.0f } },
+	{ { 0.5f, 0.5f }, { 0.0f, 1.0f, 0.0f } },
+	{ { -0.5f, 0.5f }, { 0.0f, 0.0f, 1.0f } }
+};
 
-	template<typename V>
-	bool operator==(V rhs) {
-		return object == T(rhs);
-	}
+// The indirect draws are indexed, so the triangle gets an index buffer too
+const std::vector<uint16_t> vertexIndices = { 0, 1, 2 };
 
-private:
-	//All of the constructors initialize the object handle with the equivalent of 
-	//nullptr in Vulkan: VK_NULL_HANDLE
-	T object{ VK_NULL_HANDLE };
+// Per draw data for the vertex shader (see PushConstants in shaders/shader.vert)
+struct DrawPushConstants {
+	float offset[2];
+	float scale;
+};
 
-	std::function<void(T)> deleter;
+// Per frame data for the shaders (see FrameUniforms in shaders/shader.vert), from
+//the frame allocator
+struct FrameUniforms {
+	float cameraCenter[2];
+	float cameraZoom;
+};
 
-	void cleanup() {
-		if (object != VK_NULL_HANDLE) {
-			deleter(object);
-		}
-		object = VK_NULL_HANDLE;
-	}
+// A command pool and the secondary command buffer recorded from it. Each recording
+//task of a frame gets its own, since a pool can only be used by one thread at a time.
+struct RecordingSlot {
+	VCommandPool commandPool;
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
 };
 
-// structure for queue family querying, where an index of -1 will denote "not found"
-struct QueueFamilyIndices {
-	int graphicsFamily = -1;
-	// It's actually possible that the queue families supporting drawing commands and 
-	//the ones supporting presentation do not overlap. Therefore we have to take into 
-	//account that there could be a distinct presentation queue
-	int presentFamily = -1;
+// Everything a single frame needs while it's being recorded and executed. We keep
+//several of these (AppSettings::framesInFlight) so the CPU can record frame N+1
+//while the GPU is still executing frame N.
+struct FrameContext {
+	// A pool per frame lets us reset all of the frame's command buffers at once,
+	//which is cheaper than resetting them individually
+	VCommandPool commandPool;
+	// Command buffers are freed together with their pool
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	// The draws are recorded into secondary command buffers in parallel, and the
+	//primary one above just executes them inside the render pass. One slot per thread 
+	//of the job system.
+	std::vector<RecordingSlot> recordingSlots;
+	// Signaled when the swap chain image is ready to be rendered to
+	VSemaphore imageAvailableSemaphore;
+	// Signaled when the GPU is done with this frame, so its resources can be reused.
+	//Only without timeline semaphores, frameTimeline tells the same from submittedValue.
+	VFence inFlightFence;
+	// The frameTimeline value the last submission of this slot signals, 0 before the
+	//first one
+	uint64_t submittedValue = 0;
+};
 
-	bool isComplete() {
-		return graphicsFamily >= 0 && presentFamily >= 0;
-	}
+// A pipeline the factory replaced (hot reload) or let go of (new swap chain
+//format), or a reloaded culling pipeline, see RetiredSwapchain
+struct RetiredPipeline {
+	VPipeline pipeline;
+	uint64_t retiredAt = 0;
+};
+
+// Everything that was replaced when the swap chain was recreated. Frames submitted
+//before that may still be rendering to these framebuffers and presenting from the 
+//old swap chain, so it all stays alive until those frames are done.
+struct RetiredSwapchain {
+	Swapchain::Retired swapChain;
+	std::vector<VFramebuffer> framebuffers;
+	std::vector<VSemaphore> renderFinishedSemaphores;
+	// Only set when the image format changed, which the render pass depends on
+	VRenderPass renderPass;
+	// Number of frames that had been submitted when it was retired
+	uint64_t retiredAt = 0;
 };
 
 /*
@@ -172,9 +265,13 @@ called from the initVulkan function
 */
 class HelloTriangleApplication {
 public:
+	HelloTriangleApplication(const AppSettings& settings) : settings(settings) {}
+
 	void run() {
-		initWindow();
+		loadShaders();
+		createInstanceAndWindow();
 		initVulkan();
+		startupTimings.print(std::cout);
 		mainLoop();
 	}
 
@@ -182,58 +279,376 @@ private:
 	/*
 		~~~~~~MEMBERS~~~~~~
 	*/
+	// Startup options, see Settings.h
+	AppSettings settings;
+
+	// Host memory allocator handed to the driver on every create and destroy call. It 
+	//has to outlive all Vulkan objects, so it's declared before them.
+	HostAllocator hostAllocator{ settings.hostAllocator };
+	// nullptr unless a custom allocator was selected
+	const VkAllocationCallbacks* allocator = hostAllocator.callbacks();
+
+	// Queues the validation messages and prints them on a thread of its own. The
+	//instance reports to it until it's destroyed, so it's declared before it.
+	ValidationMessenger validationMessenger{ settings.validationRepeatLimit };
+	// The validation layer in use, nullptr when validation is off
+	const char* validationLayer = nullptr;
+	// Whether the instance has VK_EXT_debug_utils, for the messenger and object names
+	bool debugUtilsEnabled = false;
+
+	// Records the secondary command buffers of every frame
+	JobSystem jobSystem{ settings.recordThreads };
+
 	GLFWwindow* window;
 
-	VDeleter<VkInstance> instance{ vkDestroyInstance };
+	VInstance instance;
 
-	// the debug callback in Vulkan is managed with a handle that needs 
+	// the debug messenger in Vulkan is managed with a handle that needs 
 	//to be explicitly created and destroyed
-	VDeleter<VkDebugReportCallbackEXT> callback{ instance, DestroyDebugReportCallbackEXT };
+	VDebugUtilsMessenger debugMessenger;
 
 	// object that represents an abstract type of surface to present rendered images to. 
 	//The surface in our program will be backed by the window that we've already opened with GLFW.
-	VDeleter<VkSurfaceKHR> surface{ instance, vkDestroySurfaceKHR };
+	VSurface surface;
 
 	// The graphics card selected. This object will be implicitly 
 	//destroyed when the VkInstance is destroyed, so we don't need to add a delete wrapper.
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+	// What it supports, queried once while picking it
+	DeviceCapabilities deviceCapabilities;
+	// The queue families we use on it, see findQueueFamilies()
+	QueueFamilyIndices queueFamilies;
+
+	// VK_KHR_get_physical_device_properties2 is optional. We use it to read device
+	//UUIDs, which is how a specific GPU can be pinned from the settings.
+	bool physicalDeviceProperties2Enabled = false;
+	PFN_vkGetPhysicalDeviceProperties2KHR getPhysicalDeviceProperties2 = nullptr;
+	// And for the descriptor indexing features, see bindlessDescriptors
+	PFN_vkGetPhysicalDeviceFeatures2KHR getPhysicalDeviceFeatures2 = nullptr;
+	// And for VK_EXT_memory_budget, see memoryAllocator
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getPhysicalDeviceMemoryProperties2 = nullptr;
+	// VK_KHR_device_group_creation, only asked for when settings.multiGpu is on
+	bool deviceGroupCreationEnabled = false;
+
+	// The GPUs linked with the picked one, when settings.multiGpu uses them
+	DeviceGroup deviceGroup;
 
 	// Placed the declaration below the VkInstance member, because it needs to be cleaned up 
 	//before the instance is cleaned up.
 	// More on destruction order: https://msdn.microsoft.com/en-us/library/6t4fe76c.aspx
 	// Logical devices are cleaned up with the vkDestroyDevice function.
-	VDeleter<VkDevice> device{ vkDestroyDevice };
+	VDevice device;
+	// The required ones and the optional ones the device has
+	std::vector<const char*> enabledDeviceExtensions;
+	// VK_EXT_descriptor_indexing is one of them, for bindlessDescriptors
+	bool descriptorIndexingEnabled = false;
+	// VK_KHR_dynamic_rendering, which replaces renderPass and the framebuffers
+	bool dynamicRenderingEnabled = false;
+	// Whether the grid is drawn by gpuCulling, decided with the device features.
+	//The pipeline's vertex input depends on it.
+	bool useGpuCulling = false;
+	// From VK_KHR_draw_indirect_count, nullptr without it
+	PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = nullptr;
+	// VK_EXT_memory_budget, handed to memoryAllocator once it is initialized
+	bool memoryBudgetEnabled = false;
+	// VK_KHR_timeline_semaphore, used by the frames, the uploads and the render graph
+	bool timelineSemaphoresEnabled = false;
+	// Counts the frames the graphics queue has finished: frame N signals N + 1. Only
+	//created with timelineSemaphoresEnabled.
+	TimelineSemaphore frameTimeline{ device, allocator };
 
 	// Member to store a handle to the graphics queue
 	// Device queues are implicitly cleaned up when the device is destroyed, so we don't need to 
 	//wrap it in a deleter object.
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
+	// Uploads go to the transfer queue, so they overlap with rendering instead of
+	//waiting in line on the graphics queue
+	VkQueue transferQueue;
+	// Nothing is submitted here yet, compute passes are recorded with the graphics
+	//ones (see RenderGraph)
+	VkQueue computeQueue;
+
+	// Hands out device memory for buffers and images from a few big blocks. Everything 
+	//that gets memory from it is declared below it, so it's released first.
+	DeviceMemoryAllocator memoryAllocator{ device, allocator };
+
+	// Gets data into device local buffers and images through the transfer queue
+	UploadService uploadService{ device, allocator, memoryAllocator };
+
+	// Uniforms (set 0 of every pipeline layout) and geometry that only live for one
+	//frame, reset when the frame's fence is waited on
+	FrameAllocator frameAllocator{ device, allocator, memoryAllocator };
+
+	// The passes of a frame, declared in recordCommandBuffer. Puts in the barriers and
+	//layout transitions between them.
+	RenderGraph renderGraph{ device, allocator, memoryAllocator };
+
+	// The triangle, in device local memory. Draws are skipped until its upload has 
+	//landed.
+	VBuffer vertexBuffer;
+	DeviceAllocation vertexBufferMemory;
+	UploadTicket vertexBufferUpload = 0;
+	// Only for the indirect draws, uploaded with the vertex buffer
+	VBuffer indexBuffer;
+	DeviceAllocation indexBufferMemory;
+
+	// Culls the grid and writes its draw commands when settings.gpuCulling is on
+	GpuCulling gpuCulling{ device, allocator, memoryAllocator };
+
+	// The copies of the triangle, see createScene()
+	SceneStore scene;
+	// The direct draws of the current frame: the scene's objects that are on screen.
+	//Written before the recording threads start, only read by them.
+	std::vector<uint32_t> visibleObjects;
+
+	// The swap chain owns the images we render to and present. It's a child of the
+	//device, so it's declared after it to be destroyed first.
+	Swapchain swapChain{ device, allocator };
+	// What we render to instead in headless mode
+	OffscreenTarget offscreenTarget{ device, allocator, memoryAllocator };
+
+	// The render pass describes the framebuffer attachments and how their contents 
+	//are handled during rendering
+	VRenderPass renderPass;
+
+	// One framebuffer for each swap chain image
+	std::vector<VFramebuffer> swapChainFramebuffers;
+
+	// Shader compilation results, loaded from disk at startup and saved at shutdown.
+	//Pipelines don't need it to stay alive, but it needs the device.
+	PipelineCache pipelineCache{ device, allocator };
+
+	// The shader modules the pipelines are created from, see loadShaders()
+	ShaderLibrary shaderLibrary{ device, allocator };
+
+	// Uniform values and push constants used by the shaders
+	VPipelineLayout pipelineLayout;
+	// The pipelines to draw the triangle with, one per GraphicsPipelineKey (see
+	//pipelineKey). Hot reload creates them again on another thread while the old ones
+	//keep drawing.
+	PipelineFactory pipelineFactory{ device, allocator, pipelineCache, shaderLibrary };
+	// The factory's vertex layout, for the direct or the indirect draws
+	uint32_t vertexLayout = 0;
+	// The fragment shader variant to draw with, F2 switches
+	Shading shading{ settings.shading };
+	// What the draws of the frame being recorded bind, see recordCommandBuffer
+	VkPipeline drawPipeline = VK_NULL_HANDLE;
+	// Replaced pipelines, kept until the frames drawing with them are done
+	std::deque<RetiredPipeline> retiredPipelines;
+
+	// How long the GPU spends on each frame and render pass. Press F12 to write the
+	//last frames to settings.gpuProfilePath.
+	GpuProfiler gpuProfiler{ device, allocator };
+	// Set 1 of every pipeline layout when the device has descriptor indexing, bound
+	//once per command buffer
+	BindlessDescriptors bindlessDescriptors{ device, allocator };
+	// settings.textures, each image in a slot of bindlessDescriptors
+	TextureStreamer textureStreamer{ device, allocator, memoryAllocator, uploadService, bindlessDescriptors };
+	bool gpuProfileDumpRequested = false;
+	// Where the CPU time of a frame goes, reported every settings.statsInterval seconds
+	FrameStats frameStats{ settings.statsInterval };
+	StatsCounter graphicsSubmits;
+	StatsCounter swapchainRecreations;
+	// Everything above and more, exported to settings.statsExport while running.
+	//Stopped at the end of mainLoop, its sources read the members declared before it.
+	StatsRegistry statsRegistry;
+
+	// Per frame in flight command recording and synchronization objects
+	std::vector<FrameContext> frames;
+	// The presentation engine may still be reading from an image after the fence of
+	//the frame that rendered it was signaled, so the "render finished" semaphore is
+	//per swap chain image rather than per frame, otherwise it could be reused while
+	//a present still waits on it
+	std::vector<VSemaphore> renderFinishedSemaphores;
+	// The frame that is currently using each swap chain image, as the value its
+	//submission signals (0 for none, see waitForFrame). There can be more frames in
+	//flight than images, or images may be acquired out of order.
+	std::vector<uint64_t> imagesInFlight;
+	// Index in frames of the frame being recorded
+	uint32_t currentFrame = 0;
+	// Frames submitted so far
+	uint64_t frameNumber = 0;
+
+	// How long each step of the startup took
+	StageTimings startupTimings;
+
+	// Sleeps between frames with settings.frameRate
+	FramePacer framePacer{ device };
+	// With settings.renderOnDemand, set by whatever changes what the next frame shows
+	bool redrawRequested = true;
+
+	// Set when the window was resized or presenting said the swap chain doesn't 
+	//match the surface anymore. Not every platform reports an out of date swap chain 
+	//after a resize, hence the GLFW callback too.
+	bool swapChainOutdated = false;
+	// Oldest first, released as the frames that used them complete
+	std::deque<RetiredSwapchain> retiredSwapchains;
 
 	/*
 		~~~~~~FUNCTIONS~~~~~~
 	*/
 
+	// glfwInit() has been called already, see createInstanceAndWindow()
 	void initWindow() {
-		// initializes the GLFW library
-		glfwInit();
 		// we need to tell it to not create an OpenGL context
 		glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-		// handling resized windows takes special care, disable it for now 
-		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
 		// The first three parameters specify the width, height and title of the window. 
 		// The fourth parameter allows you to optionally specify a monitor to open the 
 		//window on and the last parameter is only relevant to OpenGL.
 		window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+
+		// The window can be resized, which means the swap chain has to follow. GLFW 
+		//doesn't know about our class, so the callback finds it through the window's 
+		//user pointer.
+		glfwSetWindowUserPointer(window, this);
+		glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+		glfwSetKeyCallback(window, keyCallback);
+		glfwSetWindowRefreshCallback(window, windowRefreshCallback);
 	}
 
+	static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
+		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		app->swapChainOutdated = true;
+	}
+
+	static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		if (key == GLFW_KEY_F12 && action == GLFW_PRESS) {
+			app->gpuProfileDumpRequested = true;
+		}
+		if (key == GLFW_KEY_F2 && action == GLFW_PRESS) {
+			app->shading = app->shading == Shading::Colors ? Shading::Luminance : Shading::Colors;
+		}
+		app->redrawRequested = true;
+	}
+
+	// The window's contents were damaged, by another window moving over it for example
+	static void windowRefreshCallback(GLFWwindow* window) {
+		auto app = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
+		app->redrawRequested = true;
+	}
+
+	// Whether the next loop iteration has anything new to show. Without
+	//settings.renderOnDemand every one does.
+	bool needsRedraw() const {
+		return !settings.renderOnDemand || redrawRequested || swapChainOutdated || settings.animateScene || settings.cameraPath;
+	}
+
+	// Polls the window events, after sleeping until the next frame is due with
+	//settings.frameRate, or until an event says there's something to draw with
+	//settings.renderOnDemand. Events wake it up either way.
+	void waitForNextFrame() {
+		FramePacer::Clock::time_point start = FramePacer::Clock::now();
+		if (!needsRedraw()) {
+			// Pending shader reloads aren't window events
+			if (settings.hotReloadShaders || pipelineFactory.isBusy()) {
+				glfwWaitEventsTimeout(IDLE_POLL_SECONDS);
+			}
+			else {
+				glfwWaitEvents();
+			}
+			if (!needsRedraw()) {
+				framePacer.slept(FramePacer::Clock::now() - start, true);
+				return;
+			}
+		}
+
+		// A frame that was woken up by an event still keeps to the frame rate
+		double timeout = framePacer.secondsUntilNextFrame();
+		if (timeout > 0.0) {
+			glfwWaitEventsTimeout(timeout);
+		}
+		else {
+			glfwPollEvents();
+		}
+		framePacer.slept(FramePacer::Clock::now() - start, false);
+	}
+
+	// A minimized window has a zero sized framebuffer
+	bool isMinimized() {
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+		return width == 0 || height == 0;
+	}
+
+	// The window and the instance don't depend on each other, so the instance (and its
+	//debug callback) is created on another thread while this one opens the window.
+	//GLFW has to be initialized first, which like creating windows has to happen on
+	//the main thread; glfwGetRequiredInstanceExtensions can be called from any thread.
+	// Headless runs don't touch GLFW at all, so they work without a display.
+	void createInstanceAndWindow() {
+		if (settings.headless) {
+			createInstanceAndDebugCallback();
+			return;
+		}
+
+		startupTimings.measure("glfwInit", [] {
+			if (glfwInit() != GLFW_TRUE) {
+				throw std::runtime_error("failed to initialize GLFW!");
+			}
+		});
+		std::future<void> instanceReady = std::async(std::launch::async, [this] { createInstanceAndDebugCallback(); });
+		startupTimings.measure("initWindow", [this] { initWindow(); });
+		instanceReady.get();
+	}
+
+	void createInstanceAndDebugCallback() {
+		startupTimings.measure("createInstance", [this] { createInstance(); });
+		startupTimings.measure("setupDebugCallback", [this] { setupDebugCallback(); });
+	}
+
+	// Every stage is timed and the breakdown printed once everything is up
 	void initVulkan() {
-		createInstance();
-		setupDebugCallback();
-		createSurface();
-		pickPhysicalDevice();
-		createLogicalDevice();
+		if (!settings.headless) {
+			startupTimings.measure("createSurface", [this] { createSurface(); });
+		}
+		startupTimings.measure("pickPhysicalDevice", [this] { pickPhysicalDevice(); });
+		startupTimings.measure("createLogicalDevice", [this] { createLogicalDevice(); });
+		startupTimings.measure("createShaderModules", [this] { shaderLibrary.createModules(); });
+		startupTimings.measure("initBindlessDescriptors", [this] { initBindlessDescriptors(); });
+		startupTimings.measure("initMemoryAllocator", [this] {
+			memoryAllocator.init(physicalDevice);
+			if (memoryBudgetEnabled) {
+				memoryAllocator.enableMemoryBudget(getPhysicalDeviceMemoryProperties2);
+			}
+			if (deviceGroup.isActive()) {
+				memoryAllocator.enableDeviceGroup();
+			}
+		});
+		startupTimings.measure("initFrameAllocator", [this] { frameAllocator.init(deviceCapabilities.properties.limits, settings.framesInFlight); });
+		startupTimings.measure("initUploadService", [this] { initUploadService(); });
+		startupTimings.measure("initRenderGraph", [this] { initRenderGraph(); });
+		startupTimings.measure("loadPipelineCache", [this] { pipelineCache.load(physicalDevice, settings.pipelineCachePath); });
+		if (settings.headless) {
+			startupTimings.measure("createOffscreenTarget", [this] { createOffscreenTarget(); });
+		}
+		else {
+			startupTimings.measure("createSwapChain", [this] { createSwapChain(); });
+		}
+		startupTimings.measure("createRenderPass", [this] { createRenderPass(); });
+		// With a cold pipeline cache this is where the driver compiles the shaders, by
+		//far the slowest stage. Nothing else here needs the pipeline, so it's created
+		//on another thread while the rest is set up: the pipeline layout and pipeline
+		//factory are left alone by this thread until the future is done. The other
+		//variants are created when they're first drawn with.
+		std::future<void> pipelineReady = std::async(std::launch::async, [this] {
+			startupTimings.measure("createGraphicsPipeline", [this] {
+				createPipelineLayout();
+				initPipelineFactory();
+				pipelineFactory.wait(pipelineKey(shading));
+			});
+		});
+		startupTimings.measure("createFramebuffers", [this] { createFramebuffers(); });
+		startupTimings.measure("createFrameContexts", [this] { createFrameContexts(); });
+		startupTimings.measure("initGpuProfiler", [this] { initGpuProfiler(); });
+		startupTimings.measure("createVertexBuffer", [this] { createVertexBuffer(); });
+		startupTimings.measure("createScene", [this] { createScene(); });
+		startupTimings.measure("initGpuCulling", [this] { initGpuCulling(); });
+		startupTimings.measure("initTextureStreamer", [this] { initTextureStreamer(); });
+		startupTimings.measure("initStatsExport", [this] { initStatsExport(); });
+		startupTimings.measure("waitForPipeline", [&pipelineReady] { pipelineReady.get(); });
 	}
 
 	// On each platform there are subtle differences on how to create surfaces. But, as we're using
@@ -242,20 +657,103 @@ private:
 	void createSurface() {
 		// The parameters are the VkInstance, GLFW window pointer, custom allocators and pointer to 
 		//VkSurfaceKHR variable. It simply passes through the VkResult from the relevant platform call.
-		if (glfwCreateWindowSurface(instance, window, nullptr, surface.replace()) != VK_SUCCESS) {
+		if (glfwCreateWindowSurface(instance, window, allocator, surface.replace(instance, allocator)) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create window surface!");
 		}
 	}
 
 	// Rendering loop that iterates until the window is closed in a moment.
 	void mainLoop() {
-		while (!glfwWindowShouldClose(window)) {
-			glfwPollEvents();
+		auto runStart = std::chrono::steady_clock::now();
+		if (settings.headless) {
+			// No window and no vsync: frames go as fast as the GPU renders them
+			uint32_t frameCount = settings.frameCount != 0 ? settings.frameCount : DEFAULT_HEADLESS_FRAMES;
+			for (uint32_t i = 0; i < frameCount; i++) {
+				updatePipelines();
+				drawFrame();
+				frameStats.endFrame(std::cout);
+				statsRegistry.endFrame();
+			}
+		}
+		while (!settings.headless && !glfwWindowShouldClose(window)) {
+			// There's nothing to present to while minimized, so sleep until the 
+			//window gets an event instead of spinning
+			if (isMinimized()) {
+				glfwWaitEvents();
+				continue;
+			}
+			waitForNextFrame();
+			updatePipelines();
+			if (!needsRedraw()) {
+				continue;
+			}
+			frameStats.inputSampled();
+			framePacer.frameStarted();
+			redrawRequested = false;
+			drawFrame();
+			frameStats.endFrame(std::cout);
+			statsRegistry.endFrame();
+
+			if (gpuProfileDumpRequested) {
+				gpuProfiler.dump(settings.gpuProfilePath);
+				gpuProfileDumpRequested = false;
+			}
+
+			if (settings.frameCount != 0 && frameNumber >= settings.frameCount) {
+				break;
+			}
+		}
+
+		// Operations in drawFrame are asynchronous, so wait for the device to finish 
+		//them before the objects they use are cleaned up
+		vkDeviceWaitIdle(device);
+		std::chrono::duration<double> runTime = std::chrono::steady_clock::now() - runStart;
+		statsRegistry.stop();
+
+		if (settings.headless) {
+			// The last frames' copies haven't been looked at yet
+			offscreenTarget.writeReadbacks();
+			// Nobody can press F12 here, and benchmark runs want the numbers anyway
+			gpuProfiler.dump(settings.gpuProfilePath);
+		}
+
+		// Everything that will be compiled has been by now
+		pipelineFactory.waitForCreations();
+		pipelineCache.save();
+
+		pipelineCache.printStats(std::cout);
+		pipelineFactory.printStats(std::cout);
+		shaderLibrary.printStats(std::cout);
+		frameStats.printStats(std::cout);
+		gpuProfiler.printStats(std::cout);
+		scene.printStats(std::cout);
+		gpuCulling.printStats(std::cout);
+		textureStreamer.printStats(std::cout);
+		bindlessDescriptors.printStats(std::cout);
+		frameAllocator.printStats(std::cout);
+		renderGraph.printStats(std::cout);
+		if (!settings.headless) {
+			framePacer.printStats(std::cout);
 		}
+		if (frameTimeline.isEnabled()) {
+			std::cout << "frame timeline: " << frameTimeline.blockingWaitCount() << " of " << frameNumber << " frame waits blocked" << std::endl;
+		}
+		deviceGroup.printStats(std::cout);
+		uploadService.printStats(std::cout);
+		memoryAllocator.printStats(std::cout);
+		hostAllocator.printStats(std::cout);
+		validationMessenger.printStats(std::cout);
+		statsRegistry.printStats(std::cout);
+
+		#ifdef VULKANIZE_BENCHMARK
+		writeBenchmarkReport(runTime.count());
+		#endif
 
-		glfwDestroyWindow(window);
+		if (!settings.headless) {
+			glfwDestroyWindow(window);
 
-		glfwTerminate();
+			glfwTerminate();
+		}
 	}
 
 	void createInstance() {
@@ -280,8 +778,18 @@ private:
 		#endif
 
 		// Checking for debug layer support
-		if (enableValidationLayers && !checkValidationLayerSupport()) {
-			throw std::runtime_error("validation layers requested, but not available!");
+		if (settings.validation != ValidationMode::Off) {
+			validationLayer = ValidationMessenger::findLayer();
+			if (validationLayer == nullptr) {
+				throw std::runtime_error("validation layers requested, but not available!");
+			}
+			debugUtilsEnabled = ValidationMessenger::isDebugUtilsAvailable(validationLayer);
+			if (!debugUtilsEnabled) {
+				std::cerr << VK_EXT_DEBUG_UTILS_EXTENSION_NAME " is not available, " << validationLayer
+					<< " reports on its own, without the message queue" << std::endl;
+			}
+			validationMessenger.start();
+			std::cout << "validation: " << validationLayer << std::endl;
 		}
 
 		// technically optional, but it may provide some useful information to the driver 
@@ -313,48 +821,28 @@ private:
 
 
 		// The last two members of the struct determine the global validation layers to enable
-		if (enableValidationLayers) {
-			createInfo.enabledLayerCount = validationLayers.size();
-			createInfo.ppEnabledLayerNames = validationLayers.data();
+		if (validationLayer != nullptr) {
+			createInfo.enabledLayerCount = 1;
+			createInfo.ppEnabledLayerNames = &validationLayer;
 		}
 		else {
 			createInfo.enabledLayerCount = 0;
 		}
 
+		// Chained to the create info, the messenger also hears about problems in
+		//vkCreateInstance and vkDestroyInstance themselves
+		VkDebugUtilsMessengerCreateInfoEXT messengerInfo = validationMessenger.messengerCreateInfo(settings.validation == ValidationMode::Verbose);
+		if (debugUtilsEnabled) {
+			createInfo.pNext = &messengerInfo;
+		}
+
 		// Create the instance! (checking for errors)
 		// https://www.khronos.org/registry/vulkan/specs/1.0/man/html/vkCreateInstance.html
-		if (vkCreateInstance(&createInfo, nullptr, instance.replace()) != VK_SUCCESS) {
+		if (vkCreateInstance(&createInfo, allocator, instance.replace(allocator)) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create instance!");
 		}
 	}
 
-	// Check whether validation layers are supported
-	bool checkValidationLayerSupport() {
-		// https://www.khronos.org/registry/vulkan/specs/1.0/man/html/vkEnumerateInstanceLayerProperties.html
-		uint32_t layerCount;
-		vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
-
-		std::vector<VkLayerProperties> availableLayers(layerCount);
-		vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
-
-		for (const char* layerName : validationLayers) {
-			bool layerFound = false;
-
-			for (const auto& layerProperties : availableLayers) {
-				if (strcmp(layerName, layerProperties.layerName) == 0) {
-					layerFound = true;
-					break;
-				}
-			}
-
-			if (!layerFound) {
-				return false;
-			}
-		}
-
-		return true;
-	}
-
 	// Returns the required list of extensions based on whether validation 
 	//layers are enabled or not
 	std::vector<const char*> getRequiredExtensions() {
@@ -362,58 +850,66 @@ private:
 
 		// GLFW has a handy built-in function that returns the extension(s) it needs to do
 		// The extensions specified by GLFW are always required...
-		unsigned int glfwExtensionCount = 0;
-		const char** glfwExtensions;
-		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-		for (unsigned int i = 0; i < glfwExtensionCount; i++) {
-			extensions.push_back(glfwExtensions[i]);
+		//unless there's no window: headless runs need neither VK_KHR_surface nor
+		//the platform's surface extension
+		if (!settings.headless) {
+			unsigned int glfwExtensionCount = 0;
+			const char** glfwExtensions;
+			glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+			for (unsigned int i = 0; i < glfwExtensionCount; i++) {
+				extensions.push_back(glfwExtensions[i]);
+			}
 		}
 
-		//...  but the debug report extension is conditionally added
-		if (enableValidationLayers) {
-			//VK_EXT_DEBUG_REPORT_EXTENSION_NAME macro here which is 
-			//equal to the literal string "VK_EXT_debug_report". 
+		//...  but the debug utils extension is conditionally added
+		if (debugUtilsEnabled) {
+			//VK_EXT_DEBUG_UTILS_EXTENSION_NAME macro here which is 
+			//equal to the literal string "VK_EXT_debug_utils". 
 			//Using this macro lets you avoid typos.
-			extensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
+			extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+		}
+
+		// Optional extensions are only enabled if the loader has them
+		physicalDeviceProperties2Enabled = isInstanceExtensionAvailable(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+		if (physicalDeviceProperties2Enabled) {
+			extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+		}
+		deviceGroupCreationEnabled = settings.multiGpu != MultiGpuMode::Off && isInstanceExtensionAvailable(VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME);
+		if (deviceGroupCreationEnabled) {
+			extensions.push_back(VK_KHR_DEVICE_GROUP_CREATION_EXTENSION_NAME);
 		}
 
 		return extensions;
 	}
 
-	// Callback function. The VKAPI_ATTR and VKAPI_CALL ensure that the function 
-	//has the right signature for Vulkan to call it.
-	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback
-	(
-		VkDebugReportFlagsEXT flags,
-		VkDebugReportObjectTypeEXT objType,
-		uint64_t obj,
-		size_t location,
-		int32_t code,
-		const char* layerPrefix,
-		const char* msg,
-		void* userData
-	)
-	{
-
-		std::cerr << "validation layer: " << msg << std::endl;
+	bool isInstanceExtensionAvailable(const char* name) {
+		uint32_t extensionCount = 0;
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
 
-		return VK_FALSE;
+		for (const auto& extension : extensions) {
+			if (strcmp(extension.extensionName, name) == 0) {
+				return true;
+			}
+		}
+		return false;
 	}
 
+	// The messages go to validationMessenger, see ValidationMessenger.h
 	void setupDebugCallback() {
-		if (!enableValidationLayers) return;
-		//  structure with details about the callback
-		VkDebugReportCallbackCreateInfoEXT createInfo = {};
-		createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
-		createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
-		createInfo.pfnCallback = debugCallback;
+		if (!debugUtilsEnabled) return;
+		VkDebugUtilsMessengerCreateInfoEXT createInfo = validationMessenger.messengerCreateInfo(settings.validation == ValidationMode::Verbose);
 
-		if (CreateDebugReportCallbackEXT(instance, &createInfo, nullptr, callback.replace()) != VK_SUCCESS) {
-			throw std::runtime_error("failed to set up debug callback!");
+		if (CreateDebugUtilsMessengerEXT(instance, &createInfo, allocator, debugMessenger.replace(instance, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to set up debug messenger!");
 		}
+		validationMessenger.loadObjectNaming(instance);
 	}
 
+	// Instead of grabbing the first suitable device, every device gets a score and the 
+	//highest one wins, unless a device UUID was pinned in the settings
 	void pickPhysicalDevice() {
 		// First, query the number of available devices
 		uint32_t deviceCount = 0;
@@ -425,21 +921,165 @@ private:
 		// Otherwise we allocate an array to hold all VkPhysicalDevice handles
 		std::vector<VkPhysicalDevice> devices(deviceCount);
 		vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
-		// Check if any of the physical devices meet our requirements
+
+		if (physicalDeviceProperties2Enabled) {
+			getPhysicalDeviceProperties2 = (PFN_vkGetPhysicalDeviceProperties2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2KHR");
+			getPhysicalDeviceFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+			getPhysicalDeviceMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR) vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+		}
+		if (!settings.deviceUUID.empty() && getPhysicalDeviceProperties2 == nullptr) {
+			throw std::runtime_error("device UUID selection needs " VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+		}
+
+		// Every device is queried once, the scoring and everything after the pick 
+		//work from these
+		std::vector<DeviceCapabilities> capabilities;
+		capabilities.reserve(deviceCount);
 		for (const auto& device : devices) {
-			if (isDeviceSuitable(device)) {
-				physicalDevice = device;
-				break;
+			capabilities.push_back(DeviceCapabilities::query(device, surface, getPhysicalDeviceFeatures2, getPhysicalDeviceProperties2));
+		}
+
+		// Score every device (0 means it can't be used at all) and list them, so the 
+		//UUIDs are easy to find when pinning a device
+		const uint32_t NOT_PICKED = UINT32_MAX;
+		uint32_t picked = NOT_PICKED;
+		std::vector<std::pair<uint64_t, uint32_t>> candidates;
+		std::cout << "physical devices:" << std::endl;
+		for (uint32_t i = 0; i < deviceCount; i++) {
+			uint64_t score = rateDeviceSuitability(capabilities[i]);
+			std::string uuid = getDeviceUUID(devices[i]);
+
+			std::cout << "\t" << capabilities[i].properties.deviceName
+				<< " [" << (uuid.empty() ? "uuid unavailable" : uuid) << "]"
+				<< " score " << score << std::endl;
+
+			if (!settings.deviceUUID.empty()) {
+				if (uuid == settings.deviceUUID) {
+					if (score == 0) {
+						throw std::runtime_error(std::string("pinned device ") + capabilities[i].properties.deviceName + " can't do what you need!");
+					}
+					picked = i;
+				}
 			}
+			else if (score > 0) {
+				candidates.push_back(std::make_pair(score, i));
+			}
+		}
+
+		if (!settings.deviceUUID.empty() && picked == NOT_PICKED) {
+			throw std::runtime_error("no device with UUID " + settings.deviceUUID + " found!");
 		}
 
-		if (physicalDevice == VK_NULL_HANDLE) {
+		// Highest score first. stable_sort keeps the enumeration order for equal scores.
+		if (picked == NOT_PICKED && !candidates.empty()) {
+			std::stable_sort(candidates.begin(), candidates.end(),
+				[](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) {
+					return a.first > b.first;
+				});
+			picked = candidates.front().second;
+		}
+
+		if (picked == NOT_PICKED) {
 			throw std::runtime_error("no Vulkan supporting GPU can do what you need!");
 		}
+
+		physicalDevice = devices[picked];
+		deviceCapabilities = std::move(capabilities[picked]);
+		queueFamilies = findQueueFamilies(deviceCapabilities);
+		std::cout << "using " << deviceCapabilities.properties.deviceName << std::endl;
+
+		findDeviceGroup();
+	}
+
+	// Presenting from a device group needs the group's swap chain and present modes,
+	//which we don't do yet, so only headless runs use more than one GPU
+	void findDeviceGroup() {
+		MultiGpuMode mode = settings.multiGpu;
+		if (mode != MultiGpuMode::Off && !settings.headless) {
+			std::cout << "device group: multi-GPU rendering is headless only, using one GPU" << std::endl;
+			mode = MultiGpuMode::Off;
+		}
+		if (mode != MultiGpuMode::Off && (!deviceGroupCreationEnabled || !deviceCapabilities.hasExtension(VK_KHR_DEVICE_GROUP_EXTENSION_NAME))) {
+			std::cout << "device group: no device group support, using one GPU" << std::endl;
+			mode = MultiGpuMode::Off;
+		}
+		deviceGroup.find(instance, physicalDevice, mode);
+	}
+
+	// Rates how well a device fits us. Anything unsuitable gets 0, otherwise the device
+	//type dominates (so a discrete GPU beats any integrated one), followed by whether 
+	//graphics and presentation share a family, and then the amount of device local 
+	//memory and the maximum texture size break ties between devices of the same kind.
+	uint64_t rateDeviceSuitability(const DeviceCapabilities& device) {
+		if (!isDeviceSuitable(device)) {
+			return 0;
+		}
+
+		uint64_t score = 1;
+
+		switch (device.properties.deviceType) {
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+			score += 1000000000;
+			break;
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+			score += 500000000;
+			break;
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+			score += 250000000;
+			break;
+		default:
+			// CPU implementations and others are a last resort
+			break;
+		}
+
+		// A single family for drawing and presentation avoids sharing the swap chain
+		//images between queues
+		QueueFamilyIndices indices = findQueueFamilies(device);
+		if (indices.graphicsFamily == indices.presentFamily) {
+			score += 100000000;
+		}
+
+		// Device local memory in MiB (the biggest device local heap, since integrated 
+		//GPUs sometimes report system memory as several heaps)
+		const VkPhysicalDeviceMemoryProperties& memoryProperties = device.memoryProperties;
+		VkDeviceSize deviceLocalMemory = 0;
+		for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+			if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+				deviceLocalMemory = std::max(deviceLocalMemory, memoryProperties.memoryHeaps[i].size);
+			}
+		}
+		score += std::min<uint64_t>(deviceLocalMemory / (1024 * 1024), 10000000) * 8;
+
+		// The maximum size of textures affects graphics quality
+		score += device.properties.limits.maxImageDimension2D;
+
+		return score;
+	}
+
+	// The deviceUUID as lowercase hex, or an empty string if we can't query it
+	std::string getDeviceUUID(VkPhysicalDevice device) {
+		if (getPhysicalDeviceProperties2 == nullptr) {
+			return std::string();
+		}
+
+		VkPhysicalDeviceIDPropertiesKHR idProperties = {};
+		idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES_KHR;
+
+		VkPhysicalDeviceProperties2KHR properties2 = {};
+		properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+		properties2.pNext = &idProperties;
+		getPhysicalDeviceProperties2(device, &properties2);
+
+		std::ostringstream uuid;
+		uuid << std::hex << std::setfill('0');
+		for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+			uuid << std::setw(2) << (unsigned int) idProperties.deviceUUID[i];
+		}
+		return uuid.str();
 	}
 
 	// Check if physiscal device supports the operations we'll perform
-	bool isDeviceSuitable(VkPhysicalDevice device) {
+	bool isDeviceSuitable(const DeviceCapabilities& device) {
 		/**
 			//For now, we'll stick to devices that just support Vulkan
 			//and the needed queues.
@@ -466,63 +1106,124 @@ private:
 		/**/
 		QueueFamilyIndices indices = findQueueFamilies(device);
 
-		return indices.isComplete();
+		bool extensionsSupported = checkDeviceExtensionSupport(device);
+
+		// Only query for swap chain support after verifying that the extension is available
+		//(and when there's a surface to present to at all)
+		bool swapChainAdequate = settings.headless;
+		if (extensionsSupported && !settings.headless) {
+			swapChainAdequate = device.surfaceSupport.isAdequate();
+		}
+
+		return indices.isComplete() && extensionsSupported && swapChainAdequate;
+	}
+
+	// Go through the device extensions and tick off the required ones
+	bool checkDeviceExtensionSupport(const DeviceCapabilities& device) {
+		const std::vector<const char*>& extensions = requiredDeviceExtensions();
+		std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
+
+		for (const auto& extension : device.extensions) {
+			requiredExtensions.erase(extension.extensionName);
+		}
+
+		return requiredExtensions.empty();
+	}
+
+	// Headless runs don't present, so they need no swap chain extension
+	const std::vector<const char*>& requiredDeviceExtensions() const {
+		static const std::vector<const char*> none;
+		return settings.headless ? none : deviceExtensions;
 	}
 
 	// Function to check which queue families are supported by the device 
 	//and which one of these supports the commands that we want to use.
-	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device) {
+	// Called once per device while picking one, the result for the picked device is
+	//kept in queueFamilies.
+	QueueFamilyIndices findQueueFamilies(const DeviceCapabilities& device) {
 		QueueFamilyIndices indices;
 
-		// Same structure: query amount then allocate and query details
-		uint32_t queueFamilyCount = 0;
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
-
-		std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-		vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
-
 		// The VkQueueFamilyProperties struct contains some details about the queue family, 
 		//including the type of operations that are supported and the number of queues that 
 		//can be created based on that family
+		// Transfer families that also do compute (but not graphics) are our second choice
+		//for uploads, in case there is no transfer-only family
+		int computeTransferFamily = -1;
+
+		// We go through all the families (no early out), since the transfer and compute 
+		//families may come after the graphics and present ones
 		int i = 0;
-		for (const auto& queueFamily : queueFamilies) {
+		for (const auto& queueFamily : device.queueFamilies) {
 			// We need to find at least one queue family that supports VK_QUEUE_GRAPHICS_BIT
 			//so that it supports graphics commands
-			if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			if (indices.graphicsFamily < 0 && queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
 				indices.graphicsFamily = i;
 			}
 
-			// Look for a queue family that has the capability of presenting to our window surface
-			//Takes the physical device, queue family index and surface as parameters
-			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			bool graphics = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+			bool compute = (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+			bool transfer = (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) != 0;
+
+			if (queueFamily.queueCount > 0 && !graphics) {
+				// Transfer-only: the DMA engine
+				if (transfer && !compute && indices.transferFamily < 0) {
+					indices.transferFamily = i;
+				}
+				// Compute without graphics: async compute. Compute queues also support
+				//transfers, even when they don't advertise the bit.
+				if (compute && indices.computeFamily < 0) {
+					indices.computeFamily = i;
+				}
+				if (compute && computeTransferFamily < 0) {
+					computeTransferFamily = i;
+				}
+			}
+
+			// Look for a queue family that has the capability of presenting to our window
+			//surface (never, when headless)
+			VkBool32 presentSupport = device.presentSupport[i];
 
 			// Check the value of the boolean for presentation and store the presentation family 
 			//queue index
-			if (queueFamily.queueCount > 0 && presentSupport) {
+			if (indices.presentFamily < 0 && queueFamily.queueCount > 0 && presentSupport) {
 				indices.presentFamily = i;
 			}
-			// IMPROVEMENT:  it's very likely that drawing and presentation end up being the same queue 
-			//family after all, but throughout the program we will treat them as if they were separate 
-			//queues for a uniform approach. BUT one could add logic to explicitly prefer a physical 
-			//device that supports drawing and presentation in the same queue for improved performance.
-
-			if (indices.isComplete()) {
-				break;
+			// It's very likely that drawing and presentation end up being the same queue family
+			//after all, and that's the faster setup (no sharing of the swap chain images), so a
+			//family that can do both wins over separate ones. rateDeviceSuitability also
+			//prefers devices that have such a family.
+			if (queueFamily.queueCount > 0 && graphics && presentSupport && indices.graphicsFamily != indices.presentFamily) {
+				indices.graphicsFamily = i;
+				indices.presentFamily = i;
 			}
 
 			i++;
 		}
 
+		// Without a surface nothing is presented. The graphics family stands in, so the
+		//code that creates the queues doesn't need to know.
+		if (settings.headless) {
+			indices.presentFamily = indices.graphicsFamily;
+		}
+
+		// Fallbacks for devices without dedicated families
+		if (indices.transferFamily < 0) {
+			indices.transferFamily = computeTransferFamily >= 0 ? computeTransferFamily : indices.graphicsFamily;
+		}
+		if (indices.computeFamily < 0) {
+			indices.computeFamily = indices.graphicsFamily;
+		}
+
 		return indices;
 	}
 
 	void createLogicalDevice() {
-		QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+		const QueueFamilyIndices& indices = queueFamilies;
 
 		std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 		// Create a set of all unique queue families that are necessary for the required queues
-		std::set<int> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily };
+		//(a family that is shared by several roles still gets a single queue)
+		std::set<int> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily, indices.transferFamily, indices.computeFamily };
 
 		// Vulkan lets you assign priorities to queues to influence the scheduling of 
 		//command buffer execution.
@@ -542,6 +1243,67 @@ private:
 
 		// Set of device features that we'll be using (the ones we queried support for)
 		VkPhysicalDeviceFeatures deviceFeatures = {};
+		// The indirect draws need multiDrawIndirect and drawIndirectFirstInstance, and
+		//use VK_KHR_draw_indirect_count when it's there
+		useGpuCulling = settings.gpuCulling && settings.drawCount > 0 && GpuCulling::isSupported(deviceCapabilities.features);
+		if (useGpuCulling) {
+			GpuCulling::enableFeatures(deviceFeatures);
+		}
+		else if (settings.gpuCulling) {
+			std::cout << "gpu culling: multiDrawIndirect or drawIndirectFirstInstance not supported, drawing directly" << std::endl;
+		}
+		// The compressed texture formats the device has
+		if (!settings.textures.empty()) {
+			TextureStreamer::enableFeatures(deviceCapabilities.features, deviceFeatures);
+		}
+
+		// Bindless descriptors are optional. Descriptor indexing depends on
+		//VK_KHR_maintenance3, and its features are enabled by chaining their struct.
+		enabledDeviceExtensions = requiredDeviceExtensions();
+		VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {};
+		descriptorIndexingEnabled = BindlessDescriptors::isSupported(deviceCapabilities.descriptorIndexingFeatures)
+			&& deviceCapabilities.hasExtension(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+		if (descriptorIndexingEnabled) {
+			enabledDeviceExtensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+			enabledDeviceExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+			descriptorIndexingFeatures = BindlessDescriptors::enableFeatures(deviceCapabilities.descriptorIndexingFeatures);
+		}
+		bool drawIndirectCountEnabled = useGpuCulling && deviceCapabilities.hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		if (drawIndirectCountEnabled) {
+			enabledDeviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+		// Presents can ask for a time to be shown at when there's a frame rate to keep
+		bool displayTimingEnabled = !settings.headless && settings.frameRate > 0
+			&& deviceCapabilities.hasExtension(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+		if (displayTimingEnabled) {
+			enabledDeviceExtensions.push_back(VK_GOOGLE_DISPLAY_TIMING_EXTENSION_NAME);
+		}
+		// How much of the device local heap is left for us, for the texture budget
+		memoryBudgetEnabled = getPhysicalDeviceMemoryProperties2 != nullptr
+			&& deviceCapabilities.hasExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		if (memoryBudgetEnabled) {
+			enabledDeviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+		// Pipelines and rendering without render passes, see pipelineFactory
+		std::vector<const char*> dynamicRenderingExtensions = PipelineFactory::dynamicRenderingExtensions();
+		dynamicRenderingEnabled = settings.dynamicRendering
+			&& PipelineFactory::isDynamicRenderingSupported(deviceCapabilities.dynamicRenderingFeatures)
+			&& std::all_of(dynamicRenderingExtensions.begin(), dynamicRenderingExtensions.end(), [this](const char* name) { return deviceCapabilities.hasExtension(name); });
+		VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {};
+		if (dynamicRenderingEnabled) {
+			enabledDeviceExtensions.insert(enabledDeviceExtensions.end(), dynamicRenderingExtensions.begin(), dynamicRenderingExtensions.end());
+			dynamicRenderingFeatures = PipelineFactory::enableDynamicRenderingFeatures();
+		}
+		// The device group submissions would need a timeline value per GPU, so they
+		//keep their fences
+		timelineSemaphoresEnabled = settings.timelineSemaphores && !deviceGroup.isActive()
+			&& deviceCapabilities.hasExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)
+			&& TimelineSemaphore::isSupported(deviceCapabilities.timelineSemaphoreFeatures);
+		VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {};
+		if (timelineSemaphoresEnabled) {
+			enabledDeviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+			timelineSemaphoreFeatures = TimelineSemaphore::enableFeatures();
+		}
 
 		// With the two structures above, we can start the creation of the logical device
 		VkDeviceCreateInfo createInfo = {};
@@ -553,36 +1315,1211 @@ private:
 		// Pointer to desired features
 		createInfo.pEnabledFeatures = &deviceFeatures;
 
+		// The extension structs are chained in front of each other
+		const void* next = nullptr;
+		if (descriptorIndexingEnabled) {
+			descriptorIndexingFeatures.pNext = (void*) next;
+			next = &descriptorIndexingFeatures;
+		}
+		if (timelineSemaphoresEnabled) {
+			timelineSemaphoreFeatures.pNext = (void*) next;
+			next = &timelineSemaphoreFeatures;
+		}
+		if (dynamicRenderingEnabled) {
+			dynamicRenderingFeatures.pNext = (void*) next;
+			next = &dynamicRenderingFeatures;
+		}
+		// A device group creates one logical device for all of its GPUs
+		VkDeviceGroupDeviceCreateInfoKHR deviceGroupInfo = deviceGroup.deviceCreateInfo();
+		if (deviceGroup.isActive()) {
+			enabledDeviceExtensions.push_back(VK_KHR_DEVICE_GROUP_EXTENSION_NAME);
+			deviceGroupInfo.pNext = next;
+			next = &deviceGroupInfo;
+		}
+		createInfo.pNext = next;
+
 		// Information similar to VkInstanceCreateInfo (extensions and validation layers), but
 		//device specific
-		// For now, enable the same validation layers for devices as we did for the instance
-		createInfo.enabledExtensionCount = 0;
-
-		if (enableValidationLayers) {
-			createInfo.enabledLayerCount = validationLayers.size();
-			createInfo.ppEnabledLayerNames = validationLayers.data();
+		// Enable the swap chain extension (checked in isDeviceSuitable)
+		createInfo.enabledExtensionCount = (uint32_t) enabledDeviceExtensions.size();
+		createInfo.ppEnabledExtensionNames = enabledDeviceExtensions.data();
+
+		// Device layers are deprecated, but older implementations still look at them, so
+		//enable the same validation layer for the device as we did for the instance
+		if (validationLayer != nullptr) {
+			createInfo.enabledLayerCount = 1;
+			createInfo.ppEnabledLayerNames = &validationLayer;
 		}
 		else {
 			createInfo.enabledLayerCount = 0;
 		}
 
 		// And now... create it!
-		if (vkCreateDevice(physicalDevice, &createInfo, nullptr, device.replace()) != VK_SUCCESS) {
+		if (vkCreateDevice(physicalDevice, &createInfo, allocator, device.replace(allocator)) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create logical device!");
 		}
 
+		if (drawIndirectCountEnabled) {
+			drawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR) vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+		}
+		if (timelineSemaphoresEnabled) {
+			frameTimeline.init();
+			validationMessenger.setObjectName(device, VK_OBJECT_TYPE_SEMAPHORE, frameTimeline.handle(), "frame timeline");
+		}
+		std::cout << "synchronization: " << (timelineSemaphoresEnabled ? "timeline semaphores" : "fences") << std::endl;
+		framePacer.init(settings.headless ? 0 : settings.frameRate, displayTimingEnabled);
+
 		// Retrieve queue handles for each queue family. The parameters are the logical device, 
 		//queue family, queue index and a pointer to the variable to store the queue handle in. 
 		// Because we're only creating a single queue from these families, we'll simply use index 0.
 		vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
 		vkGetDeviceQueue(device, indices.presentFamily, 0, &presentQueue);
+		// When there are no dedicated families these end up being the graphics queue
+		vkGetDeviceQueue(device, indices.transferFamily, 0, &transferQueue);
+		vkGetDeviceQueue(device, indices.computeFamily, 0, &computeQueue);
+
+		// Queues that are shared by several roles end up with the last name
+		validationMessenger.setObjectName(device, VK_OBJECT_TYPE_QUEUE, computeQueue, "compute queue");
+		validationMessenger.setObjectName(device, VK_OBJECT_TYPE_QUEUE, transferQueue, "transfer queue");
+		validationMessenger.setObjectName(device, VK_OBJECT_TYPE_QUEUE, presentQueue, "present queue");
+		validationMessenger.setObjectName(device, VK_OBJECT_TYPE_QUEUE, graphicsQueue, "graphics queue");
+
+		std::cout << "queue families: graphics " << indices.graphicsFamily
+			<< ", present " << indices.presentFamily
+			<< ", transfer " << indices.transferFamily << (indices.hasDedicatedTransfer() ? " (dedicated)" : " (shared with graphics)")
+			<< ", compute " << indices.computeFamily << (indices.hasAsyncCompute() ? " (async)" : " (shared with graphics)")
+			<< std::endl;
+	}
+
+	// The swap chain details (format, present mode, image count) live in Swapchain.h,
+	//here we just feed it the device, surface and the current window size
+	void createSwapChain() {
+		const QueueFamilyIndices& indices = queueFamilies;
+
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+		VkExtent2D windowExtent = { (uint32_t) width, (uint32_t) height };
+
+		swapChain.create(deviceCapabilities.surfaceSupport, surface, indices.graphicsFamily, indices.presentFamily, settings, windowExtent);
+		framePacer.setSwapchain(swapChain.handle());
+	}
+
+	// One offscreen image per frame in flight, the size the window would have. With
+	//readback enabled they can be copied back and written to files.
+	void createOffscreenTarget() {
+		VkExtent2D extent = { (uint32_t) WIDTH, (uint32_t) HEIGHT };
+		// With a device group the readback buffers are in host memory all GPUs share
+		//(the allocator keeps mapped memory out of multi-instance heaps), so the GPU
+		//that rendered a frame copies it straight there
+		bool readback = settings.readbackInterval > 0;
+		offscreenTarget.create(extent, settings.framesInFlight, readback);
+	}
+
+	// The images we render to: the swap chain's, or the offscreen ones when headless
+	VkFormat targetFormat() const {
+		return settings.headless ? offscreenTarget.imageFormat() : swapChain.imageFormat();
+	}
+
+	VkExtent2D targetExtent() const {
+		return settings.headless ? offscreenTarget.extent() : swapChain.extent();
+	}
+
+	uint32_t targetImageCount() const {
+		return settings.headless ? offscreenTarget.imageCount() : swapChain.imageCount();
+	}
+
+	VkImageView targetImageView(uint32_t index) const {
+		return settings.headless ? offscreenTarget.imageView(index) : swapChain.imageView(index);
+	}
+
+	VkImage targetImage(uint32_t index) const {
+		return settings.headless ? offscreenTarget.image(index) : swapChain.image(index);
+	}
+
+	void initRenderGraph() {
+		renderGraph.init(settings.framesInFlight);
+	}
+
+	// Creates a new swap chain for the current window size, handing the current one
+	//over as oldSwapchain. Rendering keeps going: frames that are in flight finish 
+	//with the old swap chain and its framebuffers, which are retired instead of 
+	//destroyed, and nobody waits for the device to go idle. The viewport and scissor 
+	//are dynamic state, so the pipeline survives a resize. Returns false if the 
+	//surface has no size right now (minimized), the swap chain stays outdated then.
+	bool recreateSwapChain() {
+		const QueueFamilyIndices& indices = queueFamilies;
+
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+		VkExtent2D windowExtent = { (uint32_t) width, (uint32_t) height };
+
+		// The current extent follows the window, so the capabilities are read again.
+		//When the size didn't change, this isn't a resize but the surface itself
+		//changing (moving to another monitor, for example), which can bring other
+		//formats and present modes.
+		bool resized = windowExtent.width != swapChain.extent().width || windowExtent.height != swapChain.extent().height;
+		deviceCapabilities.refreshSurface(surface, !resized);
+		if (!Swapchain::canPresent(deviceCapabilities.surfaceSupport.capabilities, windowExtent)) {
+			return false;
+		}
+
+		RetiredSwapchain retired;
+		retired.retiredAt = frameNumber;
+
+		VkFormat previousFormat = swapChain.imageFormat();
+		retired.swapChain = swapChain.recreate(deviceCapabilities.surfaceSupport, surface, indices.graphicsFamily, indices.presentFamily, settings, windowExtent);
+		retired.framebuffers = std::move(swapChainFramebuffers);
+		retired.renderFinishedSemaphores = std::move(renderFinishedSemaphores);
+
+		// Moving to a monitor with a different format means pipelines for it (the next
+		//frame waits for its own), and a new render pass without dynamic rendering
+		if (swapChain.imageFormat() != previousFormat) {
+			pipelineFactory.clear();
+			retired.renderPass = std::move(renderPass);
+			createRenderPass();
+		}
+
+		framePacer.setSwapchain(swapChain.handle());
+		createFramebuffers();
+		createRenderFinishedSemaphores();
+		// The frame fences still guard the frame contexts, the new images just 
+		//haven't been used by any frame yet
+		imagesInFlight.assign(swapChain.imageCount(), 0);
+
+		retiredSwapchains.push_back(std::move(retired));
+		swapChainOutdated = false;
+		swapchainRecreations.add();
+		return true;
+	}
+
+	// Frames complete in submission order, so once we waited for the fence of the 
+	//frame framesInFlight frames back, every frame before it is done too. A retired
+	//swap chain is released one frame after that point for its last frames, which 
+	//leaves time for the present that followed the last frame that used it (presents
+	//don't signal a fence in Vulkan 1.0).
+	void releaseRetiredSwapchains() {
+		while (!retiredSwapchains.empty() && frameNumber >= retiredSwapchains.front().retiredAt + settings.framesInFlight) {
+			retiredSwapchains.pop_front();
+		}
+		while (!retiredPipelines.empty() && frameNumber >= retiredPipelines.front().retiredAt + settings.framesInFlight) {
+			retiredPipelines.pop_front();
+		}
+	}
+
+	// A single subpass with one color attachment: the swap chain image, cleared at
+	//the start. Getting it ready for the presentation engine is the render graph's
+	//job.
+	// https://vulkan-tutorial.com/Drawing_a_triangle/Graphics_pipeline_basics/Render_passes
+	// Not with dynamic rendering, the pass is described when it begins instead.
+	void createRenderPass() {
+		if (dynamicRenderingEnabled) {
+			return;
+		}
+		VkAttachmentDescription colorAttachment = {};
+		colorAttachment.format = targetFormat();
+		colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		// The render graph moves the image into the attachment layout before the pass
+		//and on to presenting (or copying it back) after it
+		colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+		VkAttachmentReference colorAttachmentRef = {};
+		colorAttachmentRef.attachment = 0;
+		colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+		VkSubpassDescription subpass = {};
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+		subpass.colorAttachmentCount = 1;
+		subpass.pColorAttachments = &colorAttachmentRef;
+
+		// No external dependencies: the render graph's barrier in front of the pass
+		//waits at the color attachment output stage, which is where we wait on the
+		//image available semaphore
+		VkRenderPassCreateInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+		renderPassInfo.attachmentCount = 1;
+		renderPassInfo.pAttachments = &colorAttachment;
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = 0;
+		renderPassInfo.pDependencies = nullptr;
+
+		if (vkCreateRenderPass(device, &renderPassInfo, allocator, renderPass.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create render pass!");
+		}
+		validationMessenger.setObjectName(device, VK_OBJECT_TYPE_RENDER_PASS, renderPass.get(), "main pass");
+	}
+
+	// Starts loading the shaders on worker threads, the modules are created as soon
+	//as the device exists
+	void loadShaders() {
+		shaderLibrary.configure(settings.compileShaders, settings.hotReloadShaders);
+		// Compiled from shaders/ by shaders/compile.bat, or at runtime from the sources
+		shaderLibrary.add("vertex", "shaders/vert.spv", "shaders/shader.vert");
+		shaderLibrary.add("fragment", "shaders/frag.spv", "shaders/shader.frag");
+		if (settings.gpuCulling) {
+			shaderLibrary.add("instanced vertex", "shaders/instanced_vert.spv", "shaders/instanced.vert");
+			shaderLibrary.add("cull", "shaders/cull.spv", "shaders/cull.comp");
+		}
+	}
+
+	// Once per frame: takes in the pipelines created since the last frame, hands the
+	//ones they replaced to retiredPipelines, and with hot reload on has the pipelines
+	//created again when new shaders came in. The shader library is only polled while
+	//no pipeline is being created, so the modules stay put while they're used. The
+	//culling pipeline is a single compute one, created again right here.
+	void updatePipelines() {
+		if (pipelineFactory.update()) {
+			redrawRequested = true;
+		}
+		for (VPipeline& pipeline : pipelineFactory.takeRetired()) {
+			retirePipeline(std::move(pipeline));
+		}
+		if (!pipelineFactory.isBusy() && shaderLibrary.pollReload()) {
+			pipelineFactory.invalidate();
+			if (gpuCulling.isEnabled()) {
+				try {
+					retirePipeline(gpuCulling.reloadPipeline(shaderLibrary.module("cull"), pipelineCache));
+				}
+				catch (const std::exception& error) {
+					std::cerr << "shaders: keeping the old culling pipeline, " << error.what() << std::endl;
+				}
+			}
+			redrawRequested = true;
+		}
+	}
+
+	void retirePipeline(VPipeline pipeline) {
+		RetiredPipeline retired;
+		retired.pipeline = std::move(pipeline);
+		retired.retiredAt = frameNumber;
+		retiredPipelines.push_back(std::move(retired));
+	}
+
+	// The uniforms and push constants every pipeline gets
+	void createPipelineLayout() {
+		// The position of each copy of the triangle is pushed right before its draw
+		VkPushConstantRange pushConstantRange = {};
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = sizeof(DrawPushConstants);
+
+		// The per frame uniforms, then the bindless set if there is one. The shaders
+		//don't use the bindless set yet, but every pipeline gets the same set 1 so it
+		//stays bound across pipeline changes.
+		VkDescriptorSetLayout setLayouts[] = { frameAllocator.layout(), bindlessDescriptors.layout() };
+
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+		pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount = bindlessDescriptors.isEnabled() ? 2 : 1;
+		pipelineLayoutInfo.pSetLayouts = setLayouts;
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, allocator, pipelineLayout.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create pipeline layout!");
+		}
+		validationMessenger.setObjectName(device, VK_OBJECT_TYPE_PIPELINE_LAYOUT, pipelineLayout.get(), "triangle pipeline layout");
+	}
+
+	// The pipelines' fixed function state is the factory's, what's ours is the layout
+	//and the vertex input
+	void initPipelineFactory() {
+		pipelineFactory.init(pipelineLayout, dynamicRenderingEnabled);
+
+		// Format of the vertex data given to the vertex shader
+		std::vector<VkVertexInputBindingDescription> bindingDescriptions = { Vertex::getBindingDescription() };
+		auto vertexAttributes = Vertex::getAttributeDescriptions();
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions(vertexAttributes.begin(), vertexAttributes.end());
+		// The indirect draws read the placement of each copy per instance, from the
+		//culling's object buffer in binding 1
+		if (useGpuCulling) {
+			VkVertexInputBindingDescription instanceBinding = {};
+			instanceBinding.binding = 1;
+			instanceBinding.stride = sizeof(SceneInstance);
+			instanceBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+			bindingDescriptions.push_back(instanceBinding);
+
+			VkVertexInputAttributeDescription offsetAttribute = {};
+			offsetAttribute.binding = 1;
+			offsetAttribute.location = 2;
+			offsetAttribute.format = VK_FORMAT_R32G32_SFLOAT;
+			offsetAttribute.offset = offsetof(SceneInstance, offset);
+			attributeDescriptions.push_back(offsetAttribute);
+
+			VkVertexInputAttributeDescription scaleAttribute = {};
+			scaleAttribute.binding = 1;
+			scaleAttribute.location = 3;
+			scaleAttribute.format = VK_FORMAT_R32_SFLOAT;
+			scaleAttribute.offset = offsetof(SceneInstance, scale);
+			attributeDescriptions.push_back(scaleAttribute);
+		}
+
+		vertexLayout = pipelineFactory.addVertexLayout(bindingDescriptions, attributeDescriptions);
+	}
+
+	// Everything the pipeline to draw the grid with depends on
+	GraphicsPipelineKey pipelineKey(Shading variant) const {
+		GraphicsPipelineKey key;
+		key.vertexShader = useGpuCulling ? "instanced vertex" : "vertex";
+		key.fragmentShader = "fragment";
+		key.vertexLayout = vertexLayout;
+		key.colorFormat = targetFormat();
+		// Dynamic rendering only needs the format
+		key.renderPass = dynamicRenderingEnabled ? VK_NULL_HANDLE : renderPass.get();
+		key.setConstant(0, (uint32_t) variant);
+		return key;
+	}
+
+	// The variant of the current shading. While that one is still being created, the
+	//startup variant, which is only missing after a new swap chain format dropped the
+	//pipelines: then it's waited for.
+	VkPipeline currentPipeline() {
+		VkPipeline pipeline = pipelineFactory.request(pipelineKey(shading));
+		if (pipeline != VK_NULL_HANDLE) {
+			return pipeline;
+		}
+		return pipelineFactory.wait(pipelineKey(settings.shading));
+	}
+
+	// The attachments of the render pass are bound through a framebuffer, which 
+	//references the image views. One per swap chain image.
+	void createFramebuffers() {
+		swapChainFramebuffers.clear();
+		// Dynamic rendering takes the image views when the rendering begins
+		if (dynamicRenderingEnabled) {
+			return;
+		}
+		swapChainFramebuffers.resize(targetImageCount());
+
+		for (uint32_t i = 0; i < targetImageCount(); i++) {
+			VkImageView attachments[] = { targetImageView(i) };
+
+			VkFramebufferCreateInfo framebufferInfo = {};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = renderPass;
+			framebufferInfo.attachmentCount = 1;
+			framebufferInfo.pAttachments = attachments;
+			framebufferInfo.width = targetExtent().width;
+			framebufferInfo.height = targetExtent().height;
+			framebufferInfo.layers = 1;
+
+			if (vkCreateFramebuffer(device, &framebufferInfo, allocator, swapChainFramebuffers[i].replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create framebuffer!");
+			}
+		}
+	}
+
+	// The staging ring lives in host visible memory, so this comes after the memory 
+	//allocator is initialized
+	void initUploadService() {
+		const QueueFamilyIndices& indices = queueFamilies;
+		uploadService.init(indices.transferFamily, transferQueue, timelineSemaphoresEnabled);
+		if (deviceGroup.isActive()) {
+			uploadService.setDeviceMask(deviceGroup.allDevicesMask());
+		}
+	}
+
+	// The vertex buffer lives in device local memory and is filled through the upload
+	//service. It's used by the graphics queue but written by the transfer queue, which
+	//may be a different family: concurrent sharing lets both use it without
+	//transferring ownership.
+	// https://vulkan-tutorial.com/Vertex_buffers/Vertex_buffer_creation
+	void createVertexBuffer() {
+		const QueueFamilyIndices& indices = queueFamilies;
+		uint32_t queueFamilyIndices[] = { (uint32_t) indices.graphicsFamily, (uint32_t) indices.transferFamily };
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = sizeof(vertices[0]) * vertices.size();
+		bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		if (indices.hasDedicatedTransfer()) {
+			bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+			bufferInfo.queueFamilyIndexCount = 2;
+			bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+		}
+		else {
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		}
+
+		if (vkCreateBuffer(device, &bufferInfo, allocator, vertexBuffer.replace(device, allocator)) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create vertex buffer!");
+		}
+		validationMessenger.setObjectName(device, VK_OBJECT_TYPE_BUFFER, vertexBuffer.get(), "vertex buffer");
+
+		vertexBufferMemory = memoryAllocator.allocateAndBind(vertexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+		uploadService.uploadBuffer(vertexBuffer, 0, vertices.data(), bufferInfo.size);
+
+		if (useGpuCulling) {
+			bufferInfo.size = sizeof(vertexIndices[0]) * vertexIndices.size();
+			bufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			if (vkCreateBuffer(device, &bufferInfo, allocator, indexBuffer.replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create index buffer!");
+			}
+			validationMessenger.setObjectName(device, VK_OBJECT_TYPE_BUFFER, indexBuffer.get(), "index buffer");
+
+			indexBufferMemory = memoryAllocator.allocateAndBind(indexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			uploadService.uploadBuffer(indexBuffer, 0, vertexIndices.data(), bufferInfo.size);
+		}
+		// One ticket for both, they're only used together
+		vertexBufferUpload = uploadService.flush();
+	}
+
+	// One object per copy of the triangle, on the grid. The radius is the farthest
+	//vertex from the triangle's origin. With settings.animateScene every object gets
+	//its own direction, spread by the golden angle, and drifts a cell every 5 seconds.
+	void createScene() {
+		float vertexRadius = 0.0f;
+		for (const Vertex& vertex : vertices) {
+			vertexRadius = std::max(vertexRadius, std::sqrt(vertex.pos[0] * vertex.pos[0] + vertex.pos[1] * vertex.pos[1]));
+		}
+
+		scene.clear();
+		for (uint32_t draw = 0; draw < settings.drawCount; draw++) {
+			DrawPushConstants placement = gridPlacement(draw);
+			uint32_t object = scene.add(placement.offset[0], placement.offset[1], placement.scale, vertexRadius * placement.scale);
+			if (settings.animateScene) {
+				float angle = 2.39996323f * draw;
+				float speed = 2.0f * placement.scale / 5.0f;
+				scene.setVelocity(object, speed * std::cos(angle), speed * std::sin(angle));
+			}
+		}
+	}
+
+	// The objects come from the scene every frame, see recordCommandBuffer
+	void initGpuCulling() {
+		if (!useGpuCulling) {
+			return;
+		}
+		gpuCulling.init(scene.size(), (uint32_t) vertexIndices.size(), frameAllocator.layout(), shaderLibrary.module("cull"),
+			pipelineCache, drawIndexedIndirectCount, settings.framesInFlight);
+		validationMessenger.setObjectName(device, VK_OBJECT_TYPE_BUFFER, gpuCulling.commandBuffer(), "indirect commands");
+	}
+
+	// Command pool, command buffer and synchronization objects for every frame in flight
+	void createFrameContexts() {
+		const QueueFamilyIndices& indices = queueFamilies;
+
+		frames.clear();
+		frames.resize(settings.framesInFlight);
+
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+		// Created signaled, so the first wait on each frame doesn't block forever
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+		for (FrameContext& frame : frames) {
+			// Command buffers are rerecorded every frame, which the transient hint is for
+			VkCommandPoolCreateInfo poolInfo = {};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.queueFamilyIndex = indices.graphicsFamily;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+			if (vkCreateCommandPool(device, &poolInfo, allocator, frame.commandPool.replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create command pool!");
+			}
+
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = frame.commandPool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandBufferCount = 1;
+
+			if (vkAllocateCommandBuffers(device, &allocInfo, &frame.commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate command buffers!");
+			}
+
+			frame.recordingSlots.clear();
+			frame.recordingSlots.resize(jobSystem.threadCount());
+			for (auto& slot : frame.recordingSlots) {
+				if (vkCreateCommandPool(device, &poolInfo, allocator, slot.commandPool.replace(device, allocator)) != VK_SUCCESS) {
+					throw std::runtime_error("failed to create command pool!");
+				}
+
+				VkCommandBufferAllocateInfo secondaryInfo = {};
+				secondaryInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+				secondaryInfo.commandPool = slot.commandPool;
+				secondaryInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+				secondaryInfo.commandBufferCount = 1;
+
+				if (vkAllocateCommandBuffers(device, &secondaryInfo, &slot.commandBuffer) != VK_SUCCESS) {
+					throw std::runtime_error("failed to allocate command buffers!");
+				}
+			}
+
+			if (vkCreateSemaphore(device, &semaphoreInfo, allocator, frame.imageAvailableSemaphore.replace(device, allocator)) != VK_SUCCESS ||
+				(!frameTimeline.isEnabled() && vkCreateFence(device, &fenceInfo, allocator, frame.inFlightFence.replace(device, allocator)) != VK_SUCCESS)) {
+				throw std::runtime_error("failed to create synchronization objects for a frame!");
+			}
+
+			// Validation messages name these instead of showing bare handles
+			std::string name = "frame " + std::to_string(&frame - frames.data());
+			validationMessenger.setObjectName(device, VK_OBJECT_TYPE_COMMAND_BUFFER, frame.commandBuffer, name + " command buffer");
+			validationMessenger.setObjectName(device, VK_OBJECT_TYPE_SEMAPHORE, frame.imageAvailableSemaphore.get(), name + " image available");
+			if (!frameTimeline.isEnabled()) {
+				validationMessenger.setObjectName(device, VK_OBJECT_TYPE_FENCE, frame.inFlightFence.get(), name + " in flight");
+			}
+		}
+
+		createRenderFinishedSemaphores();
+
+		imagesInFlight.assign(targetImageCount(), 0);
+		currentFrame = 0;
+
+		std::cout << "recording " << settings.drawCount << " draws per frame on up to " << jobSystem.threadCount() << " threads" << std::endl;
+	}
+
+	// Only when createLogicalDevice enabled descriptor indexing
+	void initBindlessDescriptors() {
+		if (!descriptorIndexingEnabled) {
+			std::cout << "bindless descriptors: no descriptor indexing on this device, disabled" << std::endl;
+			return;
+		}
+		bindlessDescriptors.init(deviceCapabilities.descriptorIndexingProperties, settings.framesInFlight);
+	}
+
+	// The files are opened on worker threads, the textures come in over the next
+	//frames. See requestTextures for who asks for which levels.
+	void initTextureStreamer() {
+		if (settings.textures.empty()) {
+			return;
+		}
+		const QueueFamilyIndices& indices = queueFamilies;
+		VkDeviceSize budget = (VkDeviceSize) settings.textureBudget * 1024 * 1024;
+		textureStreamer.init(physicalDevice, indices.graphicsFamily, indices.transferFamily, budget, settings.framesInFlight);
+		for (const std::string& path : settings.textures) {
+			textureStreamer.load(path);
+		}
+	}
+
+	// The counters are totals since the start, the sources are read on the render
+	//thread at every snapshot, see StatsRegistry
+	void initStatsExport() {
+		if (settings.statsExport.empty()) {
+			return;
+		}
+		statsRegistry.addCounter("queueSubmits.graphics", graphicsSubmits);
+		statsRegistry.addCounter("queueSubmits.transfer", uploadService.submitCounter());
+		statsRegistry.addCounter("swapchainRecreations", swapchainRecreations);
+		statsRegistry.addSource([this](StatsSnapshot& snapshot) {
+			snapshot.setCount("frameNumber", frameNumber);
+			const VkPhysicalDeviceMemoryProperties& memoryProperties = memoryAllocator.properties();
+			for (uint32_t heapIndex = 0; heapIndex < memoryProperties.memoryHeapCount; heapIndex++) {
+				std::string heap = "memory.heap" + std::to_string(heapIndex) + ".";
+				MemoryHeapStats stats = memoryAllocator.heapStats(heapIndex);
+				MemoryHeapBudget budget = memoryAllocator.heapBudget(heapIndex);
+				snapshot.setCount(heap + "blocks", stats.deviceMemoryCount);
+				snapshot.setCount(heap + "allocations", stats.allocationCount);
+				snapshot.setCount(heap + "bytesAllocated", stats.bytesAllocated);
+				snapshot.setCount(heap + "bytesUsed", stats.bytesUsed);
+				snapshot.setCount(heap + "budget", budget.budget);
+				snapshot.setCount(heap + "usage", budget.usage);
+			}
+			if (hostAllocator.allocatorMode() != HostAllocatorMode::Driver) {
+				snapshot.setCount("memory.hostBytesInUse", hostAllocator.bytesInUse());
+				snapshot.setCount("memory.hostPeakBytes", hostAllocator.peakBytes());
+			}
+			for (const auto& scope : gpuProfiler.latestScopes()) {
+				snapshot.setValue(std::string("gpuMs.") + scope.first, scope.second);
+			}
+			ValidationMessenger::Counts validation = validationMessenger.counts();
+			snapshot.setCount("validation.messages", validation.received);
+			snapshot.setCount("validation.errors", validation.errors);
+			snapshot.setCount("validation.skipped", validation.skipped);
+			snapshot.setCount("validation.dropped", validation.dropped);
+		});
+		statsRegistry.start(settings.statsExport, settings.statsExportInterval);
+	}
+
+	// The frames are submitted to the graphics queue, so that's the family whose
+	//timestamp support counts
+	void initGpuProfiler() {
+		// Each GPU of a group would have its own timestamps, for the frames it ran
+		if (deviceGroup.isActive()) {
+			std::cout << "gpu profiler: not with a device group, disabled" << std::endl;
+			return;
+		}
+		const QueueFamilyIndices& indices = queueFamilies;
+		gpuProfiler.init(physicalDevice, indices.graphicsFamily, settings.framesInFlight);
 	}
-};
 
-int main() {
-	HelloTriangleApplication app;
+	// One per swap chain image, see renderFinishedSemaphores
+	void createRenderFinishedSemaphores() {
+		VkSemaphoreCreateInfo semaphoreInfo = {};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
+		renderFinishedSemaphores.clear();
+		renderFinishedSemaphores.resize(targetImageCount());
+		for (auto& semaphore : renderFinishedSemaphores) {
+			if (vkCreateSemaphore(device, &semaphoreInfo, allocator, semaphore.replace(device, allocator)) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create synchronization objects for a frame!");
+			}
+		}
+	}
+
+	// Records the commands of one frame. The draws are split in contiguous ranges that
+	//are recorded in parallel into secondary command buffers, and the primary command
+	//buffer executes those inside the render pass.
+	void recordCommandBuffer(FrameContext& frame, uint32_t imageIndex) {
+		// The textures' new images take their bindless slots before those are written
+		Camera camera = settings.cameraPath ? cameraOnPath(frameNumber) : Camera();
+		if (textureStreamer.textureCount() > 0) {
+			requestTextures(camera);
+			textureStreamer.update(frameNumber);
+		}
+
+		// Descriptors added since the last frame are written before anything that's
+		//recorded now can use them
+		bindlessDescriptors.beginFrame(frameNumber);
+
+		// The fence was waited on, so the frame's scratch memory is free again. Anything
+		//the whole frame shares goes in there once, instead of being pushed per draw.
+		frameAllocator.beginFrame(currentFrame);
+		FrameUniforms uniforms;
+		uniforms.cameraCenter[0] = camera.center[0];
+		uniforms.cameraCenter[1] = camera.center[1];
+		uniforms.cameraZoom = camera.zoom;
+		FrameAllocator::Allocation frameUniforms = frameAllocator.pushUniform(uniforms);
+
+		if (settings.animateScene) {
+			scene.update(SCENE_STEP_SECONDS);
+		}
+
+		// Until the vertex buffer has been uploaded we only clear the screen (and
+		//without the uniforms there's nothing to draw with either)
+		// With timeline semaphores the submission waits for the upload on the GPU, see
+		//drawFrame, so it only has to be submitted
+		bool drawing = uploadService.isUsable(vertexBufferUpload) && frameUniforms.isValid();
+		// With settings.renderOnDemand, try again until the scene is there
+		if (!drawing) {
+			redrawRequested = true;
+		}
+
+		// The indirect draws get every object and are culled on the GPU, the direct
+		//draws are only recorded for the objects that are on screen
+		bool indirect = gpuCulling.isEnabled();
+		uint32_t drawCount = 0;
+		if (indirect) {
+			gpuCulling.beginFrame(currentFrame);
+			if (drawing) {
+				scene.writeInstances(gpuCulling.objects());
+				gpuCulling.flushObjects();
+				drawCount = scene.size();
+			}
+		}
+		else if (drawing) {
+			drawCount = scene.cull(camera.center, camera.zoom, visibleObjects);
+		}
+
+		uint32_t taskCount = (drawCount + MIN_DRAWS_PER_TASK - 1) / MIN_DRAWS_PER_TASK;
+		taskCount = std::min(taskCount, (uint32_t) frame.recordingSlots.size());
+		if (indirect) {
+			taskCount = std::min(taskCount, 1u);
+		}
+		// Read by the recording threads
+		if (taskCount > 0) {
+			drawPipeline = currentPipeline();
+		}
+
+		jobSystem.parallelFor(taskCount, [&](uint32_t task) {
+			uint32_t firstDraw = (uint32_t) ((uint64_t) drawCount * task / taskCount);
+			uint32_t endDraw = (uint32_t) ((uint64_t) drawCount * (task + 1) / taskCount);
+			recordDraws(frame.recordingSlots[task], imageIndex, frameUniforms, firstDraw, endDraw);
+		});
+		// Everything the secondaries allocated is written by now
+		frameAllocator.endFrame();
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		// Rerecorded before every submission
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+		// The GPUs of the group that run this frame, the secondaries go along
+		VkDeviceGroupCommandBufferBeginInfoKHR deviceGroupBeginInfo = {};
+		deviceGroupBeginInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_COMMAND_BUFFER_BEGIN_INFO_KHR;
+		deviceGroupBeginInfo.deviceMask = deviceGroup.frameDeviceMask(frameNumber);
+		if (deviceGroup.isActive()) {
+			beginInfo.pNext = &deviceGroupBeginInfo;
+		}
+
+		if (vkBeginCommandBuffer(frame.commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+
+		// The fence of this frame slot was waited on, so its previous timestamps are
+		//ready to be read
+		gpuProfiler.beginFrame(frame.commandBuffer, currentFrame, frameNumber);
+		uint32_t frameScope = gpuProfiler.beginScope(frame.commandBuffer, "frame");
+
+		VkClearValue clearColor = {};
+		clearColor.color.float32[0] = 0.0f;
+		clearColor.color.float32[1] = 0.0f;
+		clearColor.color.float32[2] = 0.0f;
+		clearColor.color.float32[3] = 1.0f;
+
+		VkRenderPassBeginInfo renderPassInfo = {};
+		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassInfo.renderPass = renderPass;
+		renderPassInfo.framebuffer = dynamicRenderingEnabled ? VK_NULL_HANDLE : swapChainFramebuffers[imageIndex].get();
+		renderPassInfo.renderArea.offset = { 0, 0 };
+		renderPassInfo.renderArea.extent = targetExtent();
+		renderPassInfo.clearValueCount = 1;
+		renderPassInfo.pClearValues = &clearColor;
+
+		// The same without a render pass. The target is in the attachment layout
+		//already, see below.
+		VkRenderingAttachmentInfoKHR colorAttachment = {};
+		colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+		colorAttachment.imageView = targetImageView(imageIndex);
+		colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+		colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+		colorAttachment.clearValue = clearColor;
+		VkRenderingInfoKHR renderingInfo = {};
+		renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+		renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR;
+		renderingInfo.renderArea = renderPassInfo.renderArea;
+		renderingInfo.layerCount = 1;
+		renderingInfo.colorAttachmentCount = 1;
+		renderingInfo.pColorAttachments = &colorAttachment;
+
+		// The target's old contents are cleared anyway. It comes from the presentation
+		//engine and goes back to it, or stays ready to be copied from when headless.
+		renderGraph.begin(frameNumber);
+		ResourceUsage targetUsage = settings.headless ? ResourceUsage::TransferSrc : ResourceUsage::Present;
+		RenderGraph::ResourceId target = renderGraph.importImage("target", targetImage(imageIndex), VK_IMAGE_ASPECT_COLOR_BIT, targetUsage, targetUsage, true);
+
+		// The culling writes this frame's draw commands before the main pass draws them.
+		//The previous frame's draws read the same buffers.
+		bool culling = indirect && taskCount > 0;
+		RenderGraph::ResourceId drawCommands = 0;
+		RenderGraph::ResourceId drawCountBuffer = 0;
+		if (culling) {
+			drawCommands = renderGraph.importBuffer("draw commands", gpuCulling.commandBuffer(), ResourceUsage::IndirectRead, ResourceUsage::None);
+			if (gpuCulling.compacts()) {
+				drawCountBuffer = renderGraph.importBuffer("draw count", gpuCulling.countBuffer(), ResourceUsage::IndirectRead, ResourceUsage::None);
+				RenderGraph::PassId resetPass = renderGraph.addPass("cull reset", RenderGraphQueue::Graphics, [&](VkCommandBuffer commandBuffer) {
+					gpuCulling.recordReset(commandBuffer);
+				});
+				renderGraph.use(resetPass, drawCountBuffer, ResourceUsage::TransferDst);
+			}
+			RenderGraph::PassId cullPass = renderGraph.addPass("cull", RenderGraphQueue::Compute, [&](VkCommandBuffer commandBuffer) {
+				uint32_t cullScope = gpuProfiler.beginScope(commandBuffer, "cull");
+				gpuCulling.recordCull(commandBuffer, frameAllocator, frameUniforms);
+				gpuProfiler.endScope(commandBuffer, cullScope);
+			});
+			renderGraph.use(cullPass, drawCommands, ResourceUsage::StorageWrite);
+			if (gpuCulling.compacts()) {
+				renderGraph.use(cullPass, drawCountBuffer, ResourceUsage::StorageWrite);
+			}
+		}
+
+		RenderGraph::PassId mainPass = renderGraph.addPass("main pass", RenderGraphQueue::Graphics, [&](VkCommandBuffer commandBuffer) {
+			// Timestamps are written from the primary command buffer, around everything
+			//the render pass does, the clear and the secondaries included
+			uint32_t mainPassScope = gpuProfiler.beginScope(commandBuffer, "main pass");
+
+			// The subpass contents come from secondary command buffers only
+			if (dynamicRenderingEnabled) {
+				pipelineFactory.beginRendering(commandBuffer, renderingInfo);
+			}
+			else {
+				vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+			}
+
+			if (taskCount > 0) {
+				std::vector<VkCommandBuffer> secondaries(taskCount);
+				for (uint32_t task = 0; task < taskCount; task++) {
+					secondaries[task] = frame.recordingSlots[task].commandBuffer;
+				}
+				vkCmdExecuteCommands(commandBuffer, taskCount, secondaries.data());
+			}
+
+			if (dynamicRenderingEnabled) {
+				pipelineFactory.endRendering(commandBuffer);
+			}
+			else {
+				vkCmdEndRenderPass(commandBuffer);
+			}
+			gpuProfiler.endScope(commandBuffer, mainPassScope);
+		});
+		renderGraph.use(mainPass, target, ResourceUsage::ColorAttachment);
+		if (culling) {
+			renderGraph.use(mainPass, drawCommands, ResourceUsage::IndirectRead);
+			if (gpuCulling.compacts()) {
+				renderGraph.use(mainPass, drawCountBuffer, ResourceUsage::IndirectRead);
+			}
+		}
+
+		if (settings.headless && offscreenTarget.hasReadback() && frameNumber % settings.readbackInterval == 0) {
+			// The host is done with the buffer, its fence was waited on before writing
+			//the last copy out
+			RenderGraph::ResourceId readbackBuffer = renderGraph.importBuffer("readback", offscreenTarget.readbackBuffer(imageIndex),
+				ResourceUsage::HostRead, ResourceUsage::HostRead);
+			RenderGraph::PassId readbackPass = renderGraph.addPass("readback", RenderGraphQueue::Graphics, [&](VkCommandBuffer commandBuffer) {
+				offscreenTarget.recordReadback(commandBuffer, imageIndex, frameNumber);
+			});
+			renderGraph.use(readbackPass, target, ResourceUsage::TransferSrc);
+			renderGraph.use(readbackPass, readbackBuffer, ResourceUsage::TransferDst);
+		}
+
+		renderGraph.execute(frame.commandBuffer);
+
+		gpuProfiler.endScope(frame.commandBuffer, frameScope);
+
+		if (vkEndCommandBuffer(frame.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
+
+	// Records draws [firstDraw, endDraw) of visibleObjects, or the indirect draws,
+	//into the slot's secondary command buffer. Runs on a job system thread, and only
+	//touches the slot and read only state.
+	void recordDraws(RecordingSlot& slot, uint32_t imageIndex, const FrameAllocator::Allocation& frameUniforms, uint32_t firstDraw, uint32_t endDraw) {
+		vkResetCommandPool(device, slot.commandPool, 0);
+
+		// A secondary command buffer that continues a render pass has to say which one,
+		//the framebuffer is optional but lets the driver optimize. With dynamic
+		//rendering it gives the attachment formats instead.
+		VkCommandBufferInheritanceInfo inheritanceInfo = {};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		VkFormat colorFormat = targetFormat();
+		VkCommandBufferInheritanceRenderingInfoKHR inheritanceRenderingInfo = {};
+		inheritanceRenderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+		inheritanceRenderingInfo.colorAttachmentCount = 1;
+		inheritanceRenderingInfo.pColorAttachmentFormats = &colorFormat;
+		inheritanceRenderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+		if (dynamicRenderingEnabled) {
+			inheritanceInfo.pNext = &inheritanceRenderingInfo;
+		}
+		else {
+			inheritanceInfo.renderPass = renderPass;
+			inheritanceInfo.subpass = 0;
+			inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+		}
+
+		VkCommandBufferBeginInfo beginInfo = {};
+		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+		if (vkBeginCommandBuffer(slot.commandBuffer, &beginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
+
+		// Pipeline and dynamic state are not inherited from the primary command buffer,
+		//every secondary sets its own
+		vkCmdBindPipeline(slot.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, drawPipeline);
+		// Descriptors aren't inherited either, but it's one bind for all the draws
+		frameAllocator.bindUniforms(slot.commandBuffer, pipelineLayout, 0, frameUniforms);
+		bindlessDescriptors.bind(slot.commandBuffer, pipelineLayout, 1);
+
+		// The indirect draws get their placements from the object buffer in binding 1
+		VkBuffer vertexBuffers[] = { vertexBuffer, gpuCulling.isEnabled() ? gpuCulling.objectBuffer() : VK_NULL_HANDLE };
+		VkDeviceSize offsets[] = { 0, 0 };
+		vkCmdBindVertexBuffers(slot.commandBuffer, 0, gpuCulling.isEnabled() ? 2 : 1, vertexBuffers, offsets);
+
+		VkViewport viewport = {};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = (float) targetExtent().width;
+		viewport.height = (float) targetExtent().height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(slot.commandBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor = {};
+		scissor.offset = { 0, 0 };
+		scissor.extent = targetExtent();
+		vkCmdSetScissor(slot.commandBuffer, 0, 1, &scissor);
+
+		if (gpuCulling.isEnabled()) {
+			// Every copy the culling kept, in one call
+			vkCmdBindIndexBuffer(slot.commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+			gpuCulling.recordDraws(slot.commandBuffer);
+		}
+		else {
+			for (uint32_t draw = firstDraw; draw < endDraw; draw++) {
+				uint32_t object = visibleObjects[draw];
+				DrawPushConstants pushConstants;
+				pushConstants.offset[0] = scene.offsetX(object);
+				pushConstants.offset[1] = scene.offsetY(object);
+				pushConstants.scale = scene.objectScale(object);
+				vkCmdPushConstants(slot.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(pushConstants), &pushConstants);
+
+				// All vertices, 1 instance, starting at vertex 0 and instance 0
+				vkCmdDraw(slot.commandBuffer, (uint32_t) vertices.size(), 1, 0, 0);
+			}
+		}
+
+		if (vkEndCommandBuffer(slot.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record command buffer!");
+		}
+	}
+
+	// The copies of the triangle are laid out on a square grid filling the screen,
+	//the camera in the frame uniforms moves over it
+	DrawPushConstants gridPlacement(uint32_t draw) const {
+		uint32_t gridSize = (uint32_t) std::ceil(std::sqrt((double) settings.drawCount));
+		float cellSize = 2.0f / gridSize;
+
+		DrawPushConstants placement;
+		placement.offset[0] = -1.0f + cellSize * (draw % gridSize + 0.5f);
+		placement.offset[1] = -1.0f + cellSize * (draw / gridSize + 0.5f);
+		placement.scale = 1.0f / gridSize;
+		return placement;
+	}
+
+	// Where the view is over the grid of draws: the point at the middle of the screen
+	//and how much it's magnified
+	struct Camera {
+		float center[2] = { 0.0f, 0.0f };
+		float zoom = 1.0f;
+	};
+
+	// The fixed camera path of settings.cameraPath. It only depends on the frame
+	//number, so the same frame always looks the same: a slow figure eight over the
+	//grid while zooming in and out every 600 frames.
+	static Camera cameraOnPath(uint64_t frame) {
+		const double pi = 3.14159265358979323846;
+		double t = (double) (frame % 600) / 600.0 * 2.0 * pi;
+		Camera camera;
+		camera.center[0] = (float) (0.5 * std::sin(t));
+		camera.center[1] = (float) (0.5 * std::sin(2.0 * t));
+		camera.zoom = (float) (1.5 + 0.5 * std::cos(t));
+		return camera;
+	}
+
+	// Texture t goes with the objects t, t + textureCount()... of the grid, and asks for
+	//the level that object t needs at its size on screen. The shaders don't sample the
+	//textures yet, they're in their bindless slots for when they do.
+	void requestTextures(const Camera& camera) {
+		if (scene.size() == 0) {
+			return;
+		}
+		float width = (float) targetExtent().width;
+		for (TextureId id = 0; id < (TextureId) textureStreamer.textureCount(); id++) {
+			uint32_t object = id % scene.size();
+			float pixels = scene.objectScale(object) * camera.zoom * 0.5f * width;
+			textureStreamer.request(id, textureStreamer.levelFor(id, pixels), frameNumber);
+		}
+	}
+
+	#ifdef VULKANIZE_BENCHMARK
+	// Everything the run measured, as JSON in settings.benchmarkOutput
+	void writeBenchmarkReport(double runSeconds) {
+		BenchmarkReport report;
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		report.setDevice(properties);
+		report.setWorkload(settings.headless ? "headless" : "windowed", (uint32_t) frameNumber, settings.drawCount,
+			settings.framesInFlight, jobSystem.threadCount(), targetExtent());
+		report.setStartup(startupTimings);
+		report.setRun(frameNumber, runSeconds);
+
+		for (int i = 0; i < FrameStats::METRIC_COUNT; i++) {
+			FrameStats::Metric metric = (FrameStats::Metric) i;
+			report.addMetric(FrameStats::metricName(metric), frameStats.total(metric));
+		}
+
+		const VkPhysicalDeviceMemoryProperties& memoryProperties = memoryAllocator.properties();
+		for (uint32_t heapIndex = 0; heapIndex < memoryProperties.memoryHeapCount; heapIndex++) {
+			bool deviceLocal = (memoryProperties.memoryHeaps[heapIndex].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+			report.addHeap(heapIndex, deviceLocal, memoryAllocator.heapStats(heapIndex));
+		}
+		if (hostAllocator.allocatorMode() != HostAllocatorMode::Driver) {
+			report.setHostMemory(hostAllocator.bytesInUse(), hostAllocator.peakBytes());
+		}
+
+		report.write(settings.benchmarkOutput);
+	}
+	#endif
+
+	// Blocks until the frame whose submission signals value is done. Without a
+	//timeline that's the fence of the slot that submitted it, unless the slot has been
+	//reused since, which already waited for it.
+	void waitForFrame(uint64_t value) {
+		if (frameTimeline.isEnabled()) {
+			frameTimeline.wait(value);
+			return;
+		}
+		for (FrameContext& frame : frames) {
+			if (value != 0 && frame.submittedValue == value) {
+				vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+			}
+		}
+	}
+
+	// Acquire an image, record and submit the frame's commands, then present. The 
+	//only place the CPU waits is on the frame that last used this frame slot, which is
+	//framesInFlight frames old.
+	void drawFrame() {
+		FrameContext& frame = frames[currentFrame];
+
+		// Anything that was queued for upload since the last frame goes to the 
+		//transfer queue now, from the thread that also submits the frames (the 
+		//transfer queue may be the graphics queue)
+		uploadService.flush();
+
+		if (swapChainOutdated && !recreateSwapChain()) {
+			return;
+		}
+
+		// Wait until the GPU is done with the previous use of this frame's resources
+		{
+			FrameStats::Scope scope(frameStats, FrameStats::FenceWait);
+			if (frameTimeline.isEnabled()) {
+				frameTimeline.wait(frame.submittedValue);
+			}
+			else {
+				vkWaitForFences(device, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+			}
+		}
+		releaseRetiredSwapchains();
+
+		uint32_t imageIndex;
+		VkResult result = VK_SUCCESS;
+		if (settings.headless) {
+			// Every frame slot has its own offscreen image. The frame that last used it
+			//is done, so its copy (if it made one) can be written out.
+			imageIndex = currentFrame;
+			offscreenTarget.writeReadback(imageIndex);
+		}
+		else {
+			FrameStats::Scope scope(frameStats, FrameStats::Acquire);
+			result = vkAcquireNextImageKHR(device, swapChain.handle(), UINT64_MAX, frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+		}
+		// The swap chain can't be presented to anymore, try again with a new one next
+		//frame. Nothing was signaled and the fence wasn't reset, so the frame slot is
+		//untouched. A suboptimal swap chain still works, it's replaced after presenting.
+		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+			swapChainOutdated = true;
+			return;
+		}
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+			throw std::runtime_error("failed to acquire swap chain image!");
+		}
+
+		// If a previous frame is still rendering to this image, we have to wait for it
+		waitForFrame(imagesInFlight[imageIndex]);
+		uint64_t frameValue = frameNumber + 1;
+		imagesInFlight[imageIndex] = frameValue;
+
+		// Only reset the fence once we know we'll submit work that signals it
+		if (!frameTimeline.isEnabled()) {
+			vkResetFences(device, 1, &frame.inFlightFence);
+		}
+
+		{
+			FrameStats::Scope scope(frameStats, FrameStats::Record);
+			// The recording slots' pools are reset by the tasks that record into them
+			vkResetCommandPool(device, frame.commandPool, 0);
+			recordCommandBuffer(frame, imageIndex);
+		}
+
+		// Color writes must wait for the image to be available, everything before 
+		//that can already start. Offscreen images are neither acquired nor presented,
+		//the fence or the timeline is all the synchronization they need.
+		// The swap chain only takes binary semaphores.
+		SemaphoreSubmit semaphores;
+		if (!settings.headless) {
+			semaphores.wait(frame.imageAvailableSemaphore, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+			semaphores.signal(renderFinishedSemaphores[imageIndex]);
+		}
+		if (frameTimeline.isEnabled()) {
+			semaphores.signal(frameTimeline.handle(), frameValue);
+		}
+		// The vertex buffer may still be copied on the transfer queue
+		uploadService.addGpuWait(vertexBufferUpload, semaphores, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &frame.commandBuffer;
+
+		// Same device mask as the command buffer was recorded with. The fence is
+		//signaled once all GPUs in it are done.
+		uint32_t deviceMask = deviceGroup.frameDeviceMask(frameNumber);
+		VkDeviceGroupSubmitInfoKHR deviceGroupSubmitInfo = {};
+		deviceGroupSubmitInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO_KHR;
+		deviceGroupSubmitInfo.commandBufferCount = 1;
+		deviceGroupSubmitInfo.pCommandBufferDeviceMasks = &deviceMask;
+		if (deviceGroup.isActive()) {
+			submitInfo.pNext = &deviceGroupSubmitInfo;
+		}
+		semaphores.apply(submitInfo);
+
+		{
+			FrameStats::Scope scope(frameStats, FrameStats::Submit);
+			VkFence fence = frameTimeline.isEnabled() ? VK_NULL_HANDLE : frame.inFlightFence.get();
+			if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit draw command buffer!");
+			}
+		}
+		graphicsSubmits.add();
+		frame.submittedValue = frameValue;
+		deviceGroup.countFrame(deviceMask);
+		frameNumber++;
+
+		if (settings.headless) {
+			currentFrame = (currentFrame + 1) % settings.framesInFlight;
+			return;
+		}
+
+		VkSwapchainKHR swapChains[] = { swapChain.handle() };
+
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &renderFinishedSemaphores[imageIndex];
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = swapChains;
+		presentInfo.pImageIndices = &imageIndex;
+		framePacer.applyPresentTime(presentInfo);
+
+		// The image was still presented when the swap chain is suboptimal, and even 
+		//when it's out of date the semaphores have been consumed, so either way the
+		//frame is done and the swap chain gets recreated before the next one
+		{
+			FrameStats::Scope scope(frameStats, FrameStats::Present);
+			result = vkQueuePresentKHR(presentQueue, &presentInfo);
+		}
+		frameStats.presented();
+		framePacer.collectTimings();
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+			swapChainOutdated = true;
+		}
+		else if (result != VK_SUCCESS) {
+			throw std::runtime_error("failed to present swap chain image!");
+		}
+
+		currentFrame = (currentFrame + 1) % settings.framesInFlight;
+	}
+};
+
+int main(int argc, char** argv) {
 	try {
+		AppSettings defaults;
+		#ifdef VULKANIZE_BENCHMARK
+		// A fixed workload that's the same on every machine: no window, a set number of
+		//frames, the camera on its path and no pipeline cache carried over from the
+		//last run. Any option can still be overridden.
+		defaults.headless = true;
+		defaults.frameCount = 1000;
+		defaults.cameraPath = true;
+		defaults.statsInterval = 0;
+		defaults.pipelineCachePath = "";
+		#endif
+		HelloTriangleApplication app(parseSettings(argc, argv, defaults));
 		app.run();
 	}
 	catch (const std::runtime_error& e) {
@@ -0,0 +1,9 @@
+@echo off
+rem Compiles the GLSL shaders to SPIR-V, which is what vkCreateShaderModule takes.
+rem Runs before every build (see the pre-build event), the .spv files are read at
+rem runtime from the working directory (shaders/vert.spv, shaders/frag.spv and so on).
+cd /d "%~dp0"
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V shader.vert -o vert.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V shader.frag -o frag.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V instanced.vert -o instanced_vert.spv || exit /b 1
+"%VULKAN_SDK%\Bin\glslangValidator.exe" -V cull.comp -o cull.spv || exit /b 1
@@ -0,0 +1,30 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// shader.vert for the indirect draws: where the copy of the triangle goes comes
+//from per instance attributes instead of push constants, one instance per draw
+//command (see GpuCulling.h)
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+// The objects the culling reads (see SceneInstance in SceneStore.h)
+layout(location = 2) in vec2 instanceOffset;
+layout(location = 3) in float instanceScale;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+layout(location = 0) out vec3 fragColor;
+
+// The same for every draw of a frame (see FrameUniforms in main.cpp)
+layout(set = 0, binding = 0) uniform FrameUniforms {
+	vec2 cameraCenter;
+	float cameraZoom;
+} frame;
+
+void main() {
+	vec2 position = inPosition * instanceScale + instanceOffset;
+	gl_Position = vec4((position - frame.cameraCenter) * frame.cameraZoom, 0.0, 1.0);
+	fragColor = inColor;
+}
@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+// Set per pipeline (see Shading in Settings.h): 0 draws the colors, 1 their
+//luminance. The branch is folded away when the pipeline is compiled.
+layout(constant_id = 0) const uint SHADING = 0;
+
+void main() {
+	vec3 color = fragColor;
+	if (SHADING == 1) {
+		color = vec3(dot(fragColor, vec3(0.2126, 0.7152, 0.0722)));
+	}
+	outColor = vec4(color, 1.0);
+}
@@ -0,0 +1,32 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// The triangle comes from the vertex buffer (see Vertex in main.cpp)
+// https://vulkan-tutorial.com/Vertex_buffers/Vertex_input_description
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+out gl_PerVertex {
+	vec4 gl_Position;
+};
+
+layout(location = 0) out vec3 fragColor;
+
+// Where this copy of the triangle goes on the grid, set per draw with vkCmdPushConstants
+layout(push_constant) uniform PushConstants {
+	vec2 offset;
+	float scale;
+} pushConstants;
+
+// The same for every draw of a frame (see FrameUniforms in main.cpp)
+layout(set = 0, binding = 0) uniform FrameUniforms {
+	vec2 cameraCenter;
+	float cameraZoom;
+} frame;
+
+void main() {
+	vec2 position = inPosition * pushConstants.scale + pushConstants.offset;
+	gl_Position = vec4((position - frame.cameraCenter) * frame.cameraZoom, 0.0, 1.0);
+	fragColor = inColor;
+}